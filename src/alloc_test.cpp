@@ -0,0 +1,212 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_alloc_test - checks, that executing instructions never allocates:
+ * every program below is run by cycle() and by run() under every quirk
+ * profile, counting operator new calls. Programs, that fault or run off the
+ * end of the RAM, must stop the VM with the expected fault, still without
+ * allocating. Loading a state of any profile into a VM of any other one
+ * mustn't allocate either (EnvPool does that in its workers).
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "quirks.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+std::size_t allocations = 0;
+}
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace {
+constexpr uint64_t cycles = 100'000;
+
+struct Program {
+    const char *                 name;
+    std::vector<ChipVM::instr_t> instrs;
+    bool                         i_at_end = false; // I points to the last byte
+    bool                         stops    = false; // faults or halts
+    Fault                        fault    = Fault::none;
+};
+
+const std::vector<Program> programs{
+    {"mixed",
+     {
+         0x1206, // JP 0x206
+         0x7101, // ADD V1, 1
+         0x00EE, // RET
+         0x6A05, // LD VA, 5
+         0xA300, // LD I, 0x300
+         0xFA33, // LD B, VA
+         0xF255, // LD [I], V2
+         0xF265, // LD V2, [I]
+         0xC0FF, // RND V0, 0xFF
+         0xD015, // DRW V0, V1, 5
+         0xF015, // LD DT, V0
+         0xF018, // LD ST, V0
+         0xF107, // LD V1, DT
+         0xF00A, // LD V0, K
+         0x2202, // CALL 0x202
+         0x00FF, // HIGH
+         0x00C1, // SCD 1
+         0x00FB, // SCR
+         0x00FE, // LOW
+         0x00E0, // CLS
+         0x1206  // JP 0x206
+     }},
+    {"delay timer wait",
+     {
+         0x603C, // LD V0, 60
+         0xF015, // LD DT, V0
+         0xF107, // LD V1, DT
+         0x3100, // SE V1, 0
+         0x1204, // JP 0x204
+         0x1200  // JP 0x200
+     }},
+    {"key poll", {0xE09E, 0x1200}}, // SKP V0; JP 0x200
+    {"jump to itself", {0x1200}},
+    {"stack overflow", {0x2200}, false, true, Fault::stack_overflow},
+    {"stack underflow", {0x00EE}, false, true, Fault::stack_underflow},
+    {"segmentation fault", {0xF555}, true, true, Fault::segmentation_fault},
+    {"invalid key", {0x6020, 0xE09E}, false, true, Fault::invalid_key},
+    {"end of RAM", {0x1FFE}, false, true, Fault::none}};
+
+constexpr QuirkProfile profiles[]{
+    QuirkProfile::chip8,
+    QuirkProfile::chip48,
+    QuirkProfile::superchip,
+    QuirkProfile::xochip,
+    QuirkProfile::legacy};
+
+std::unique_ptr<ChipVM> make_vm(QuirkProfile quirks, const Program &program)
+{
+    auto vm = std::make_unique<ChipVM>(
+        std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+        std::make_shared<HeadlessImpl::NullKeyboardDriver>(),
+        std::make_shared<HeadlessImpl::NullSoundDriver>());
+
+    vm->set_quirks(quirks);
+    vm->timer_mode = TimerMode::virtual_time;
+    vm->seed_random(1);
+
+    auto dst = vm->ram.begin() + C8Consts::USER_SPACE;
+    for (const ChipVM::instr_t instr : program.instrs) {
+        *dst++ = instr >> 8;
+        *dst++ = instr & 0xFF;
+    }
+
+    if (program.i_at_end)
+        vm->i_reg = static_cast<uint16_t>(vm->ram.size() - 1);
+
+    return vm;
+}
+
+/** \return false if the program has allocated or stopped unexpectedly */
+bool check(QuirkProfile quirks, const Program &program, bool use_run)
+{
+    auto vm = make_vm(quirks, program);
+
+    const std::size_t before = allocations;
+    if (use_run) {
+        vm->run(cycles);
+    }
+    else {
+        for (uint64_t i = 0; i < cycles; ++i)
+            vm->cycle();
+    }
+
+    const std::size_t allocated = allocations - before;
+
+    const std::string name = std::string(quirk_profile_name(quirks)) + ' '
+                             + program.name + (use_run ? " (run)" : "");
+
+    if (allocated > 0) {
+        std::cerr << name << ": " << allocated << " allocations\n";
+        return false;
+    }
+
+    if (vm->working == program.stops || vm->fault != program.fault) {
+        std::cerr << name << ": " << (vm->working ? "working" : "stopped")
+                  << ", fault: " << fault_message(vm->fault) << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+/** \return false if loading the state has allocated or failed */
+bool check_load_state(QuirkProfile from, QuirkProfile to)
+{
+    auto       vm    = make_vm(from, programs.front());
+    const auto state = make_vm(to, programs.front())->save_state();
+
+    const std::size_t before    = allocations;
+    const bool        loaded    = vm->load_state(state.data(), state.size());
+    const std::size_t allocated = allocations - before;
+
+    if (!loaded || allocated > 0) {
+        std::cerr << "load_state " << quirk_profile_name(from) << " -> "
+                  << quirk_profile_name(to) << ": "
+                  << (loaded ? "loaded" : "failed") << ", " << allocated
+                  << " allocations\n";
+        return false;
+    }
+
+    return true;
+}
+} // namespace
+
+int main()
+{
+    bool passed = true;
+
+    for (const QuirkProfile quirks : profiles)
+        for (const Program &program : programs)
+            for (const bool use_run : {false, true})
+                passed &= check(quirks, program, use_run);
+
+    for (const QuirkProfile from : profiles)
+        for (const QuirkProfile to : profiles)
+            passed &= check_load_state(from, to);
+
+    return passed ? 0 : 1;
+}
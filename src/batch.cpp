@@ -0,0 +1,536 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite-batch - runs lots of ROMs headless and unthrottled, reporting
+ * the results as CSV:
+ *
+ *   granite-batch [--cycles N] [--time SECONDS] [--cycles-per-tick N]
+ *                 [--threads N] [--jit] [--output FILE] [--trace DIR]
+ *                 [--frames DIR] [--keys SCRIPT] [--wav DIR] [--seed N]
+ *                 [--quirks chip8|chip48|superchip|xochip|legacy]
+ *                 [--hash HEX]... <ROM, directory or pack>...
+ *
+ * Packs (*.grpk, see granite-pack) run all of their ROMs, or only the ones
+ * with the content hashes given by --hash. ROMs of a pack run with the
+ * quirks and instructions per frame stored in it.
+ *
+ * Timers are run in virtual time, i.e. they are decremented once per
+ * --cycles-per-tick executed instructions, and the random generator is
+ * seeded with the content hash of the ROM (or with --seed), so results are
+ * reproducible. The seed of every ROM is reported along with the results.
+ *
+ * --frames, --keys and --wav use the headless drivers to dump changed
+ * frames, replay a key script and record the sound of every ROM.
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "jit.hpp"
+#include "mapped_file.hpp"
+#include "quirks.hpp"
+#include "rom_pack.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace std::chrono;
+
+namespace {
+struct Options {
+    uint64_t                 cycles_budget = 10'000'000;
+    std::optional<double>    time_budget; // seconds
+    std::optional<uint32_t>  cycles_per_tick;
+    std::size_t              threads = 0;
+    bool                     use_jit = false;
+    std::string              output;
+    std::string              trace_dir; // trace every ROM into it
+    std::string              frames_dir;
+    std::string              keys_file;
+    std::string              wav_dir;
+    std::optional<uint64_t>  seed; // content hash of the ROM by default
+    QuirkProfile             quirks = default_quirk_profile;
+    std::vector<uint64_t>    hashes; // ROMs to run from the packs
+    std::vector<std::string> roms;
+
+    std::vector<HeadlessImpl::ScriptedKeyboardDriver::KeyEvent> key_script;
+};
+
+struct Job {
+    std::string            name; // as reported
+    fs::path               path; // loaded unless packed
+    std::optional<RomInfo> packed;
+    std::string            output_name; // of the outputs, unique per job
+};
+
+struct Result {
+    std::string status = "ok"; // ok, halted, fault or error
+    std::string fault;
+    uint64_t    cycles  = 0;
+    double      wall_ms = 0;
+    uint64_t    fb_hash = 0;
+    uint64_t    seed    = 0; // of the random generator
+    ExecStats   stats;
+};
+
+void print_usage()
+{
+    std::cerr << "Usage: granite-batch [--cycles N] [--time SECONDS]"
+                 " [--cycles-per-tick N] [--threads N] [--jit]"
+                 " [--output FILE] [--trace DIR] [--frames DIR]"
+                 " [--keys SCRIPT] [--wav DIR] [--seed N]"
+                 " [--quirks chip8|chip48|superchip|xochip|legacy]"
+                 " [--hash HEX]... <ROM, directory or pack>...\n";
+}
+
+std::optional<Options> parse_args(int argc, char *argv[])
+{
+    Options options;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool        has_value = i + 1 < argc;
+
+            if (arg == "--cycles" && has_value)
+                options.cycles_budget = std::stoull(argv[++i]);
+            else if (arg == "--time" && has_value)
+                options.time_budget = std::stod(argv[++i]);
+            else if (arg == "--cycles-per-tick" && has_value)
+                options.cycles_per_tick = std::stoul(argv[++i]);
+            else if (arg == "--threads" && has_value)
+                options.threads = std::stoul(argv[++i]);
+            else if (arg == "--jit")
+                options.use_jit = true;
+            else if (arg == "--output" && has_value)
+                options.output = argv[++i];
+            else if (arg == "--trace" && has_value)
+                options.trace_dir = argv[++i];
+            else if (arg == "--frames" && has_value)
+                options.frames_dir = argv[++i];
+            else if (arg == "--keys" && has_value)
+                options.keys_file = argv[++i];
+            else if (arg == "--wav" && has_value)
+                options.wav_dir = argv[++i];
+            else if (arg == "--seed" && has_value)
+                options.seed = std::stoull(argv[++i]);
+            else if (arg == "--quirks" && has_value) {
+                const auto quirks = parse_quirk_profile(argv[++i]);
+                if (!quirks)
+                    return std::nullopt;
+
+                options.quirks = *quirks;
+            }
+            else if (arg == "--hash" && has_value)
+                options.hashes.push_back(std::stoull(argv[++i], nullptr, 16));
+            else if (arg.starts_with("--"))
+                return std::nullopt;
+            else
+                options.roms.push_back(arg);
+        }
+    }
+    catch (const std::logic_error &) {
+        return std::nullopt;
+    }
+
+    if (options.roms.empty())
+        return std::nullopt;
+
+    return options;
+}
+
+void add_packed_rom(
+    std::vector<Job> &jobs,
+    const fs::path &  pack_path,
+    const RomInfo &   rom)
+{
+    const std::string name(rom.name);
+
+    jobs.push_back({pack_path.string() + ':' + name, name, rom, {}});
+}
+
+/*
+ * Packs are opened into the packs, their ROMs are referred by the jobs.
+ * Throws std::runtime_error if a pack is malformed or a hash isn't found in
+ * any of them.
+ */
+std::vector<Job> collect_roms(
+    const Options &                        options,
+    std::vector<std::unique_ptr<RomPack>> &packs)
+{
+    std::vector<Job>      jobs;
+    std::vector<uint64_t> missing = options.hashes;
+
+    for (const auto &arg : options.roms) {
+        if (fs::path(arg).extension() == ".grpk") {
+            const RomPack &pack =
+                *packs.emplace_back(std::make_unique<RomPack>(arg));
+
+            if (options.hashes.empty()) {
+                for (std::size_t i = 0; i < pack.size(); ++i)
+                    add_packed_rom(jobs, arg, pack.rom(i));
+            }
+            else {
+                for (const uint64_t hash : options.hashes)
+                    if (const auto rom = pack.find(hash)) {
+                        add_packed_rom(jobs, arg, *rom);
+                        std::erase(missing, hash);
+                    }
+            }
+            continue;
+        }
+
+        if (!fs::is_directory(arg)) {
+            jobs.push_back({arg, arg, std::nullopt, {}});
+            continue;
+        }
+
+        std::vector<fs::path> dir_roms;
+        for (const auto &entry : fs::recursive_directory_iterator(arg))
+            if (entry.is_regular_file())
+                dir_roms.push_back(entry.path());
+
+        std::sort(dir_roms.begin(), dir_roms.end());
+        for (const fs::path &path : dir_roms)
+            jobs.push_back({path.string(), path, std::nullopt, {}});
+    }
+
+    if (!missing.empty()) {
+        std::ostringstream message;
+        message << "No ROM with hash " << std::hex << std::setfill('0')
+                << std::setw(16) << missing.front() << " in the packs";
+
+        throw std::runtime_error(message.str());
+    }
+
+    // ROMs from different directories or packs may have the same name, and
+    // run in parallel, so the outputs are prefixed with the job number
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        std::ostringstream name;
+        name << std::setfill('0') << std::setw(4) << i << '_'
+             << jobs[i].path.filename().string();
+
+        jobs[i].output_name = name.str();
+    }
+
+    return jobs;
+}
+
+void load_rom(ChipVM &vm, std::span<const uint8_t> image)
+{
+    if (image.size() > vm.ram.size() - C8Consts::USER_SPACE)
+        throw std::runtime_error("Image doesn't fit the RAM");
+
+    std::copy(
+        image.begin(), image.end(), vm.ram.begin() + C8Consts::USER_SPACE);
+}
+
+// FNV-1a over the packed rows of all the planes and the resolution
+uint64_t hash_display(const Framebuffer &display)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+
+    const auto hash_word = [&hash](Framebuffer::word_t word) {
+        for (std::size_t i = 0; i < sizeof word; ++i) {
+            hash ^= word & 0xFF;
+            hash *= 0x100000001B3;
+            word >>= 8;
+        }
+    };
+
+    for (const auto &plane : display.data())
+        for (const auto &row : plane)
+            for (const Framebuffer::word_t word : row)
+                hash_word(word);
+
+    hash_word(display.hires());
+
+    return hash;
+}
+
+Result run_rom(const Job &job, const Options &options)
+{
+    using namespace HeadlessImpl;
+
+    static const auto null_display_driver =
+        std::make_shared<NullDisplayDriver>();
+    static const auto null_keyboard_driver =
+        std::make_shared<NullKeyboardDriver>();
+    static const auto null_sound_driver = std::make_shared<NullSoundDriver>();
+
+    Result                     result;
+    std::shared_ptr<ChipVM>    vm;
+    std::unique_ptr<Tracer>    tracer;
+    std::unique_ptr<JitEngine> jit;
+
+    try {
+        std::shared_ptr<IDisplayDriver> display_driver = null_display_driver;
+        if (!options.frames_dir.empty()) {
+            const fs::path frames_path =
+                fs::path(options.frames_dir) / job.output_name;
+            fs::create_directories(frames_path);
+
+            display_driver =
+                std::make_shared<FrameDumpDisplayDriver>(frames_path.string());
+        }
+
+        std::shared_ptr<ScriptedKeyboardDriver> scripted_keyboard_driver;
+        if (!options.keys_file.empty())
+            scripted_keyboard_driver =
+                std::make_shared<ScriptedKeyboardDriver>(options.key_script);
+
+        std::shared_ptr<WavSoundDriver> wav_sound_driver;
+        if (!options.wav_dir.empty()) {
+            fs::path wav_path = fs::path(options.wav_dir) / job.output_name;
+            wav_path += ".wav";
+
+            wav_sound_driver =
+                std::make_shared<WavSoundDriver>(wav_path.string());
+        }
+
+        vm = std::make_shared<ChipVM>(
+            display_driver,
+            scripted_keyboard_driver
+                ? std::shared_ptr<IKeyboardDriver>(scripted_keyboard_driver)
+                : null_keyboard_driver,
+            wav_sound_driver
+                ? std::shared_ptr<ISoundDriver>(wav_sound_driver)
+                : null_sound_driver);
+
+        if (scripted_keyboard_driver)
+            scripted_keyboard_driver->attach(*vm);
+        if (wav_sound_driver)
+            wav_sound_driver->attach(*vm);
+
+        // Timers follow the executed instructions, not the wall clock
+        vm->timer_mode = TimerMode::virtual_time;
+        if (options.cycles_per_tick)
+            vm->cycles_per_tick = std::max(1U, *options.cycles_per_tick);
+        else if (job.packed && job.packed->ipf)
+            vm->cycles_per_tick = job.packed->ipf;
+
+        std::optional<MappedFile> file;
+        std::span<const uint8_t>  image;
+        if (job.packed) {
+            vm->set_quirks(job.packed->quirks);
+            image = job.packed->image;
+        }
+        else {
+            vm->set_quirks(options.quirks);
+            image = file.emplace(job.path.string()).span();
+        }
+
+        load_rom(*vm, image);
+
+        // VMs seed themselves from std::random_device otherwise
+        result.seed = options.seed ? *options.seed : rom_hash(image);
+        vm->seed_random(result.seed);
+
+        if (!options.trace_dir.empty()) {
+            fs::path trace_path = fs::path(options.trace_dir) / job.output_name;
+            trace_path += ".trace";
+
+            tracer     = std::make_unique<Tracer>(trace_path.string());
+            vm->tracer = tracer.get();
+        }
+
+        if (options.use_jit)
+            jit = std::make_unique<JitEngine>(*vm);
+    }
+    catch (const std::exception &ex) {
+        result.status = "error";
+        result.fault  = ex.what();
+        return result;
+    }
+
+    // Time budget is checked once per that many cycles. Frames are dumped
+    // once per 60 Hz tick, like they are presented normally.
+    const uint64_t chunk =
+        options.frames_dir.empty() ? 4096 : vm->cycles_per_tick;
+
+    const auto start = steady_clock::now();
+    const auto deadline =
+        options.time_budget
+            ? start + duration_cast<steady_clock::duration>(
+                  duration<double>(*options.time_budget))
+            : steady_clock::time_point::max();
+
+    try {
+        while (vm->working && result.cycles < options.cycles_budget) {
+            const uint64_t count =
+                std::min(chunk, options.cycles_budget - result.cycles);
+
+            // Both fast-forward the idle loops
+            if (jit)
+                result.cycles += jit->run(count);
+            else
+                result.cycles += vm->run(count);
+
+            vm->present();
+
+            if (steady_clock::now() >= deadline)
+                break;
+        }
+
+        if (vm->fault != Fault::none) {
+            result.status = "fault";
+            result.fault  = fault_message(vm->fault);
+        }
+        else if (!vm->working) {
+            result.status = "halted";
+        }
+    }
+    catch (const std::exception &ex) {
+        result.status = "fault";
+        result.fault  = ex.what();
+    }
+
+    result.wall_ms =
+        duration<double, std::milli>(steady_clock::now() - start).count();
+    result.fb_hash = hash_display(vm->display);
+    result.stats   = vm->stats();
+
+    return result;
+}
+
+std::string csv_quote(const std::string &str)
+{
+    std::string quoted = "\"";
+
+    for (const char c : str) {
+        if (c == '"')
+            quoted += '"';
+        quoted += c;
+    }
+
+    return quoted + '"';
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto options = parse_args(argc, argv);
+    if (!options) {
+        print_usage();
+        return 1;
+    }
+
+    if (options->use_jit && !JitEngine::supported()) {
+        std::cerr << "JIT is not supported on this platform\n";
+        return 1;
+    }
+
+    if (!options->keys_file.empty()) {
+        std::ifstream script(options->keys_file);
+        if (!script) {
+            std::cerr << "Failed to open " << options->keys_file << '\n';
+            return 1;
+        }
+
+        try {
+            options->key_script =
+                HeadlessImpl::ScriptedKeyboardDriver::parse_script(script);
+        }
+        catch (const std::runtime_error &ex) {
+            std::cerr << ex.what() << '\n';
+            return 1;
+        }
+    }
+
+    try {
+        for (const std::string &dir :
+             {options->trace_dir, options->frames_dir, options->wav_dir})
+            if (!dir.empty())
+                fs::create_directories(dir);
+    }
+    catch (const fs::filesystem_error &ex) {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<RomPack>> packs;
+    std::vector<Job>                      roms;
+    try {
+        roms = collect_roms(*options, packs);
+    }
+    catch (const std::runtime_error &ex) {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+
+    std::vector<Result> results(roms.size());
+    {
+        ThreadPool pool(options->threads);
+
+        for (std::size_t i = 0; i < roms.size(); ++i)
+            pool.submit([&, i] { results[i] = run_rom(roms[i], *options); });
+
+        pool.wait();
+    }
+
+    std::ofstream output_file;
+    if (!options->output.empty()) {
+        output_file.open(options->output);
+        if (!output_file) {
+            std::cerr << "Failed to open " << options->output << '\n';
+            return 1;
+        }
+    }
+
+    std::ostream &out = output_file.is_open() ? output_file : std::cout;
+
+    out << "rom,status,cycles,wall_ms,fb_hash,seed,fault\n";
+    for (std::size_t i = 0; i < roms.size(); ++i) {
+        const Result &result = results[i];
+
+        out << csv_quote(roms[i].name) << ',' << result.status << ','
+            << result.cycles << ',' << result.wall_ms << ',' << std::hex
+            << result.fb_hash << std::dec << ',' << result.seed << ','
+            << csv_quote(result.fault) << '\n';
+    }
+
+    if constexpr (stats_enabled) {
+        ExecStats total;
+        for (const Result &result : results)
+            total += result.stats;
+
+        total.dump(std::cerr);
+    }
+
+    return 0;
+}
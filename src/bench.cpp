@@ -0,0 +1,552 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_bench - microbenchmarks of the VM core, printing JSON:
+ *
+ *   granite_bench [--min-time SECONDS]
+ */
+
+#include "chipvm.hpp"
+#include "env_pool.hpp"
+#include "headless_impl.hpp"
+#include "jit.hpp"
+#include "lockstep.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+/*
+ * Counting allocations to make sure the hot path doesn't do them.
+ */
+namespace {
+// Atomic, as the environment pool allocates on its worker threads
+std::atomic<std::size_t> allocations = 0;
+}
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace {
+struct BenchResult {
+    std::string name;
+    uint64_t    ops;
+    double      ns_per_op;
+};
+
+double min_time = 0.2; // seconds per benchmark
+
+std::vector<BenchResult> results;
+
+// Keeps the compiler from throwing away benchmarked computations
+volatile uint64_t sink = 0;
+
+std::shared_ptr<ChipVM> make_vm()
+{
+    static const auto display_driver =
+        std::make_shared<HeadlessImpl::NullDisplayDriver>();
+    static const auto keyboard_driver =
+        std::make_shared<HeadlessImpl::NullKeyboardDriver>();
+    static const auto sound_driver =
+        std::make_shared<HeadlessImpl::NullSoundDriver>();
+
+    auto vm =
+        std::make_shared<ChipVM>(display_driver, keyboard_driver, sound_driver);
+
+    // Polling the clock on every instruction would dominate the timings
+    vm->timer_mode = TimerMode::virtual_time;
+
+    return vm;
+}
+
+void load_program(ChipVM &vm, const std::vector<ChipVM::instr_t> &program)
+{
+    auto dst = vm.ram.begin() + C8Consts::USER_SPACE;
+
+    for (const ChipVM::instr_t instr : program) {
+        *dst++ = instr >> 8;
+        *dst++ = instr & 0xFF;
+    }
+
+    vm.invalidate_code(C8Consts::USER_SPACE, program.size() * 2);
+}
+
+/*
+ * Runs body(n) with growing n until it takes at least min_time, body
+ * returns the number of operations it has done.
+ */
+void bench(
+    const std::string &                        name,
+    const std::function<uint64_t(uint64_t)> &body)
+{
+    uint64_t iterations = 1024;
+
+    for (;;) {
+        const auto     start   = steady_clock::now();
+        const uint64_t ops     = body(iterations);
+        const auto     elapsed = duration<double>(steady_clock::now() - start);
+
+        if (elapsed.count() >= min_time || iterations >= (1ULL << 40)) {
+            const double ns = elapsed.count() * 1e9;
+            results.push_back({name, ops, ns / std::max<uint64_t>(ops, 1)});
+            return;
+        }
+
+        const double scale = elapsed.count() > 0
+                                 ? min_time / elapsed.count() * 1.2
+                                 : 100.0;
+        iterations *= std::clamp(scale, 2.0, 100.0);
+    }
+}
+
+void bench_fetch()
+{
+    auto vm = make_vm();
+    load_program(*vm, {0x1234});
+
+    bench("fetch_instruction", [&](uint64_t n) {
+        uint64_t acc = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            acc += vm->fetch_instruction();
+
+        sink = acc;
+        return n;
+    });
+}
+
+/*
+ * Instructions are executed through process_instruction, i.e. decoded
+ * every time. Register values are set up so every instruction takes its
+ * common path.
+ */
+void bench_opcodes()
+{
+    struct OpcodeBench {
+        const char *                 name;
+        std::vector<ChipVM::instr_t> instrs;
+    };
+
+    const std::vector<OpcodeBench> opcodes{
+        {"00E0 CLS", {0x00E0}},
+        {"2nnn+00EE CALL/RET", {0x2300, 0x00EE}},
+        {"1nnn JP", {0x1200}},
+        {"3xkk SE", {0x3012}},
+        {"4xkk SNE", {0x4012}},
+        {"5xy0 SE", {0x5010}},
+        {"6xkk LD", {0x6012}},
+        {"7xkk ADD", {0x7012}},
+        {"8xy0 LD", {0x8010}},
+        {"8xy1 OR", {0x8011}},
+        {"8xy2 AND", {0x8012}},
+        {"8xy3 XOR", {0x8013}},
+        {"8xy4 ADD", {0x8014}},
+        {"8xy5 SUB", {0x8015}},
+        {"8xy6 SHR", {0x8016}},
+        {"8xy7 SUBN", {0x8017}},
+        {"8xyE SHL", {0x801E}},
+        {"9xy0 SNE", {0x9010}},
+        {"Annn LD I", {0xA300}},
+        {"Bnnn JP V0", {0xB300}},
+        {"Cxkk RND", {0xC0FF}},
+        {"Dxyn DRW", {0xD015}},
+        {"Ex9E SKP", {0xE09E}},
+        {"ExA1 SKNP", {0xE0A1}},
+        {"Fx07 LD Vx, DT", {0xF007}},
+        {"Fx0A LD Vx, K", {0xF00A}},
+        {"Fx15 LD DT, Vx", {0xF015}},
+        {"Fx18 LD ST, Vx", {0xF018}},
+        {"Fx1E ADD I", {0xF01E}},
+        {"Fx29 LD F", {0xF029}},
+        {"Fx33 LD B", {0xF033}},
+        {"Fx55 LD [I]", {0xFF55}},
+        {"Fx65 LD Vx, [I]", {0xFF65}},
+        {"00Cn SCD", {0x00C4}},
+        {"00FB SCR", {0x00FB}},
+        {"00FC SCL", {0x00FC}},
+        {"Dxy0 DRW", {0xD010}},
+        {"Fx30 LD HF", {0xF030}},
+        {"Fx75 LD R, Vx", {0xFF75}},
+        {"Fx85 LD Vx, R", {0xFF85}},
+    };
+
+    for (const auto &opcode : opcodes) {
+        auto vm = make_vm();
+
+        const std::string name =
+            "process_instruction " + std::string(opcode.name);
+
+        bench(name, [&](uint64_t n) {
+            uint64_t ops = 0;
+
+            for (uint64_t i = 0; i < n; ++i) {
+                for (const ChipVM::instr_t instr : opcode.instrs) {
+                    vm->regs[0] = 0x1;
+                    vm->i_reg   = 0x300;
+                    vm->process_instruction(instr);
+                    ++ops;
+                }
+            }
+
+            return ops;
+        });
+    }
+}
+
+void bench_drw()
+{
+    struct DrwBench {
+        const char *name;
+        uint8_t     x, y, rows; // 0 rows is a 16x16 sprite
+        bool        hires;
+    };
+
+    const std::vector<DrwBench> cases{
+        {"1 row, aligned", 0, 0, 1, false},
+        {"5 rows, aligned", 8, 4, 5, false},
+        {"15 rows, aligned", 16, 8, 15, false},
+        {"5 rows, unaligned", 3, 4, 5, false},
+        {"15 rows, unaligned", 27, 8, 15, false},
+        {"15 rows, clipped", 60, 28, 15, false},
+        {"hires 15 rows, unaligned", 61, 8, 15, true},
+        {"hires 16x16, aligned", 64, 8, 0, true},
+        {"hires 16x16, unaligned", 59, 8, 0, true},
+        {"hires 16x16, clipped", 120, 56, 0, true},
+    };
+
+    for (const auto &drw : cases) {
+        auto vm = make_vm();
+        vm->display.set_hires(drw.hires);
+        std::fill_n(vm->ram.begin() + 0x300, 32, 0xA5);
+
+        const ChipVM::instr_t instr = 0xD010 | drw.rows;
+
+        bench("DRW " + std::string(drw.name), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                vm->regs[0] = drw.x;
+                vm->regs[1] = drw.y;
+                vm->i_reg   = 0x300;
+                vm->process_instruction(instr);
+            }
+
+            return n;
+        });
+    }
+}
+
+/*
+ * Scrolls of the high resolution display with both planes filled.
+ */
+void bench_scroll()
+{
+    struct ScrollBench {
+        const char *    name;
+        ChipVM::instr_t instr;
+    };
+
+    const std::vector<ScrollBench> cases{
+        {"down 4", 0x00C4},
+        {"right", 0x00FB},
+        {"left", 0x00FC},
+    };
+
+    for (const auto &scroll : cases) {
+        auto vm = make_vm();
+        vm->display.set_hires(true);
+
+        bench("scroll " + std::string(scroll.name), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                // Keeps the display from becoming empty
+                if (i % 16 == 0)
+                    for (auto &plane : vm->display.data())
+                        for (auto &row : plane)
+                            row.fill(0xA5A5A5A5A5A5A5A5);
+
+                vm->plane_mask = Framebuffer::all_planes;
+                vm->process_instruction(scroll.instr);
+            }
+
+            return n;
+        });
+    }
+}
+
+/*
+ * Same conversion SFMLImpl::DisplayDriver does when uploading a frame to
+ * its texture.
+ */
+void bench_frame_conversion()
+{
+    Framebuffer display;
+    display.set_hires(true);
+    for (std::size_t y = 0; y < display.height(); ++y)
+        display.draw_row(y % 2, y % display.width(), y, 0xA5A5);
+
+    std::vector<uint8_t> rgba(
+        Framebuffer::max_width * Framebuffer::max_height * 4);
+
+    const std::array<std::array<uint8_t, 4>, 4> palette{
+        {{0xF5, 0xF5, 0xF5, 0xFF},
+         {0x37, 0x47, 0x4F, 0xFF},
+         {0xFF, 0x8A, 0x65, 0xFF},
+         {0x8D, 0x6E, 0x63, 0xFF}}};
+
+    bench("frame conversion to RGBA", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            auto dst = rgba.begin();
+
+            for (std::size_t y = 0; y < Framebuffer::max_height; ++y) {
+                for (std::size_t x = 0; x < Framebuffer::max_width; ++x) {
+                    const auto &color = palette[display.pixel(x, y)];
+                    dst = std::copy(color.begin(), color.end(), dst);
+                }
+            }
+
+            sink = rgba[i % rgba.size()];
+        }
+
+        return n;
+    });
+}
+
+struct Program {
+    const char *                 name;
+    std::vector<ChipVM::instr_t> instrs;
+};
+
+const std::vector<Program> programs{
+    // Arithmetic loop, typical for the "compute" parts of games
+    {"alu loop",
+     {0x6000, 0x6101, 0x7001, 0x8014, 0x8103, 0xF01E, 0x8205, 0x3000, 0x1204,
+      0x1200}},
+
+    // Draws and erases a sprite, moving it around the screen
+    {"draw loop",
+     {0xA000, 0x6000, 0x6100, 0xD015, 0xD015, 0x7003, 0x7101, 0x1206}},
+
+    // Mix of calls, memory and timer instructions
+    {"mixed",
+     {0xA300, 0x6A7B, 0x2212, 0xF007, 0x3000, 0x1206, 0x600A, 0xF015, 0x1204,
+      0xFA33, 0xF265, 0x7A01, 0x00EE}},
+};
+
+void bench_cycles()
+{
+    for (const auto &program : programs) {
+        auto vm = make_vm();
+        load_program(*vm, program.instrs);
+
+        bench("cycle " + std::string(program.name), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i)
+                vm->cycle();
+
+            return n;
+        });
+    }
+
+    // Same with the idle loops skipped, like the wait for the delay timer
+    // in "mixed"
+    for (const auto &program : programs) {
+        auto vm = make_vm();
+        load_program(*vm, program.instrs);
+
+        bench("run " + std::string(program.name), [&](uint64_t n) {
+            return vm->run(n);
+        });
+    }
+
+    if (!JitEngine::supported())
+        return;
+
+    for (const auto &program : programs) {
+        auto vm = make_vm();
+        load_program(*vm, program.instrs);
+        JitEngine jit(*vm);
+
+        bench("jit " + std::string(program.name), [&](uint64_t n) {
+            return jit.run(n);
+        });
+    }
+}
+
+/*
+ * Same programs on lots of VMs at once, an operation is an instruction of
+ * one VM.
+ */
+void bench_lockstep()
+{
+    constexpr std::size_t count = 256;
+
+    for (const std::size_t width : {8, 16, 32}) {
+        for (const auto &program : programs) {
+            std::vector<std::shared_ptr<ChipVM>> vms;
+            std::vector<ChipVM *>                ptrs;
+
+            for (std::size_t i = 0; i < count; ++i) {
+                vms.push_back(make_vm());
+                load_program(*vms.back(), program.instrs);
+                ptrs.push_back(vms.back().get());
+            }
+
+            LockstepEngine engine(ptrs, width);
+
+            bench(
+                "lockstep x" + std::to_string(width) + " "
+                    + std::string(program.name),
+                [&](uint64_t n) {
+                    return engine.run(std::max<uint64_t>(n / count, 1));
+                });
+        }
+    }
+}
+
+/*
+ * Whole frames of lots of environments stepped in parallel, an operation is
+ * a frame of one environment.
+ */
+void bench_env_pool()
+{
+    const auto &program = programs[1]; // draw loop
+
+    std::vector<uint8_t> rom;
+    for (const ChipVM::instr_t instr : program.instrs) {
+        rom.push_back(instr >> 8);
+        rom.push_back(instr & 0xFF);
+    }
+
+    for (const EnvEngine engine :
+         {EnvEngine::interpreter, EnvEngine::lockstep}) {
+        EnvOptions options;
+        options.count  = 256;
+        options.engine = engine;
+
+        EnvPool               envs(rom, options);
+        std::vector<uint16_t> actions(envs.size());
+
+        const std::string name =
+            engine == EnvEngine::lockstep ? "env pool lockstep frame "
+                                          : "env pool frame ";
+
+        bench(name + program.name, [&](uint64_t n) {
+            const uint64_t steps = std::max<uint64_t>(n / envs.size(), 1);
+            for (uint64_t i = 0; i < steps; ++i)
+                envs.step(actions.data());
+
+            return steps * envs.size();
+        });
+    }
+}
+
+double allocations_per_cycle()
+{
+    constexpr uint64_t count = 100'000;
+
+    uint64_t total = 0;
+    for (const auto &program : programs) {
+        auto vm = make_vm();
+        load_program(*vm, program.instrs);
+
+        const std::size_t before = allocations;
+        for (uint64_t i = 0; i < count; ++i)
+            vm->cycle();
+
+        total += allocations - before;
+    }
+
+    return static_cast<double>(total) / (count * programs.size());
+}
+
+std::string json_escape(const std::string &str)
+{
+    std::string escaped;
+
+    for (const char c : str) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+
+    return escaped;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        if (arg == "--min-time" && i + 1 < argc) {
+            min_time = std::atof(argv[++i]);
+        }
+        else {
+            std::cerr << "Usage: granite_bench [--min-time SECONDS]\n";
+            return 1;
+        }
+    }
+
+    bench_fetch();
+    bench_opcodes();
+    bench_drw();
+    bench_scroll();
+    bench_frame_conversion();
+    bench_cycles();
+    bench_lockstep();
+    bench_env_pool();
+
+    const double allocs = allocations_per_cycle();
+
+    std::cout << "{\n  \"allocations_per_cycle\": " << allocs
+              << ",\n  \"benchmarks\": [\n";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &result = results[i];
+
+        std::cout << "    {\"name\": \"" << json_escape(result.name)
+                  << "\", \"ops\": " << result.ops
+                  << ", \"ns_per_op\": " << result.ns_per_op << '}'
+                  << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+
+    std::cout << "  ]\n}\n";
+
+    return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "chipvm.hpp"
+#include "env_pool.hpp"
+#include "granite.h"
+#include "headless_impl.hpp"
+#include "quirks.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+struct granite_vm {
+    granite_vm()
+        : keyboard(std::make_shared<HeadlessImpl::BitmapKeyboardDriver>()),
+          vm(std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+             keyboard,
+             std::make_shared<HeadlessImpl::NullSoundDriver>())
+    {}
+
+    std::shared_ptr<HeadlessImpl::BitmapKeyboardDriver> keyboard;
+    ChipVM                                              vm;
+};
+
+struct granite_env_pool {
+    granite_env_pool(const std::vector<uint8_t> &rom, const EnvOptions &options)
+        : envs(rom, options)
+    {}
+
+    EnvPool envs;
+};
+
+namespace {
+static_assert(
+    GRANITE_QUIRKS_CHIP8 == static_cast<int>(QuirkProfile::chip8)
+    && GRANITE_QUIRKS_CHIP48 == static_cast<int>(QuirkProfile::chip48)
+    && GRANITE_QUIRKS_SUPERCHIP == static_cast<int>(QuirkProfile::superchip)
+    && GRANITE_QUIRKS_XOCHIP == static_cast<int>(QuirkProfile::xochip)
+    && GRANITE_QUIRKS_LEGACY == static_cast<int>(QuirkProfile::legacy));
+
+static_assert(
+    GRANITE_ENV_ENGINE_INTERPRETER == static_cast<int>(EnvEngine::interpreter)
+    && GRANITE_ENV_ENGINE_LOCKSTEP == static_cast<int>(EnvEngine::lockstep));
+
+static_assert(
+    GRANITE_FAULT_NONE == static_cast<int>(Fault::none)
+    && GRANITE_FAULT_STACK_OVERFLOW == static_cast<int>(Fault::stack_overflow)
+    && GRANITE_FAULT_STACK_UNDERFLOW
+           == static_cast<int>(Fault::stack_underflow)
+    && GRANITE_FAULT_SEGMENTATION_FAULT
+           == static_cast<int>(Fault::segmentation_fault)
+    && GRANITE_FAULT_INVALID_KEY == static_cast<int>(Fault::invalid_key));
+
+// Display is handed out as a flat array of words
+using display_t = std::remove_cvref_t<decltype(Framebuffer().data())>;
+
+static_assert(std::is_same_v<Framebuffer::word_t, uint64_t>);
+static_assert(
+    sizeof(display_t) == GRANITE_FRAMEBUFFER_WORDS * sizeof(uint64_t));
+static_assert(
+    Framebuffer::planes == GRANITE_FRAMEBUFFER_PLANES
+    && Framebuffer::max_height == GRANITE_FRAMEBUFFER_ROWS
+    && Framebuffer::row_words == GRANITE_FRAMEBUFFER_ROW_WORDS);
+static_assert(EnvPool::frame_words == GRANITE_FRAMEBUFFER_WORDS);
+
+bool valid_quirks(granite_quirks quirks) noexcept
+{
+    return quirks >= GRANITE_QUIRKS_CHIP8 && quirks <= GRANITE_QUIRKS_LEGACY;
+}
+} // namespace
+
+int granite_api_version(void) { return GRANITE_API_VERSION; }
+
+granite_vm *granite_create(granite_quirks quirks)
+{
+    if (!valid_quirks(quirks))
+        return nullptr;
+
+    try {
+        auto handle = std::make_unique<granite_vm>();
+        handle->vm.set_quirks(static_cast<QuirkProfile>(quirks));
+        handle->vm.timer_mode = TimerMode::virtual_time;
+
+        return handle.release();
+    }
+    catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void granite_destroy(granite_vm *vm) { delete vm; }
+
+granite_status granite_load_rom(
+    granite_vm *   vm,
+    const uint8_t *rom,
+    std::size_t    size)
+{
+    if (!rom && size > 0)
+        return GRANITE_ERROR_INVALID_ARGUMENT;
+
+    Ram &ram = vm->vm.ram;
+
+    if (size > ram.size() - C8Consts::USER_SPACE)
+        return GRANITE_ERROR_ROM_TOO_LARGE;
+
+    std::copy(rom, rom + size, ram.begin() + C8Consts::USER_SPACE);
+    vm->vm.invalidate_code(C8Consts::USER_SPACE, size);
+
+    return GRANITE_OK;
+}
+
+uint64_t granite_run_cycles(granite_vm *vm, uint64_t count)
+{
+    return vm->vm.run(count);
+}
+
+void granite_set_cycles_per_tick(granite_vm *vm, uint32_t cycles)
+{
+    vm->vm.cycles_per_tick = std::max<uint32_t>(cycles, 1);
+}
+
+void granite_set_keys(granite_vm *vm, uint16_t keys)
+{
+    vm->keyboard->set_keys(keys);
+}
+
+void granite_seed_random(granite_vm *vm, uint64_t seed)
+{
+    vm->vm.seed_random(seed);
+}
+
+int granite_working(const granite_vm *vm) { return vm->vm.working; }
+
+granite_fault granite_get_fault(const granite_vm *vm)
+{
+    return static_cast<granite_fault>(vm->vm.fault);
+}
+
+uint64_t granite_cycles(const granite_vm *vm) { return vm->vm.cycles(); }
+
+const uint64_t *granite_framebuffer(const granite_vm *vm)
+{
+    return vm->vm.display.data().front().front().data();
+}
+
+int granite_display_width(const granite_vm *vm)
+{
+    return static_cast<int>(vm->vm.display.width());
+}
+
+int granite_display_height(const granite_vm *vm)
+{
+    return static_cast<int>(vm->vm.display.height());
+}
+
+uint64_t granite_frame_version(const granite_vm *vm)
+{
+    return vm->vm.frame_version();
+}
+
+std::size_t granite_save_state(
+    const granite_vm *vm,
+    uint8_t *         buffer,
+    std::size_t       size)
+{
+    try {
+        const std::vector<uint8_t> state = vm->vm.save_state();
+
+        if (buffer && state.size() <= size)
+            std::copy(state.cbegin(), state.cend(), buffer);
+
+        return state.size();
+    }
+    catch (const std::bad_alloc &) {
+        return 0;
+    }
+}
+
+granite_status granite_load_state(
+    granite_vm *   vm,
+    const uint8_t *state,
+    std::size_t    size)
+{
+    if (!state)
+        return GRANITE_ERROR_INVALID_ARGUMENT;
+
+    return vm->vm.load_state(state, size) ? GRANITE_OK
+                                          : GRANITE_ERROR_INVALID_STATE;
+}
+
+granite_env_options granite_env_default_options(void)
+{
+    const EnvOptions defaults;
+
+    granite_env_options options;
+    options.count                  = defaults.count;
+    options.instructions_per_frame = defaults.instructions_per_frame;
+    options.threads                = defaults.threads;
+    options.seed                   = defaults.seed;
+    options.lockstep_width         = defaults.lockstep_width;
+
+    options.quirks = static_cast<granite_quirks>(defaults.quirks);
+    options.engine = static_cast<granite_env_engine>(defaults.engine);
+
+    return options;
+}
+
+granite_env_pool *granite_env_pool_create(
+    const uint8_t *            rom,
+    std::size_t                size,
+    const granite_env_options *options)
+{
+    if ((!rom && size > 0) || !options || options->count == 0
+        || !valid_quirks(options->quirks)
+        || (options->engine != GRANITE_ENV_ENGINE_INTERPRETER
+            && options->engine != GRANITE_ENV_ENGINE_LOCKSTEP))
+        return nullptr;
+
+    EnvOptions env_options;
+    env_options.count                  = options->count;
+    env_options.instructions_per_frame = options->instructions_per_frame;
+    env_options.threads                = options->threads;
+    env_options.seed                   = options->seed;
+    env_options.lockstep_width         = options->lockstep_width;
+
+    env_options.quirks = static_cast<QuirkProfile>(options->quirks);
+    env_options.engine = static_cast<EnvEngine>(options->engine);
+
+    // ROM, that doesn't fit, unsupported lockstep width, out of memory or
+    // threads, that can't be started
+    try {
+        return new granite_env_pool(
+            std::vector<uint8_t>(rom, rom + size), env_options);
+    }
+    catch (const std::exception &) {
+        return nullptr;
+    }
+}
+
+void granite_env_pool_destroy(granite_env_pool *envs) { delete envs; }
+
+std::size_t granite_env_pool_size(const granite_env_pool *envs)
+{
+    return envs->envs.size();
+}
+
+granite_status granite_env_pool_step(
+    granite_env_pool *envs,
+    const uint16_t *  actions)
+{
+    if (!actions)
+        return GRANITE_ERROR_INVALID_ARGUMENT;
+
+    try {
+        envs->envs.step(actions);
+        return GRANITE_OK;
+    }
+    catch (const std::bad_alloc &) {
+        return GRANITE_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+void granite_env_pool_reset(granite_env_pool *envs) { envs->envs.reset(); }
+
+const uint64_t *granite_env_pool_frames(const granite_env_pool *envs)
+{
+    return envs->envs.frames();
+}
+
+const uint8_t *granite_env_pool_done(const granite_env_pool *envs)
+{
+    return envs->envs.done();
+}
+
+uint64_t
+granite_env_pool_episode_frames(const granite_env_pool *envs, std::size_t index)
+{
+    return envs->envs.episode_frames(index);
+}
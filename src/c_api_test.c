@@ -0,0 +1,195 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_c_api_test - the C API, compiled as C: a VM is created, loaded
+ * with a ROM, that draws a digit, and run, its state is saved into a buffer
+ * of the size queried with a NULL one and restored. Then an environment
+ * pool is stepped over the same ROM.
+ */
+
+#include "granite.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Draws the digit 0 at the top left corner, then counts in V1 forever */
+static const uint8_t rom[] = {
+    0x60, 0x00, /* 200: LD V0, 0x00 */
+    0xF0, 0x29, /* 202: LD F, V0 */
+    0xD0, 0x05, /* 204: DRW V0, V0, 0x5 */
+    0x71, 0x01, /* 206: ADD V1, 0x01 */
+    0x12, 0x06  /* 208: JP 0x206 */
+};
+
+static int fail(const char *message)
+{
+    fprintf(stderr, "%s\n", message);
+    return 0;
+}
+
+/** \return 0 if the VM doesn't run the ROM */
+static int check_run(void)
+{
+    granite_vm *vm     = granite_create(GRANITE_QUIRKS_CHIP8);
+    int         passed = 1;
+
+    if (!vm)
+        return fail("VM isn't created");
+
+    if (granite_load_rom(vm, rom, sizeof(rom)) != GRANITE_OK)
+        passed = fail("ROM isn't loaded");
+    else if (granite_run_cycles(vm, 1000) != 1000 || !granite_working(vm)
+             || granite_get_fault(vm) != GRANITE_FAULT_NONE
+             || granite_cycles(vm) != 1000)
+        passed = fail("ROM isn't run");
+    /* Top row of the digit 0 is 0xF0 */
+    else if (granite_framebuffer(vm)[0] != UINT64_C(0xF0) << 56
+             || granite_frame_version(vm) == 0)
+        passed = fail("Digit isn't drawn");
+
+    granite_destroy(vm);
+    return passed;
+}
+
+/** \return 0 if the invalid arguments are accepted */
+static int check_invalid(void)
+{
+    static uint8_t large_rom[4096];
+
+    granite_vm *vm;
+    int         passed = 1;
+
+    if (granite_create((granite_quirks)42))
+        return fail("VM of an unknown profile is created");
+
+    vm = granite_create(GRANITE_QUIRKS_CHIP8);
+    if (!vm)
+        return fail("VM isn't created");
+
+    if (granite_load_rom(vm, large_rom, sizeof(large_rom))
+        != GRANITE_ERROR_ROM_TOO_LARGE)
+        passed = fail("Too large ROM is loaded");
+    else if (granite_load_rom(vm, NULL, 2) != GRANITE_ERROR_INVALID_ARGUMENT)
+        passed = fail("NULL ROM is loaded");
+
+    granite_destroy(vm);
+    granite_destroy(NULL);
+    return passed;
+}
+
+/** \return 0 if the state isn't restored */
+static int check_state(void)
+{
+    granite_vm *vm = granite_create(GRANITE_QUIRKS_XOCHIP);
+    uint8_t *   state, *restored;
+    size_t      size;
+    int         passed = 1;
+
+    if (!vm)
+        return fail("VM isn't created");
+
+    granite_load_rom(vm, rom, sizeof(rom));
+    granite_run_cycles(vm, 100);
+
+    size     = granite_save_state(vm, NULL, 0);
+    state    = calloc(size, 1);
+    restored = calloc(size, 1);
+
+    if (size == 0 || !state || !restored) {
+        passed = fail("State size isn't queried");
+        goto out;
+    }
+
+    /* Nothing is written to a buffer, that is too small */
+    if (granite_save_state(vm, state, size - 1) != size || state[0] != 0
+        || granite_save_state(vm, state, size) != size || state[0] != 'G') {
+        passed = fail("State isn't saved");
+        goto out;
+    }
+
+    granite_run_cycles(vm, 100);
+
+    if (granite_load_state(vm, state, size - 1) != GRANITE_ERROR_INVALID_STATE
+        || granite_load_state(vm, NULL, size)
+               != GRANITE_ERROR_INVALID_ARGUMENT) {
+        passed = fail("Invalid state is loaded");
+        goto out;
+    }
+
+    if (granite_load_state(vm, state, size) != GRANITE_OK
+        || granite_cycles(vm) != 100
+        || granite_save_state(vm, restored, size) != size
+        || memcmp(state, restored, size) != 0)
+        passed = fail("State isn't restored");
+
+out:
+    free(restored);
+    free(state);
+    granite_destroy(vm);
+    return passed;
+}
+
+/** \return 0 if the pool isn't stepped */
+static int check_env_pool(void)
+{
+    granite_env_options options = granite_env_default_options();
+    granite_env_pool *  envs;
+    uint16_t            actions[4] = {0};
+    int                 passed     = 1;
+
+    options.count   = 4;
+    options.threads = 1;
+
+    envs = granite_env_pool_create(rom, sizeof(rom), &options);
+    if (!envs)
+        return fail("Pool isn't created");
+
+    if (granite_env_pool_step(envs, NULL) != GRANITE_ERROR_INVALID_ARGUMENT)
+        passed = fail("Pool is stepped without actions");
+    else if (
+        granite_env_pool_step(envs, actions) != GRANITE_OK
+        || granite_env_pool_size(envs) != 4
+        || granite_env_pool_episode_frames(envs, 3) != 1
+        || granite_env_pool_done(envs)[3]
+        || granite_env_pool_frames(envs)[3 * GRANITE_FRAMEBUFFER_WORDS]
+               != UINT64_C(0xF0) << 56)
+        passed = fail("Pool isn't stepped");
+
+    granite_env_pool_reset(envs);
+    if (granite_env_pool_episode_frames(envs, 0) != 0)
+        passed = fail("Pool isn't reset");
+
+    granite_env_pool_destroy(envs);
+    return passed;
+}
+
+int main(void)
+{
+    int passed = granite_api_version() == GRANITE_API_VERSION;
+
+    passed &= check_run();
+    passed &= check_invalid();
+    passed &= check_state();
+    passed &= check_env_pool();
+
+    return passed ? 0 : 1;
+}
@@ -17,18 +17,22 @@
  */
 
 #include "chipvm.hpp"
+#include "decode.hpp"
+#include "trace.hpp"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <climits>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <random>
-#include <stdexcept>
+#include <thread>
 #include <vector>
 
 namespace {
-const std::vector<uint8_t> font{
+constexpr std::array<uint8_t, 16 * C8Consts::FONT_CHAR_SIZE> font{
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -46,29 +50,156 @@ const std::vector<uint8_t> font{
     0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
+
+// Octo's 8x10 font, SUPER-CHIP one only has the decimal digits
+constexpr std::array<uint8_t, 16 * C8Consts::LARGE_CHAR_SIZE> large_font{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+static_assert(
+    font.size() == C8Consts::LARGE_FONT_START
+        && C8Consts::LARGE_FONT_START + large_font.size()
+               <= C8Consts::USER_SPACE,
+    "Fonts don't fit the RAM");
+
+/*
+ * Save state layout, all the numbers are little-endian:
+ *
+ *   "GRST" magic, u16 version,
+ *   u16 pc, u16 i_reg, u8 sp, u8 dt, u8 st, u8 fault, u8 working,
+ *   u8 timer_mode, u8 quirk profile, u8 hires, u8 plane_mask, u8 pitch,
+ *   u32 cycles_per_tick, u64 executed_cycles, u64 tick_cycles,
+ *   u64 frame version, u64 random generator state,
+ *   RAM (of the quirk profile size), registers, flags, audio pattern,
+ *   u16 stack[], u64 display words[] (plane by plane, row by row)
+ *
+ * Scalars go first, so they are validated before anything is overwritten.
+ */
+constexpr std::array<uint8_t, 4> state_magic{'G', 'R', 'S', 'T'};
+constexpr uint16_t               state_version = 3;
+
+constexpr std::size_t state_header_size = state_magic.size() + 2 + 2 + 2 + 1
+                                          + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1 + 1
+                                          + 4 + 8 + 8 + 8 + 8;
+
+constexpr std::size_t state_size(std::size_t ram_size) noexcept
+{
+    return state_header_size + ram_size + C8Consts::REGS_COUNT
+           + C8Consts::FLAGS_COUNT + C8Consts::AUDIO_PATTERN
+           + C8Consts::STACK_SIZE * 2
+           + Framebuffer::planes * Framebuffer::max_height
+                 * Framebuffer::row_words * sizeof(Framebuffer::word_t);
 }
 
+std::size_t ram_size(QuirkProfile profile) noexcept
+{
+    return visit_quirks(
+        profile, [](auto quirks) { return decltype(quirks)::ram_size; });
+}
+
+class StateWriter {
+public:
+    explicit StateWriter(uint8_t *dst_) noexcept : dst(dst_) {}
+
+    template <class T>
+    void put(T value) noexcept
+    {
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            *dst++ = static_cast<uint8_t>(value >> (i * CHAR_BIT));
+    }
+
+    template <class T, std::size_t N>
+    void put(const std::array<T, N> &values) noexcept
+    {
+        for (const T &value : values)
+            put(value);
+    }
+
+    void put(const Ram &values) noexcept
+    {
+        dst = std::copy(values.cbegin(), values.cend(), dst);
+    }
+
+private:
+    uint8_t *dst;
+};
+
+class StateReader {
+public:
+    explicit StateReader(const uint8_t *src_) noexcept : src(src_) {}
+
+    template <class T>
+    T get() noexcept
+    {
+        T value{};
+        for (std::size_t i = 0; i < sizeof(T); ++i)
+            value |= static_cast<T>(*src++) << (i * CHAR_BIT);
+
+        return value;
+    }
+
+    template <class T, std::size_t N>
+    void get(std::array<T, N> &values) noexcept
+    {
+        for (T &value : values)
+            get(value);
+    }
+
+    void get(Ram &values) noexcept
+    {
+        std::copy_n(src, values.size(), values.begin());
+        src += values.size();
+    }
+
+    template <class T>
+    void get(T &value) noexcept
+    {
+        value = get<T>();
+    }
+
+private:
+    const uint8_t *src;
+};
+} // namespace
+
 ChipVM::ChipVM(
     std::shared_ptr<IDisplayDriver>  display_driver_,
     std::shared_ptr<IKeyboardDriver> keyboard_driver_,
     std::shared_ptr<ISoundDriver>    sound_driver_)
-    : ram(0x1000),
-      regs(16),
-      stack(16),
-      display(C8Consts::DISPLAY_WIDTH * C8Consts::DISPLAY_HEIGHT),
-
-      // Drivers initialization
+    : // Drivers initialization
       display_driver(display_driver_),
       keyboard_driver(keyboard_driver_),
-      sound_driver(sound_driver_)
-{
-    std::random_device rd;
-    random_gen = std::make_unique<std::mt19937>(rd());
+      sound_driver(sound_driver_),
 
-    if (font.size() > ram.size())
-        throw std::runtime_error("Font doesn't fit the RAM");
+      next_tick(std::chrono::steady_clock::now()),
+
+      random_gen(
+          static_cast<uint64_t>(std::random_device{}()) << 32
+          | std::random_device{}())
+{
+    decoded.reserve(Ram::capacity);
+    set_quirks(quirk_profile);
 
     std::copy(font.cbegin(), font.cend(), ram.begin());
+    std::copy(
+        large_font.cbegin(),
+        large_font.cend(),
+        ram.begin() + C8Consts::LARGE_FONT_START);
 }
 
 void ChipVM::cycle()
@@ -81,15 +212,363 @@ void ChipVM::cycle()
         return;
     }
 
-    const instr_t instr = fetch_instruction();
+    DecodedInstr &cached = decoded[pc];
+    if (!cached.handler)
+        cached = decode(fetch_instruction());
+
+    // Handler may invalidate its own cache entry, so work on the copy
+    const DecodedInstr op = cached;
     inc_pc();
 
-    process_instruction(instr);
+    GRANITE_STAT(
+        ++exec_stats[classify(op.instr, instruction_set(quirk_profile))]);
+
+    if (tracer) [[unlikely]]
+        execute_traced(op);
+    else
+        op.handler(*this, op);
+
+    retire(1);
+}
+
+uint64_t ChipVM::run(uint64_t count)
+{
+    const uint64_t start = executed_cycles;
+
+    // Idle loops are entered by jumping back to their start, so only then
+    // it's worth checking for them
+    bool jumped_back = true;
+
+    for (uint64_t done = 0; working && done < count;
+         done = executed_cycles - start) {
+        if (jumped_back && skip_idle(count - done) > 0)
+            continue;
+
+        const uint16_t prev_pc = pc;
+        cycle();
+        jumped_back = pc <= prev_pc;
+    }
+
+    return executed_cycles - start;
+}
+
+uint64_t ChipVM::skip_idle(uint64_t max_cycles)
+{
+    if (stats_enabled || tracer || !working || pc > 0xFFF)
+        return 0;
+
+    // Past the end of the RAM reads as zeroes, that aren't any of the loops
+    const auto instr_at = [this](std::size_t addr) -> instr_t {
+        return addr + 1 < ram.size() ? ram[addr] << 8 | ram[addr + 1] : 0;
+    };
+
+    const instr_t first     = instr_at(pc);
+    const instr_t jump_back = 0x1000 | pc;
+    const uint8_t x         = decode_reg_x(first);
+
+    uint32_t period     = 0; // instructions per iteration
+    uint64_t iterations = 0; // that are sure to loop
+
+    if (first == jump_back) {
+        // Stopped for good, only the timers go on
+        period     = 1;
+        iterations = max_cycles;
+    }
+    else if (
+        (first & 0xF0FF) == 0xF007 && instr_at(pc + 2) == (0x3000 | x << 8)
+        && instr_at(pc + 4) == jump_back && dt > 0) {
+        // LD Vx, DT of the iteration n reads the timer after 3n
+        // instructions, the loop goes on while it isn't zero
+        period     = 3;
+        iterations = (dt * uint64_t{cycles_per_tick} - tick_cycles + 2) / 3;
+    }
+    else if (
+        ((first & 0xF0FF) == 0xE09E || (first & 0xF0FF) == 0xE0A1)
+        && instr_at(pc + 2) == jump_back && regs[x] <= 0xF) {
+        // SKP waits for the key to be pressed, SKNP for the release. In real
+        // time keys change at any moment, so the poll just goes on: sleeping
+        // until the next tick would delay the key by up to a tick.
+        const bool released = (first & 0xFF) == 0x9E;
+        if (timer_mode == TimerMode::real_time
+            || keyboard_driver->is_pressed(regs[x]) == released)
+            return 0;
+
+        period     = 2;
+        iterations = (cycles_per_tick - tick_cycles + 1) / 2;
+    }
+    else {
+        return 0;
+    }
+
+    // Nothing but the timers can end the rest of the loops
+    if (timer_mode == TimerMode::real_time) {
+        std::this_thread::sleep_until(next_tick);
+        return 0;
+    }
+
+    iterations = std::min(iterations, max_cycles / period);
+    if (iterations == 0 || tick_cycles >= cycles_per_tick)
+        return 0;
+
+    const uint64_t count = iterations * period;
+
+    // The value read by the last LD Vx, DT
+    if (period == 3)
+        regs[x] = dt - (tick_cycles + count - period) / cycles_per_tick;
+
+    // Tick by tick, so the drivers see the same time of every tick
+    for (uint64_t left = count; left > 0;) {
+        const uint64_t step =
+            std::min<uint64_t>(left, cycles_per_tick - tick_cycles);
+
+        retire(step);
+        left -= step;
+    }
+
+    return count;
+}
+
+void ChipVM::retire(uint64_t count)
+{
+    using namespace std::chrono;
+
+    executed_cycles += count;
+
+    if (timer_mode == TimerMode::virtual_time) {
+        for (tick_cycles += count; tick_cycles >= cycles_per_tick;
+             tick_cycles -= cycles_per_tick)
+            tick_timers();
+        return;
+    }
+
+    constexpr auto tick_period =
+        duration_cast<steady_clock::duration>(seconds(1))
+        / C8Consts::TIMERS_FREQUENCY;
+
+    // Catch up on all the ticks, that should've happened by now
+    for (const auto now = steady_clock::now(); now >= next_tick;
+         next_tick += tick_period)
+        tick_timers();
+}
+
+void ChipVM::tick_timers()
+{
+    if (dt > 0)
+        --dt;
+
+    if (st > 0) {
+        --st;
+        sound_driver->beep_for(1000 / C8Consts::TIMERS_FREQUENCY);
+    }
+}
+
+void ChipVM::execute_traced(const DecodedInstr &op)
+{
+    TraceRecord record;
+    record.pc    = pc - sizeof(instr_t);
+    record.instr = op.instr;
+
+    const auto regs_before = regs;
+    op.handler(*this, op);
+
+    record.i_reg = i_reg;
+
+    const auto [changed, _] =
+        std::mismatch(regs.cbegin(), regs.cend(), regs_before.cbegin());
+
+    if (changed != regs.cend()) {
+        record.reg   = changed - regs.cbegin();
+        record.value = *changed;
+    }
+
+    tracer->record(record);
+}
+
+void ChipVM::present()
+{
+    if (presented_frame_ver == frame_ver)
+        return;
+
+    presented_frame_ver = frame_ver;
     display_driver->render(display);
 }
 
+void ChipVM::process_instruction(const instr_t instr)
+{
+    const DecodedInstr op = decode(instr);
+
+    GRANITE_STAT(++exec_stats[classify(instr, instruction_set(quirk_profile))]);
+    op.handler(*this, op);
+}
+
+/*
+ * Instruction is two bytes long, so the one starting a byte before the
+ * written range is affected too.
+ */
+void ChipVM::invalidate_code(uint16_t addr, std::size_t len) noexcept
+{
+    const std::size_t beg = addr > 0 ? addr - 1 : 0;
+    const std::size_t end = std::min(addr + len, decoded.size());
+
+    for (std::size_t i = beg; i < end; ++i)
+        decoded[i].handler = nullptr;
+
+    if (code_write_callback)
+        code_write_callback(addr, len);
+}
+
+std::vector<uint8_t> ChipVM::save_state() const
+{
+    std::vector<uint8_t> state;
+    save_state(state);
+
+    return state;
+}
+
+void ChipVM::save_state(std::vector<uint8_t> &state) const
+{
+    state.resize(state_size(ram.size()));
+
+    StateWriter writer(state.data());
+
+    writer.put(state_magic);
+    writer.put(state_version);
+
+    writer.put(pc);
+    writer.put(i_reg);
+    writer.put(sp);
+    writer.put(dt);
+    writer.put(st);
+    writer.put(static_cast<uint8_t>(fault));
+    writer.put(static_cast<uint8_t>(working.load()));
+    writer.put(static_cast<uint8_t>(timer_mode));
+    writer.put(static_cast<uint8_t>(quirk_profile));
+    writer.put(static_cast<uint8_t>(display.hires()));
+    writer.put(plane_mask);
+    writer.put(pitch);
+    writer.put(cycles_per_tick);
+    writer.put(executed_cycles);
+    writer.put(tick_cycles);
+    writer.put(frame_ver);
+    writer.put(random_gen.state);
+
+    writer.put(ram);
+    writer.put(regs);
+    writer.put(flags);
+    writer.put(audio_pattern);
+    writer.put(stack);
+    writer.put(display.data());
+}
+
+bool ChipVM::load_state(const uint8_t *state, std::size_t size) noexcept
+{
+    if (size < state_header_size
+        || !std::equal(state_magic.cbegin(), state_magic.cend(), state))
+        return false;
+
+    StateReader reader(state + state_magic.size());
+
+    if (reader.get<uint16_t>() != state_version)
+        return false;
+
+    const auto new_pc              = reader.get<uint16_t>();
+    const auto new_i_reg           = reader.get<uint16_t>();
+    const auto new_sp              = reader.get<uint8_t>();
+    const auto new_dt              = reader.get<uint8_t>();
+    const auto new_st              = reader.get<uint8_t>();
+    const auto new_fault           = reader.get<uint8_t>();
+    const auto new_working         = reader.get<uint8_t>();
+    const auto new_timer_mode      = reader.get<uint8_t>();
+    const auto new_quirk_profile   = reader.get<uint8_t>();
+    const auto new_hires           = reader.get<uint8_t>();
+    const auto new_plane_mask      = reader.get<uint8_t>();
+    const auto new_pitch           = reader.get<uint8_t>();
+    const auto new_cycles_per_tick = reader.get<uint32_t>();
+
+    if (new_sp >= C8Consts::STACK_SIZE
+        || new_fault > static_cast<uint8_t>(Fault::invalid_key)
+        || new_working > 1
+        || new_timer_mode > static_cast<uint8_t>(TimerMode::virtual_time)
+        || new_quirk_profile > static_cast<uint8_t>(QuirkProfile::legacy)
+        || new_hires > 1 || new_plane_mask > Framebuffer::all_planes
+        || new_cycles_per_tick == 0)
+        return false;
+
+    const auto new_profile = static_cast<QuirkProfile>(new_quirk_profile);
+    if (size != state_size(ram_size(new_profile)))
+        return false;
+
+    // Resizes the RAM and drops the decoded instructions, as the whole RAM
+    // is about to change, so is the code
+    set_quirks(new_profile);
+
+    pc              = new_pc;
+    i_reg           = new_i_reg;
+    sp              = new_sp;
+    dt              = new_dt;
+    st              = new_st;
+    fault           = static_cast<Fault>(new_fault);
+    working         = new_working;
+    timer_mode      = static_cast<TimerMode>(new_timer_mode);
+    plane_mask      = new_plane_mask;
+    pitch           = new_pitch;
+    cycles_per_tick = new_cycles_per_tick;
+
+    executed_cycles = reader.get<uint64_t>();
+    tick_cycles     = reader.get<uint64_t>();
+    frame_ver       = reader.get<uint64_t>();
+    random_gen.seed(reader.get<uint64_t>());
+
+    reader.get(ram);
+    reader.get(regs);
+    reader.get(flags);
+    reader.get(audio_pattern);
+    reader.get(stack);
+
+    display.set_hires(new_hires);
+    reader.get(display.data());
+
+    // Wall clock time isn't a part of the state, start counting from now
+    next_tick = std::chrono::steady_clock::now();
+
+    // Make present() show the restored display
+    presented_frame_ver = frame_ver - 1;
+
+    return true;
+}
+
 void ChipVM::inc_pc() noexcept { pc += sizeof(instr_t); }
 
+void ChipVM::skip() noexcept
+{
+    inc_pc();
+    GRANITE_STAT(++exec_stats.skips_taken);
+}
+
+void ChipVM::raise(Fault fault_) noexcept
+{
+    fault   = fault_;
+    working = false;
+}
+
+const char *fault_message(Fault fault) noexcept
+{
+    switch (fault) {
+        case Fault::none:
+            return "No fault";
+        case Fault::stack_overflow:
+            return "Stack overflow";
+        case Fault::stack_underflow:
+            return "Stack underflow";
+        case Fault::segmentation_fault:
+            return "Segmentation fault (memory access outside the RAM)";
+        case Fault::invalid_key:
+            return "Key was not found in mapping";
+    }
+
+    return "Unknown fault";
+}
+
 /*
  * Attention: If you want this to be really noexcept, before calling
  * you have to ensure that program counter + instruction length
@@ -112,11 +591,3 @@ ChipVM::instr_t ChipVM::fetch_instruction() const noexcept
 
     return instr;
 }
-
-decltype(ChipVM::display)::iterator
-ChipVM::get_display_pixel(uint8_t x, uint8_t y) noexcept
-{
-    const decltype(display)::size_type index = y * C8Consts::DISPLAY_WIDTH + x;
-
-    return index < display.size() ? display.begin() + index : display.end();
-}
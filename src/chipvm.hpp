@@ -19,25 +19,162 @@
 #ifndef CHIPVM_HPP_
 #define CHIPVM_HPP_
 
+#include "framebuffer.hpp"
+#include "quirks.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
-#include <random>
+#include <optional>
 #include <vector>
 
 namespace C8Consts {
 enum {
-    DISPLAY_WIDTH    = 64,
-    DISPLAY_HEIGHT   = 32,
+    REGS_COUNT       = 16,
+    STACK_SIZE       = 16,
     INSTRUCTION_LEN  = 0x2,
     USER_SPACE       = 0x200,
-    SPRITE_WIDTH     = 8,
     FONT_CHAR_SIZE   = 5,
-    TIMERS_FREQUENCY = 60
+    LARGE_FONT_START = 16 * FONT_CHAR_SIZE, // SUPER-CHIP 8x10 digits
+    LARGE_CHAR_SIZE  = 10,
+    FLAGS_COUNT      = 16, // SUPER-CHIP RPL user flags
+    AUDIO_PATTERN    = 16, // XO-CHIP audio pattern buffer size
+    TIMERS_FREQUENCY = 60,
+    REFRESH_RATE     = 60
 };
 }
 
+/*
+ * How delay and sound timers are advanced.
+ */
+enum class TimerMode {
+    real_time,   // at TIMERS_FREQUENCY of the wall clock
+    virtual_time // every ChipVM::cycles_per_tick executed instructions
+};
+
+/*
+ * Reason of the VM stopping abnormally. Faults are not exceptions, as they
+ * are pretty common for broken or fuzzed ROMs.
+ */
+enum class Fault : uint8_t {
+    none,
+    stack_overflow,
+    stack_underflow,
+    segmentation_fault, // memory access outside the RAM
+    invalid_key         // key index is greater than 0xF
+};
+
+const char *fault_message(Fault fault) noexcept;
+
+/*
+ * xorshift64* generator. Its whole state is a single word, so saving and
+ * restoring it together with the VM is cheap.
+ */
+class Xorshift64 {
+public:
+    using result_type = uint64_t;
+
+    explicit Xorshift64(uint64_t seed_ = 1) noexcept { seed(seed_); }
+
+    // Zero state would make the generator return zeroes forever
+    void seed(uint64_t seed_) noexcept
+    {
+        state = seed_ ? seed_ : 0x9E3779B97F4A7C15;
+    }
+
+    result_type operator()() noexcept
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1D;
+    }
+
+    static constexpr result_type min() noexcept { return 1; }
+    static constexpr result_type max() noexcept { return UINT64_MAX; }
+
+    uint64_t state;
+};
+
+/*
+ * RAM of the largest profile, stored right in the VM, so the handlers reach
+ * it without going through a pointer. Only the first size() bytes, the RAM
+ * of the current quirk profile, are addressable.
+ */
+class Ram {
+public:
+    using value_type = uint8_t;
+
+    static constexpr std::size_t capacity = C8Consts::XO_CHIP_RAM_SIZE;
+
+    std::size_t size() const noexcept { return active; }
+
+    uint8_t *      data() noexcept { return cells.data(); }
+    const uint8_t *data() const noexcept { return cells.data(); }
+
+    uint8_t *      begin() noexcept { return cells.data(); }
+    uint8_t *      end() noexcept { return cells.data() + active; }
+    const uint8_t *begin() const noexcept { return cells.data(); }
+    const uint8_t *end() const noexcept { return cells.data() + active; }
+    const uint8_t *cbegin() const noexcept { return begin(); }
+    const uint8_t *cend() const noexcept { return end(); }
+
+    uint8_t &      operator[](std::size_t addr) noexcept { return cells[addr]; }
+    const uint8_t &operator[](std::size_t addr) const noexcept
+    {
+        return cells[addr];
+    }
+
+    // Compares the addressable cells only
+    friend bool operator==(const Ram &lhs, const Ram &rhs) noexcept
+    {
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+    }
+
+    /**
+     * Keeps the contents like std::vector::resize: cells past the old size
+     * read as zeroes after growing.
+     */
+    void resize(std::size_t size) noexcept
+    {
+        if (size < active)
+            std::fill(cells.begin() + size, cells.begin() + active, 0);
+
+        active = size;
+    }
+
+private:
+    std::array<uint8_t, capacity> cells{};
+    std::size_t                   active = C8Consts::RAM_SIZE;
+};
+
 class IDisplayDriver;
+class IKeyboardDriver;
+class ISoundDriver;
+class ChipVM;
+class Tracer;
+
+/*
+ * Instruction with all of its operands already extracted, so executing it
+ * again is just a call through the handler pointer.
+ */
+struct DecodedInstr {
+    using handler_t = void (*)(ChipVM &vm, const DecodedInstr &op);
+
+    handler_t handler = nullptr; // nullptr means "not decoded yet"
+    uint16_t  instr   = 0;
+    uint16_t  addr    = 0; // nnn
+    uint8_t   x       = 0;
+    uint8_t   y       = 0;
+    uint8_t   imm     = 0; // kk
+    uint8_t   nibble  = 0; // n
+};
 
 class ChipVM {
     friend class IDisplayDriver;
@@ -45,7 +182,8 @@ class ChipVM {
     friend class ISoundDriver;
 
 public:
-    using instr_t = uint16_t;
+    using instr_t               = uint16_t;
+    using code_write_callback_t = std::function<void(uint16_t, std::size_t)>;
 
     ChipVM(
         std::shared_ptr<IDisplayDriver>  display_driver_,
@@ -53,37 +191,212 @@ public:
         std::shared_ptr<ISoundDriver>    sound_driver_);
 
     /**
-     * The most important method, that is fetching and executing instructions,
-     * drawing the display, etc.
-     *
-     * \return Has VM finished its work
+     * The most important method, that is fetching and executing instructions.
+     * Display isn't drawn here, call present() for that.
      */
     void cycle();
 
-    std::vector<uint8_t>  ram, regs;
-    std::vector<uint16_t> stack;
-    std::vector<bool>     display;
+    /**
+     * Executes up to `count` instructions like that many cycle() calls, but
+     * fast-forwards the idle loops (see skip_idle).
+     *
+     * \return number of the executed instructions, it's less than `count`
+     * if the VM stops
+     */
+    uint64_t run(uint64_t count);
+
+    /**
+     * Recognizes idle loops at the program counter: waiting for the delay
+     * timer (LD Vx, DT; SE Vx, 0; JP back), polling a key (SKP or SKNP Vx;
+     * JP back) and jumping to itself. In virtual time whole iterations, up to
+     * `max_cycles` instructions, are accounted at once, exactly as if they
+     * were executed. Keys are expected to change only on timer ticks or
+     * between the calls, so key polls are skipped up to the next tick.
+     *
+     * In real time the VM thread sleeps until the next tick instead, but only
+     * in the timer waits and jumps to itself: key polls aren't fast-forwarded
+     * there, so a key event ends them without waiting for the tick.
+     *
+     * Does nothing if the tracer is attached or with GRANITE_STATS.
+     *
+     * \return number of the skipped instructions, 0 if the VM isn't idle
+     */
+    uint64_t skip_idle(uint64_t max_cycles);
+
+    /**
+     * Passes the display to the display driver, if it has changed since the
+     * last call. Meant to be called once per display refresh.
+     */
+    void present();
+
+    /**
+     * Incremented every time the display is modified (by CLS, DRW,
+     * scrolling or switching the resolution).
+     */
+    uint64_t frame_version() const noexcept { return frame_ver; }
+
+    /**
+     * Accounts instructions, executed by the cycle() or by an external
+     * execution engine, and advances timers accordingly.
+     */
+    void retire(uint64_t count);
+
+    /**
+     * Decrements delay and sound timers once, beeping if the sound timer is
+     * active. Called by retire().
+     */
+    void tick_timers();
+
+    uint64_t cycles() const noexcept { return executed_cycles; }
+
+    /**
+     * Decodes the instruction and executes it right away, bypassing the
+     * predecoded instructions cache.
+     */
+    void process_instruction(instr_t instr);
+
+    /**
+     * Reads the instruction at the program counter. Caller has to ensure
+     * that it doesn't go beyond the RAM.
+     */
+    instr_t fetch_instruction() const noexcept;
+
+    /**
+     * Extracts handler and operands of the instruction, the handler is the
+     * one of the current quirk profile.
+     */
+    DecodedInstr decode(instr_t instr) const noexcept
+    {
+        return decoder(instr);
+    }
+
+    QuirkProfile quirks() const noexcept { return quirk_profile; }
+
+    /**
+     * Switches to the handlers of the profile, dropping the decoded
+     * instructions. RAM is resized to the size of the profile, keeping its
+     * contents. Never allocates, the storage is sized for the largest one.
+     */
+    void set_quirks(QuirkProfile profile) noexcept;
+
+    /**
+     * Must be called after writing to RAM in [addr; addr + len) range, so
+     * the instructions there are decoded again on the next execution.
+     */
+    void invalidate_code(uint16_t addr, std::size_t len) noexcept;
+
+    /**
+     * Serializes the whole VM state (memory, registers, display, timers and
+     * random generator) to a compact versioned binary blob. Drivers and
+     * callbacks are not a part of the state.
+     */
+    std::vector<uint8_t> save_state() const;
+
+    /**
+     * Same as above, but reuses the buffer's storage.
+     */
+    void save_state(std::vector<uint8_t> &state) const;
+
+    /**
+     * Restores the state produced by save_state(). The blob may point right
+     * into a mapped file.
+     *
+     * \return false if the blob is malformed or of the other version, the VM
+     * is left untouched in that case. Never allocates, even if the profile
+     * changes.
+     */
+    bool load_state(const uint8_t *state, std::size_t size) noexcept;
+
+    void seed_random(uint64_t seed) noexcept { random_gen.seed(seed); }
+
+    /**
+     * Execution statistics gathered so far, all zeroes unless built with
+     * GRANITE_STATS. Counters aren't synchronized, so call it from the VM
+     * thread or after the VM has stopped.
+     */
+    ExecStats stats() const noexcept
+    {
+#ifdef GRANITE_STATS
+        return exec_stats;
+#else
+        return {};
+#endif
+    }
+
+    Ram ram; // its size depends on the quirk profile
+
+    std::array<uint8_t, C8Consts::REGS_COUNT>  regs{};
+    std::array<uint16_t, C8Consts::STACK_SIZE> stack{};
+    std::array<uint8_t, C8Consts::FLAGS_COUNT> flags{}; // Fx75 and Fx85
+    Framebuffer                                display;
+
+    // XO-CHIP planes, that are drawn, cleared and scrolled
+    uint8_t plane_mask = 0x1;
+
+    // XO-CHIP audio, drivers play a plain beep for now
+    std::array<uint8_t, C8Consts::AUDIO_PATTERN> audio_pattern{};
+    uint8_t                                      pitch = 64;
 
     // Special registers
-    uint16_t             pc    = C8Consts::USER_SPACE; // program counter
-    uint16_t             i_reg = 0;                    // index register
-    uint8_t              sp    = 0;                    // stack pointer
-    std::atomic<uint8_t> dt = 0, st = 0;               // delay and sound timers
+    uint16_t pc    = C8Consts::USER_SPACE; // program counter
+    uint16_t i_reg = 0;                    // index register
+    uint8_t  sp    = 0;                    // stack pointer
+    uint8_t  dt = 0, st = 0;               // delay and sound timers
+
+    // Wall clock by default, like the timers used to run. Scheduler, batch
+    // runs, EnvPool and the C API switch to the virtual time.
+    TimerMode timer_mode      = TimerMode::real_time;
+    uint32_t  cycles_per_tick = 10; // for TimerMode::virtual_time
 
     std::atomic<bool> working = true;
+    Fault             fault   = Fault::none; // why the VM stopped working
 
     std::shared_ptr<IDisplayDriver>  display_driver;
     std::shared_ptr<IKeyboardDriver> keyboard_driver;
     std::shared_ptr<ISoundDriver>    sound_driver;
 
+    // Called from invalidate_code, lets execution engines drop their caches
+    code_write_callback_t code_write_callback;
+
+    // Records every instruction executed by cycle() if set, see trace.hpp
+    Tracer *tracer = nullptr;
+
 private:
-    void    inc_pc() noexcept;
-    instr_t fetch_instruction() const noexcept;
-    void    process_instruction(instr_t instr);
-    decltype(display)::iterator
-    get_display_pixel(uint8_t x, uint8_t y) noexcept;
+    // Instructions handlers, see instructions.cpp
+    template <class Quirks>
+    struct Ops;
+
+    template <class Quirks>
+    static DecodedInstr decode_for(instr_t instr) noexcept;
+
+    using decoder_t = DecodedInstr (*)(instr_t instr) noexcept;
+
+    void inc_pc() noexcept;
+    void skip() noexcept; // skips the next instruction
+
+    // Executes the instruction and records it to the tracer
+    void execute_traced(const DecodedInstr &op);
+    void raise(Fault fault_) noexcept;
+
+    // Indexed by the address of the instruction. Capacity for the largest
+    // RAM is reserved up front, so switching profiles never reallocates, and
+    // only the part of the current profile is touched.
+    std::vector<DecodedInstr> decoded;
 
-    std::unique_ptr<std::mt19937> random_gen;
+    QuirkProfile quirk_profile = default_quirk_profile;
+    decoder_t    decoder       = nullptr;
+
+    uint64_t frame_ver = 0, presented_frame_ver = 0;
+
+    uint64_t                              executed_cycles = 0;
+    uint64_t                              tick_cycles     = 0;
+    std::chrono::steady_clock::time_point next_tick;
+
+    Xorshift64 random_gen;
+
+#ifdef GRANITE_STATS
+    ExecStats exec_stats;
+#endif
 };
 
 /*
@@ -102,13 +415,19 @@ protected:
 
 class IDisplayDriver : public IDriver {
 public:
-    virtual void render(const std::vector<bool> &display) = 0;
+    virtual void render(const Framebuffer &display) = 0;
 };
 
 class IKeyboardDriver : public IDriver {
 public:
     virtual bool    is_pressed(uint8_t key) = 0;
     virtual uint8_t wait_for_key()          = 0;
+
+    /**
+     * Called by LD Vx, K. Drivers, that can't block, return nothing if no
+     * key is pressed, and the instruction is executed again.
+     */
+    virtual std::optional<uint8_t> try_get_key() { return wait_for_key(); }
 };
 
 class ISoundDriver : public IDriver {
@@ -0,0 +1,53 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DECODE_HPP_
+#define DECODE_HPP_
+
+#include <cstdint>
+
+/*
+ * Operand fields of an instruction, shared by the interpreter and the
+ * disassembler.
+ */
+
+inline uint8_t decode_opcode(uint16_t instr) noexcept
+{
+    return (instr & 0xF000) >> 12;
+}
+
+inline uint16_t decode_addr(uint16_t instr) noexcept { return instr & 0xFFF; }
+
+inline uint8_t decode_reg_x(uint16_t instr) noexcept
+{
+    return (instr & 0x0F00) >> 8;
+}
+
+inline uint8_t decode_reg_y(uint16_t instr) noexcept
+{
+    return (instr & 0x00F0) >> 4;
+}
+
+inline uint8_t decode_imm(uint16_t instr) noexcept { return instr & 0x00FF; }
+
+inline uint8_t decode_nibble(uint16_t instr) noexcept
+{
+    return instr & 0x000F;
+}
+
+#endif /* !DECODE_HPP_ */
@@ -0,0 +1,726 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "chipvm.hpp"
+#include "decode.hpp"
+#include "disasm.hpp"
+#include "rom_pack.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr std::size_t none = SIZE_MAX;
+
+// What the decoding depends on
+struct Isa {
+    InstructionSet set;
+    bool           jump_vx;
+    bool           shift_vy;
+    std::size_t    ram_size;
+};
+
+Isa isa_of(QuirkProfile profile) noexcept
+{
+    return visit_quirks(profile, [](auto quirks) {
+        using Quirks = decltype(quirks);
+
+        return Isa{
+            Quirks::instruction_set,
+            Quirks::jump_vx,
+            Quirks::shift_vy,
+            Quirks::ram_size};
+    });
+}
+
+uint16_t word_at(std::span<const uint8_t> ram, uint32_t addr) noexcept
+{
+    const auto byte_at = [ram](uint32_t index) -> uint16_t {
+        return index < ram.size() ? ram[index] : 0;
+    };
+
+    return byte_at(addr) << 8 | byte_at(addr + 1);
+}
+
+std::string hex(uint32_t value, int digits)
+{
+    std::ostringstream str;
+    str << "0x" << std::hex << std::uppercase << std::setfill('0')
+        << std::setw(digits) << value;
+
+    return str.str();
+}
+
+std::string reg(uint8_t index) { return {'V', "0123456789ABCDEF"[index]}; }
+
+// Addresses, that the instruction passes the control to
+std::vector<uint32_t> flow_targets(
+    const Instruction &      instr,
+    std::span<const uint8_t> ram,
+    QuirkProfile             quirks)
+{
+    const uint32_t next = instr.addr + instr.length;
+
+    switch (instr.flow) {
+        case Flow::next:
+            return {next};
+
+        case Flow::jump:
+            return {instr.target};
+
+        case Flow::call:
+            return {instr.target, next};
+
+        // Skipped F000 nnnn is two words long
+        case Flow::skip:
+            return {next, next + decode_instruction(ram, next, quirks).length};
+
+        case Flow::ret:
+        case Flow::indirect:
+        case Flow::exit:
+            break;
+    }
+
+    return {};
+}
+
+/*
+ * Immediate dominators of the blocks (Cooper, Harvey and Kennedy), the
+ * entry block is the first one. Unreachable blocks get none.
+ */
+std::vector<std::size_t> find_dominators(
+    const std::vector<std::vector<std::size_t>> &succs,
+    const std::vector<std::vector<std::size_t>> &preds)
+{
+    const std::size_t count = succs.size();
+
+    std::vector<std::size_t> postorder;
+    std::vector<bool>        seen(count);
+
+    std::vector<std::pair<std::size_t, std::size_t>> stack{{0, 0}};
+    seen[0] = true;
+
+    while (!stack.empty()) {
+        auto &[block, edge] = stack.back();
+
+        if (edge == succs[block].size()) {
+            postorder.push_back(block);
+            stack.pop_back();
+            continue;
+        }
+
+        const std::size_t succ = succs[block][edge++];
+        if (!seen[succ]) {
+            seen[succ] = true;
+            stack.emplace_back(succ, 0);
+        }
+    }
+
+    std::vector<std::size_t> order(count, none);
+    for (std::size_t i = 0; i < postorder.size(); ++i)
+        order[postorder[i]] = i;
+
+    std::vector<std::size_t> idom(count, none);
+    idom[0] = 0;
+
+    const auto intersect = [&](std::size_t a, std::size_t b) {
+        while (a != b) {
+            while (order[a] < order[b])
+                a = idom[a];
+            while (order[b] < order[a])
+                b = idom[b];
+        }
+
+        return a;
+    };
+
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        // Reverse postorder, so the predecessors mostly go first
+        for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+            if (*it == 0)
+                continue;
+
+            std::size_t dominator = none;
+            for (const std::size_t pred : preds[*it]) {
+                if (idom[pred] != none)
+                    dominator = dominator == none ? pred
+                                                  : intersect(pred, dominator);
+            }
+
+            if (idom[*it] != dominator) {
+                idom[*it] = dominator;
+                changed   = true;
+            }
+        }
+    }
+
+    return idom;
+}
+
+void find_loops(RomAnalysis &analysis)
+{
+    const std::vector<BasicBlock> &blocks = analysis.blocks;
+    const std::size_t              count  = blocks.size();
+
+    const auto index_of = [&blocks](uint16_t start) -> std::size_t {
+        return std::lower_bound(
+                   blocks.cbegin(),
+                   blocks.cend(),
+                   start,
+                   [](const BasicBlock &block, uint32_t addr) {
+                       return block.start < addr;
+                   })
+            - blocks.cbegin();
+    };
+
+    std::vector<std::vector<std::size_t>> succs(count), preds(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        for (const uint16_t start : blocks[i].successors) {
+            succs[i].push_back(index_of(start));
+            preds[index_of(start)].push_back(i);
+        }
+    }
+
+    const std::vector<std::size_t> idom = find_dominators(succs, preds);
+
+    const auto dominates = [&idom](std::size_t a, std::size_t b) {
+        for (;; b = idom[b]) {
+            if (b == a)
+                return true;
+            if (b == 0)
+                return false;
+        }
+    };
+
+    // Every header with the back edges to it
+    std::vector<std::vector<std::size_t>> latches(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (idom[i] == none)
+            continue;
+
+        for (const std::size_t succ : succs[i])
+            if (dominates(succ, i))
+                latches[succ].push_back(i);
+    }
+
+    for (std::size_t header = 0; header < count; ++header) {
+        if (latches[header].empty())
+            continue;
+
+        // Blocks, that reach the latches without passing the header
+        std::vector<bool>        in_loop(count);
+        std::vector<std::size_t> stack = latches[header];
+        in_loop[header]                = true;
+
+        Loop loop;
+        loop.header = blocks[header].start;
+
+        while (!stack.empty()) {
+            const std::size_t block = stack.back();
+            stack.pop_back();
+
+            if (in_loop[block])
+                continue;
+
+            in_loop[block] = true;
+            for (const std::size_t pred : preds[block])
+                if (idom[pred] != none)
+                    stack.push_back(pred);
+        }
+
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!in_loop[i])
+                continue;
+
+            loop.blocks.push_back(blocks[i].start);
+            loop.size += blocks[i].end - blocks[i].start;
+        }
+
+        for (const std::size_t latch : latches[header])
+            loop.latches.push_back(blocks[latch].start);
+
+        analysis.loops.push_back(std::move(loop));
+    }
+
+    for (Loop &outer : analysis.loops) {
+        for (const Loop &inner : analysis.loops) {
+            if (&inner != &outer
+                && std::binary_search(
+                    outer.blocks.cbegin(), outer.blocks.cend(), inner.header))
+                outer.innermost = false;
+        }
+    }
+}
+} // namespace
+
+Instruction decode_instruction(
+    std::span<const uint8_t> ram,
+    uint32_t                 addr,
+    QuirkProfile             quirks) noexcept
+{
+    const InstructionSet set = isa_of(quirks).set;
+
+    Instruction instr;
+    instr.addr  = addr;
+    instr.instr = word_at(ram, addr);
+
+    const uint8_t nibble = decode_nibble(instr.instr);
+    const uint8_t imm    = decode_imm(instr.instr);
+
+    switch (decode_opcode(instr.instr)) {
+        case 0x0:
+            if (imm == 0xEE)
+                instr.flow = Flow::ret;
+            else if (set != InstructionSet::chip8 && instr.instr == 0x00FD)
+                instr.flow = Flow::exit;
+            break;
+
+        case 0x1:
+            instr.flow   = Flow::jump;
+            instr.target = decode_addr(instr.instr);
+            break;
+
+        case 0x2:
+            instr.flow   = Flow::call;
+            instr.target = decode_addr(instr.instr);
+            break;
+
+        case 0x3:
+        case 0x4:
+            instr.flow = Flow::skip;
+            break;
+
+        // 5xy2 and 5xy3 are SAVE and LOAD under XO-CHIP
+        case 0x5:
+            if (set != InstructionSet::xochip
+                || (nibble != 0x2 && nibble != 0x3))
+                instr.flow = Flow::skip;
+            break;
+
+        case 0x9:
+            if (nibble == 0x0)
+                instr.flow = Flow::skip;
+            break;
+
+        case 0xB:
+            instr.flow = Flow::indirect;
+            break;
+
+        case 0xE:
+            if (imm == 0x9E || imm == 0xA1)
+                instr.flow = Flow::skip;
+            break;
+
+        case 0xF:
+            if (set == InstructionSet::xochip && instr.instr == 0xF000) {
+                instr.operand = word_at(ram, addr + 2);
+                instr.length  = 4;
+            }
+            break;
+    }
+
+    return instr;
+}
+
+std::string format_instruction(const Instruction &instr, QuirkProfile quirks)
+{
+    const Isa  isa       = isa_of(quirks);
+    const bool superchip = isa.set != InstructionSet::chip8;
+    const bool xochip    = isa.set == InstructionSet::xochip;
+
+    const uint16_t    op     = instr.instr;
+    const uint8_t     x      = decode_reg_x(op);
+    const uint8_t     y      = decode_reg_y(op);
+    const uint8_t     nibble = decode_nibble(op);
+    const std::string vx = reg(x), vy = reg(y);
+    const std::string addr = hex(decode_addr(op), 3);
+    const std::string imm  = hex(decode_imm(op), 2);
+
+    switch (decode_opcode(op)) {
+        case 0x0:
+            switch (decode_imm(op)) {
+                case 0xE0:
+                    return "CLS";
+
+                case 0xEE:
+                    return "RET";
+            }
+
+            if (!superchip || x != 0x0)
+                return "SYS " + addr;
+
+            switch (decode_imm(op)) {
+                case 0xFB:
+                    return "SCR";
+
+                case 0xFC:
+                    return "SCL";
+
+                case 0xFD:
+                    return "EXIT";
+
+                case 0xFE:
+                    return "LOW";
+
+                case 0xFF:
+                    return "HIGH";
+            }
+
+            if (y == 0xC)
+                return "SCD " + std::to_string(nibble);
+            if (xochip && y == 0xD)
+                return "SCU " + std::to_string(nibble);
+
+            return "SYS " + addr;
+
+        case 0x1:
+            return "JP " + addr;
+
+        case 0x2:
+            return "CALL " + addr;
+
+        case 0x3:
+            return "SE " + vx + ", " + imm;
+
+        case 0x4:
+            return "SNE " + vx + ", " + imm;
+
+        case 0x5:
+            if (xochip && nibble == 0x2)
+                return "SAVE " + vx + " - " + vy;
+            if (xochip && nibble == 0x3)
+                return "LOAD " + vx + " - " + vy;
+
+            return "SE " + vx + ", " + vy;
+
+        case 0x6:
+            return "LD " + vx + ", " + imm;
+
+        case 0x7:
+            return "ADD " + vx + ", " + imm;
+
+        case 0x8:
+            switch (nibble) {
+                case 0x0:
+                    return "LD " + vx + ", " + vy;
+
+                case 0x1:
+                    return "OR " + vx + ", " + vy;
+
+                case 0x2:
+                    return "AND " + vx + ", " + vy;
+
+                case 0x3:
+                    return "XOR " + vx + ", " + vy;
+
+                case 0x4:
+                    return "ADD " + vx + ", " + vy;
+
+                case 0x5:
+                    return "SUB " + vx + ", " + vy;
+
+                case 0x6:
+                    return "SHR " + vx + (isa.shift_vy ? ", " + vy : "");
+
+                case 0x7:
+                    return "SUBN " + vx + ", " + vy;
+
+                case 0xE:
+                    return "SHL " + vx + (isa.shift_vy ? ", " + vy : "");
+            }
+            break;
+
+        case 0x9:
+            if (nibble == 0x0)
+                return "SNE " + vx + ", " + vy;
+            break;
+
+        case 0xA:
+            return "LD I, " + addr;
+
+        case 0xB:
+            return "JP " + (isa.jump_vx ? vx : reg(0x0)) + ", " + addr;
+
+        case 0xC:
+            return "RND " + vx + ", " + imm;
+
+        case 0xD:
+            return "DRW " + vx + ", " + vy + ", " + std::to_string(nibble);
+
+        case 0xE:
+            switch (decode_imm(op)) {
+                case 0x9E:
+                    return "SKP " + vx;
+
+                case 0xA1:
+                    return "SKNP " + vx;
+            }
+            break;
+
+        case 0xF:
+            switch (decode_imm(op)) {
+                case 0x07:
+                    return "LD " + vx + ", DT";
+
+                case 0x0A:
+                    return "LD " + vx + ", K";
+
+                case 0x15:
+                    return "LD DT, " + vx;
+
+                case 0x18:
+                    return "LD ST, " + vx;
+
+                case 0x1E:
+                    return "ADD I, " + vx;
+
+                case 0x29:
+                    return "LD F, " + vx;
+
+                case 0x33:
+                    return "LD B, " + vx;
+
+                case 0x55:
+                    return "LD [I], " + vx;
+
+                case 0x65:
+                    return "LD " + vx + ", [I]";
+            }
+
+            if (superchip) {
+                switch (decode_imm(op)) {
+                    case 0x30:
+                        return "LD HF, " + vx;
+
+                    case 0x75:
+                        return "LD R, " + vx;
+
+                    case 0x85:
+                        return "LD " + vx + ", R";
+                }
+            }
+
+            if (xochip) {
+                switch (decode_imm(op)) {
+                    case 0x00:
+                        if (x == 0x0)
+                            return "LD I, long " + hex(instr.operand, 4);
+                        break;
+
+                    case 0x01:
+                        return "PLANE " + std::to_string(x);
+
+                    case 0x02:
+                        if (x == 0x0)
+                            return "AUDIO";
+                        break;
+
+                    case 0x3A:
+                        return "PITCH " + vx;
+                }
+            }
+            break;
+    }
+
+    // Executed as no-op by the VM
+    return "DW " + hex(op, 4);
+}
+
+const BasicBlock *RomAnalysis::block_at(uint32_t addr) const noexcept
+{
+    const auto it = std::lower_bound(
+        code.cbegin(),
+        code.cend(),
+        addr,
+        [](const Instruction &instr, uint32_t addr_) {
+            return instr.addr < addr_;
+        });
+
+    if (it == code.cend() || it->addr != addr)
+        return nullptr;
+
+    return &blocks[code_blocks[it - code.cbegin()]];
+}
+
+RomAnalysis analyze_rom(std::span<const uint8_t> image, QuirkProfile quirks)
+{
+    const std::size_t ram_size = isa_of(quirks).ram_size;
+
+    if (image.size() > ram_size - C8Consts::USER_SPACE)
+        throw std::invalid_argument("ROM doesn't fit the RAM");
+
+    std::vector<uint8_t> ram(ram_size);
+    std::copy(image.begin(), image.end(), ram.begin() + C8Consts::USER_SPACE);
+
+    const uint32_t begin = C8Consts::USER_SPACE;
+    const uint32_t end   = begin + image.size();
+
+    const auto in_image = [begin, end](uint32_t addr) {
+        return addr >= begin && addr < end;
+    };
+
+    RomAnalysis analysis;
+    analysis.quirks = quirks;
+
+    if (image.empty())
+        return analysis;
+
+    // Indexed by the address
+    std::vector<bool>    visited(ram_size), leader(ram_size);
+    std::vector<uint8_t> incoming(ram_size); // edges, counted up to two
+
+    // Recover the code reachable from the entry point
+    std::vector<uint32_t> work{begin};
+    leader[begin] = true;
+
+    while (!work.empty()) {
+        const uint32_t addr = work.back();
+        work.pop_back();
+
+        if (visited[addr])
+            continue;
+
+        visited[addr] = true;
+
+        const Instruction instr = decode_instruction(ram, addr, quirks);
+        analysis.code.push_back(instr);
+
+        if (instr.flow == Flow::call)
+            analysis.subroutines.push_back(instr.target);
+        else if (instr.flow == Flow::indirect)
+            analysis.indirect_jumps.push_back(instr.addr);
+
+        for (const uint32_t target : flow_targets(instr, ram, quirks)) {
+            if (!in_image(target))
+                continue;
+
+            incoming[target] = std::min(incoming[target] + 1, 2);
+            leader[target]   = leader[target] || instr.flow != Flow::next;
+            work.push_back(target);
+        }
+    }
+
+    std::sort(
+        analysis.code.begin(),
+        analysis.code.end(),
+        [](const Instruction &a, const Instruction &b) {
+            return a.addr < b.addr;
+        });
+
+    std::sort(analysis.subroutines.begin(), analysis.subroutines.end());
+    analysis.subroutines.erase(
+        std::unique(analysis.subroutines.begin(), analysis.subroutines.end()),
+        analysis.subroutines.end());
+    std::sort(analysis.indirect_jumps.begin(), analysis.indirect_jumps.end());
+
+    std::vector<std::size_t> index(ram_size, none);
+    for (std::size_t i = 0; i < analysis.code.size(); ++i)
+        index[analysis.code[i].addr] = i;
+
+    // Split the code into blocks at the leaders and the joins
+    analysis.code_blocks.resize(analysis.code.size());
+
+    std::vector<bool> covered(ram_size);
+    for (const Instruction &first : analysis.code) {
+        if (covered[first.addr])
+            continue;
+
+        BasicBlock block;
+        block.start = first.addr;
+
+        const Instruction *instr = &first;
+        for (;;) {
+            covered[instr->addr] = true;
+            analysis.code_blocks[index[instr->addr]] = analysis.blocks.size();
+
+            const uint32_t next = instr->addr + instr->length;
+            if (instr->flow != Flow::next || !in_image(next) || leader[next]
+                || incoming[next] > 1)
+                break;
+
+            instr = &analysis.code[index[next]];
+        }
+
+        block.end  = instr->addr + instr->length;
+        block.flow = instr->flow;
+
+        for (const uint32_t target : flow_targets(*instr, ram, quirks))
+            if (in_image(target))
+                block.successors.push_back(target);
+
+        analysis.blocks.push_back(std::move(block));
+    }
+
+    find_loops(analysis);
+
+    // Bytes of the image, that no reachable instruction covers
+    std::vector<bool> is_code(ram_size);
+    for (const Instruction &instr : analysis.code)
+        for (uint32_t addr = instr.addr;
+             addr < std::min<uint32_t>(end, instr.addr + instr.length);
+             ++addr)
+            is_code[addr] = true;
+
+    for (uint32_t addr = begin; addr < end; ++addr) {
+        if (is_code[addr])
+            continue;
+
+        if (analysis.data.empty() || analysis.data.back().end != addr)
+            analysis.data.push_back({addr, addr + 1});
+        else
+            ++analysis.data.back().end;
+    }
+
+    return analysis;
+}
+
+std::shared_ptr<const RomAnalysis>
+AnalysisCache::get(std::span<const uint8_t> image, QuirkProfile quirks)
+{
+    const key_t key{rom_hash(image), quirks};
+
+    {
+        std::scoped_lock lk(mutex);
+
+        if (const auto it = analyses.find(key); it != analyses.end())
+            return it->second;
+    }
+
+    // Analyzed without the lock, if two threads race, the first one wins
+    auto analysis =
+        std::make_shared<const RomAnalysis>(analyze_rom(image, quirks));
+
+    std::scoped_lock lk(mutex);
+    return analyses.emplace(key, std::move(analysis)).first->second;
+}
+
+std::size_t AnalysisCache::size() const
+{
+    std::scoped_lock lk(mutex);
+    return analyses.size();
+}
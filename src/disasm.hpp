@@ -0,0 +1,151 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DISASM_HPP_
+#define DISASM_HPP_
+
+#include "quirks.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * How an instruction passes the control on.
+ */
+enum class Flow : uint8_t {
+    next,     // to the next instruction
+    jump,     // JP addr
+    call,     // CALL addr, returning to the next instruction
+    skip,     // to the next instruction or over it
+    ret,      // RET
+    indirect, // JP V0, addr, the target depends on a register
+    exit      // EXIT (SUPER-CHIP)
+};
+
+struct Instruction {
+    uint16_t addr    = 0;
+    uint16_t instr   = 0;
+    uint16_t operand = 0; // the second word of F000 nnnn (XO-CHIP)
+    uint16_t target  = 0; // of jump and call
+    uint8_t  length  = 2; // in bytes, 4 for F000 nnnn
+    Flow     flow    = Flow::next;
+};
+
+/**
+ * Decodes the instruction at the address the same way as the VM of the
+ * profile does. Bytes beyond the RAM are read as zeroes.
+ */
+Instruction decode_instruction(
+    std::span<const uint8_t> ram,
+    uint32_t                 addr,
+    QuirkProfile             quirks) noexcept;
+
+/**
+ * \return mnemonic of the instruction, like "LD V1, 0x2A" (see the comments
+ * of the handlers in instructions.cpp)
+ */
+std::string format_instruction(const Instruction &instr, QuirkProfile quirks);
+
+struct BasicBlock {
+    uint32_t start = 0, end = 0; // [start; end)
+    Flow     flow  = Flow::next; // of the last instruction
+
+    // Starts of the blocks, the call target goes first and the taken skip
+    // last. Edges leaving the image are dropped.
+    std::vector<uint16_t> successors;
+};
+
+/*
+ * Natural loop: the header dominates the blocks of the loop, and the
+ * latches jump back to it. Innermost loops, that contain no other ones, are
+ * the candidates for the hot loops.
+ */
+struct Loop {
+    uint16_t              header = 0;
+    std::vector<uint16_t> latches;
+    std::vector<uint16_t> blocks; // starts, sorted
+    uint32_t              size      = 0; // bytes of code
+    bool                  innermost = true;
+};
+
+struct DataRegion {
+    uint32_t start = 0, end = 0; // [start; end)
+};
+
+/*
+ * Control flow of a ROM, recovered statically from its entry point through
+ * jumps, calls and skips. Targets of JP V0, addr are unknown, so the code
+ * behind them is reported as data, and so is code written at runtime.
+ * Irreducible cycles aren't reported as loops.
+ */
+struct RomAnalysis {
+    QuirkProfile quirks = default_quirk_profile;
+
+    std::vector<Instruction> code;   // reachable instructions, sorted
+    std::vector<BasicBlock>  blocks; // sorted, the entry point first
+    std::vector<Loop>        loops;  // sorted by the header
+    std::vector<DataRegion>  data;   // bytes of the image, that aren't code
+
+    // Index of the block of every instruction of the code
+    std::vector<std::size_t> code_blocks;
+
+    std::vector<uint16_t> subroutines;    // CALL targets, sorted
+    std::vector<uint16_t> indirect_jumps; // addresses of JP V0, addr
+
+    /**
+     * \return the block of the instruction at the address, or nullptr if
+     * there's no instruction there. Blocks overlap, if the code jumps into
+     * the middle of an instruction, so the range of the block isn't enough.
+     */
+    const BasicBlock *block_at(uint32_t addr) const noexcept;
+};
+
+/**
+ * Analyzes the ROM loaded at C8Consts::USER_SPACE.
+ *
+ * Throws std::invalid_argument if the ROM doesn't fit the RAM of the
+ * profile.
+ */
+RomAnalysis analyze_rom(std::span<const uint8_t> image, QuirkProfile quirks);
+
+/*
+ * Analyses of the ROMs seen so far, keyed by the content hash and the
+ * profile, so every ROM is analyzed once. Thread-safe.
+ */
+class AnalysisCache {
+public:
+    std::shared_ptr<const RomAnalysis>
+    get(std::span<const uint8_t> image, QuirkProfile quirks);
+
+    std::size_t size() const;
+
+private:
+    using key_t = std::pair<uint64_t, QuirkProfile>;
+
+    mutable std::mutex                                  mutex;
+    std::map<key_t, std::shared_ptr<const RomAnalysis>> analyses;
+};
+
+#endif /* !DISASM_HPP_ */
@@ -0,0 +1,141 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_disasm_test - control flow recovery: loops found by analyze_rom
+ * in small hand-written ROMs, a self-loop, nested loops, a loop entered
+ * from two places and an irreducible cycle, that isn't a loop, as its
+ * blocks don't dominate each other.
+ */
+
+#include "disasm.hpp"
+#include "quirks.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+struct Case {
+    std::string           name;
+    std::vector<uint16_t> instrs; // at C8Consts::USER_SPACE
+    std::vector<uint16_t> blocks; // starts of the basic blocks
+    std::vector<Loop>     loops;
+};
+
+const std::vector<Case> cases{
+    {"self-loop",
+     {
+         0x1200, // 200: JP 0x200
+     },
+     {0x200},
+     {{0x200, {0x200}, {0x200}, 2, true}}},
+
+    {"nested loops",
+     {
+         0x6000, // 200: LD V0, 0x00
+         0x6100, // 202: LD V1, 0x00   outer loop
+         0x7101, // 204: ADD V1, 0x01  inner loop
+         0x3105, // 206: SE V1, 0x05
+         0x1204, // 208: JP 0x204
+         0x7001, // 20A: ADD V0, 0x01
+         0x3003, // 20C: SE V0, 0x03
+         0x1202, // 20E: JP 0x202
+         0x1210, // 210: JP 0x210
+     },
+     {0x200, 0x202, 0x204, 0x208, 0x20A, 0x20E, 0x210},
+     {{0x202, {0x20E}, {0x202, 0x204, 0x208, 0x20A, 0x20E}, 14, false},
+      {0x204, {0x208}, {0x204, 0x208}, 6, true},
+      {0x210, {0x210}, {0x210}, 2, true}}},
+
+    {"two entries into the header",
+     {
+         0x3000, // 200: SE V0, 0x00
+         0x1206, // 202: JP 0x206
+         0x6101, // 204: LD V1, 0x01
+         0x7001, // 206: ADD V0, 0x01  dominated by 0x200 only
+         0x1206, // 208: JP 0x206
+     },
+     {0x200, 0x202, 0x204, 0x206},
+     {{0x206, {0x206}, {0x206}, 4, true}}},
+
+    {"irreducible cycle",
+     {
+         0x3000, // 200: SE V0, 0x00
+         0x1206, // 202: JP 0x206
+         0x120A, // 204: JP 0x20A
+         0x7001, // 206: ADD V0, 0x01
+         0x120A, // 208: JP 0x20A
+         0x7101, // 20A: ADD V1, 0x01
+         0x1206, // 20C: JP 0x206
+     },
+     {0x200, 0x202, 0x204, 0x206, 0x20A},
+     {}}};
+
+bool same(const Loop &a, const Loop &b)
+{
+    return a.header == b.header && a.latches == b.latches
+           && a.blocks == b.blocks && a.size == b.size
+           && a.innermost == b.innermost;
+}
+
+/** \return false if the blocks or the loops aren't the expected ones */
+bool check_case(const Case &test)
+{
+    std::vector<uint8_t> image;
+    for (const uint16_t instr : test.instrs) {
+        image.push_back(static_cast<uint8_t>(instr >> 8));
+        image.push_back(static_cast<uint8_t>(instr));
+    }
+
+    const RomAnalysis analysis = analyze_rom(image, QuirkProfile::chip8);
+
+    std::vector<uint16_t> blocks;
+    for (const BasicBlock &block : analysis.blocks)
+        blocks.push_back(static_cast<uint16_t>(block.start));
+
+    if (blocks != test.blocks) {
+        std::cerr << test.name << ": wrong blocks\n";
+        return false;
+    }
+
+    bool passed = analysis.loops.size() == test.loops.size();
+    for (std::size_t i = 0; passed && i < test.loops.size(); ++i)
+        passed = same(analysis.loops[i], test.loops[i]);
+
+    if (!passed) {
+        std::cerr << test.name << ": wrong loops\n";
+        return false;
+    }
+
+    return true;
+}
+} // namespace
+
+int main()
+{
+    bool passed = true;
+
+    for (const Case &test : cases)
+        passed &= check_case(test);
+
+    return passed ? 0 : 1;
+}
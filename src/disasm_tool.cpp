@@ -0,0 +1,286 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite-disasm - disassembles ROMs, recovering the code reachable from the
+ * entry point and splitting it into basic blocks, with the loops and the
+ * data regions in between:
+ *
+ *   granite-disasm [--quirks PROFILE] [--summary] <ROM or pack>...
+ *
+ * ROMs of packs (*.grpk) are disassembled with their own quirk profiles.
+ * --summary prints just the blocks, loops and data regions of every ROM.
+ */
+
+#include "chipvm.hpp"
+#include "disasm.hpp"
+#include "mapped_file.hpp"
+#include "quirks.hpp"
+#include "rom_pack.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+struct Options {
+    QuirkProfile             quirks  = default_quirk_profile;
+    bool                     summary = false;
+    std::vector<std::string> roms;
+};
+
+std::optional<Options> parse_args(int argc, char *argv[])
+{
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        if (arg == "--quirks" && i + 1 < argc) {
+            const auto quirks = parse_quirk_profile(argv[++i]);
+            if (!quirks)
+                return std::nullopt;
+
+            options.quirks = *quirks;
+        }
+        else if (arg == "--summary")
+            options.summary = true;
+        else if (arg.starts_with("--"))
+            return std::nullopt;
+        else
+            options.roms.push_back(arg);
+    }
+
+    if (options.roms.empty())
+        return std::nullopt;
+
+    return options;
+}
+
+std::string hex(uint32_t value, int digits = 4)
+{
+    std::ostringstream str;
+    str << "0x" << std::hex << std::uppercase << std::setfill('0')
+        << std::setw(digits) << value;
+
+    return str.str();
+}
+
+std::string count(std::size_t number, const std::string &noun)
+{
+    return std::to_string(number) + ' ' + noun + (number == 1 ? "" : "s");
+}
+
+std::string join(const std::vector<uint16_t> &addrs)
+{
+    std::string str;
+    for (const uint16_t addr : addrs)
+        str += (str.empty() ? "" : ", ") + hex(addr);
+
+    return str;
+}
+
+bool contains(const std::vector<uint16_t> &sorted, uint32_t addr)
+{
+    return std::binary_search(sorted.cbegin(), sorted.cend(), addr);
+}
+
+void print_summary(const RomAnalysis &analysis)
+{
+    std::size_t data_size = 0;
+    for (const DataRegion &region : analysis.data)
+        data_size += region.end - region.start;
+
+    std::cout << "; " << count(analysis.code.size(), "instruction") << ", "
+              << count(analysis.blocks.size(), "block") << ", "
+              << count(analysis.loops.size(), "loop") << ", "
+              << count(data_size, "byte") << " of data\n";
+
+    for (const Loop &loop : analysis.loops) {
+        std::cout << "; loop " << hex(loop.header) << ": "
+                  << count(loop.blocks.size(), "block") << ", "
+                  << count(loop.size, "byte") << ", back from "
+                  << join(loop.latches)
+                  << (loop.innermost ? ", innermost" : "") << '\n';
+    }
+
+    for (const DataRegion &region : analysis.data) {
+        std::cout << "; data " << hex(region.start) << '-' << hex(region.end)
+                  << ", " << count(region.end - region.start, "byte") << '\n';
+    }
+
+    if (!analysis.subroutines.empty())
+        std::cout << "; subroutines " << join(analysis.subroutines) << '\n';
+
+    // Code behind these may be missing
+    if (!analysis.indirect_jumps.empty())
+        std::cout << "; indirect jumps at " << join(analysis.indirect_jumps)
+                  << '\n';
+}
+
+void print_block(const RomAnalysis &analysis, const BasicBlock &block)
+{
+    std::vector<std::string> notes;
+    if (block.start == analysis.blocks.front().start)
+        notes.push_back("entry");
+    if (contains(analysis.subroutines, block.start))
+        notes.push_back("subroutine");
+
+    for (const Loop &loop : analysis.loops)
+        if (loop.header == block.start)
+            notes.push_back(loop.innermost ? "innermost loop" : "loop");
+
+    std::cout << '\n' << hex(block.start) << ':';
+    for (std::size_t i = 0; i < notes.size(); ++i)
+        std::cout << (i ? ", " : "  ; ") << notes[i];
+    std::cout << '\n';
+
+    auto it = std::lower_bound(
+        analysis.code.cbegin(),
+        analysis.code.cend(),
+        block.start,
+        [](const Instruction &instr, uint32_t addr) {
+            return instr.addr < addr;
+        });
+
+    // Instructions may overlap, so follow the lengths
+    for (uint32_t addr = block.start; addr < block.end;) {
+        it = std::find_if(it, analysis.code.cend(), [addr](const auto &i) {
+            return i.addr == addr;
+        });
+
+        std::cout << "    " << hex(it->addr) << "  "
+                  << hex(it->instr).substr(2) << ' '
+                  << (it->length > 2 ? hex(it->operand).substr(2) : "    ")
+                  << "  " << format_instruction(*it, analysis.quirks) << '\n';
+
+        addr += it->length;
+    }
+
+    if (block.flow != Flow::next || !block.successors.empty())
+        std::cout << "    ; -> "
+                  << (block.successors.empty() ? "none"
+                                               : join(block.successors))
+                  << '\n';
+}
+
+void print_data(std::span<const uint8_t> image, const DataRegion &region)
+{
+    constexpr uint32_t bytes_per_line = 8;
+
+    std::cout << '\n' << hex(region.start) << ":  ; data\n";
+
+    for (uint32_t addr = region.start; addr < region.end;
+         addr += bytes_per_line) {
+        std::cout << "    " << hex(addr) << "  DB ";
+
+        const uint32_t line_end = std::min(region.end, addr + bytes_per_line);
+        for (uint32_t byte = addr; byte < line_end; ++byte)
+            std::cout << (byte != addr ? ", " : "")
+                      << hex(image[byte - C8Consts::USER_SPACE], 2);
+
+        std::cout << '\n';
+    }
+}
+
+void disassemble(
+    AnalysisCache &          cache,
+    const std::string &      name,
+    std::span<const uint8_t> image,
+    QuirkProfile             quirks,
+    bool                     summary)
+{
+    const auto analysis = cache.get(image, quirks);
+
+    std::cout << "; " << name << ", " << quirk_profile_name(quirks) << ", "
+              << image.size() << " bytes\n";
+    print_summary(*analysis);
+
+    if (!summary) {
+        auto block = analysis->blocks.cbegin();
+        auto data  = analysis->data.cbegin();
+
+        // Data regions never overlap the code, list both by the address
+        while (block != analysis->blocks.cend()
+               || data != analysis->data.cend()) {
+            if (data == analysis->data.cend()
+                || (block != analysis->blocks.cend()
+                    && block->start < data->start))
+                print_block(*analysis, *block++);
+            else
+                print_data(image, *data++);
+        }
+    }
+
+    std::cout << '\n';
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const auto options = parse_args(argc, argv);
+    if (!options) {
+        std::cerr << "Usage: granite-disasm [--quirks PROFILE] [--summary]"
+                     " <ROM or pack>...\n";
+        return 1;
+    }
+
+    // Same ROMs in different packs are analyzed once
+    AnalysisCache cache;
+
+    try {
+        for (const std::string &rom : options->roms) {
+            if (fs::path(rom).extension() != ".grpk") {
+                const MappedFile file(rom);
+                disassemble(
+                    cache, rom, file.span(), options->quirks, options->summary);
+                continue;
+            }
+
+            const RomPack pack(rom);
+            for (std::size_t i = 0; i < pack.size(); ++i) {
+                const RomInfo info = pack.rom(i);
+                disassemble(
+                    cache,
+                    rom + ':' + std::string(info.name),
+                    info.image,
+                    info.quirks,
+                    options->summary);
+            }
+        }
+    }
+    catch (const std::exception &ex) {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "env_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+// Every task steps this many environments at least
+constexpr std::size_t min_chunk = 16;
+
+// Tasks per worker, so the idle ones have something to steal
+constexpr std::size_t chunks_per_worker = 4;
+
+// splitmix64 finalizer, spreads nearby seeds far apart
+uint64_t mix(uint64_t value) noexcept
+{
+    value += 0x9E3779B97F4A7C15;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+    return value ^ (value >> 31);
+}
+} // namespace
+
+EnvPool::EnvPool(const std::vector<uint8_t> &rom, const EnvOptions &options)
+    : instructions_per_frame(std::max(1U, options.instructions_per_frame)),
+      seed(options.seed),
+      frames_buffer(options.count * frame_words),
+      done_flags(options.count),
+      pool(options.threads)
+{
+    if (options.count == 0)
+        throw std::invalid_argument("There must be at least one environment");
+
+    // Environments share the drivers, that do nothing
+    const auto display_driver =
+        std::make_shared<HeadlessImpl::NullDisplayDriver>();
+    const auto sound_driver = std::make_shared<HeadlessImpl::NullSoundDriver>();
+
+    envs.resize(options.count);
+    for (Env &env : envs) {
+        env.keyboard = std::make_shared<HeadlessImpl::BitmapKeyboardDriver>();
+        env.vm       = std::make_unique<ChipVM>(
+            display_driver, env.keyboard, sound_driver);
+    }
+
+    ChipVM &first = *envs.front().vm;
+    first.set_quirks(options.quirks);
+
+    if (rom.size() > first.ram.size() - C8Consts::USER_SPACE)
+        throw std::invalid_argument("ROM doesn't fit the RAM");
+
+    std::copy(rom.begin(), rom.end(), first.ram.begin() + C8Consts::USER_SPACE);
+    first.timer_mode      = TimerMode::virtual_time;
+    first.cycles_per_tick = instructions_per_frame;
+
+    initial_state = first.save_state();
+
+    reset();
+
+    chunk =
+        std::max(min_chunk, envs.size() / (pool.size() * chunks_per_worker));
+
+    if (options.engine == EnvEngine::lockstep) {
+        if (options.lockstep_width != 8 && options.lockstep_width != 16
+            && options.lockstep_width != 32)
+            throw std::invalid_argument("Group width must be 8, 16 or 32");
+
+        // Whole groups per task, every task runs its own engine. Profile is
+        // loaded by reset(), so the VMs are ready for the engines.
+        const std::size_t width = options.lockstep_width;
+        chunk                   = (chunk + width - 1) / width * width;
+
+        for (std::size_t begin = 0; begin < envs.size(); begin += chunk) {
+            const std::size_t end = std::min(begin + chunk, envs.size());
+
+            std::vector<ChipVM *> vms;
+            for (std::size_t index = begin; index < end; ++index)
+                vms.push_back(envs[index].vm.get());
+
+            engines.emplace_back(std::move(vms), width);
+        }
+    }
+}
+
+void EnvPool::step(const uint16_t *actions)
+{
+    // Submitted tasks refer to the actions, so they must be finished before
+    // leaving, even if submitting the rest has failed
+    try {
+        for (std::size_t begin = 0; begin < envs.size(); begin += chunk) {
+            const std::size_t end = std::min(begin + chunk, envs.size());
+            pool.submit([=, this] { step_range(begin, end, actions); });
+        }
+    }
+    catch (...) {
+        pool.wait();
+        throw;
+    }
+
+    pool.wait();
+}
+
+void EnvPool::reset()
+{
+    for (std::size_t index = 0; index < envs.size(); ++index) {
+        envs[index].episode = 0;
+        start_episode(index);
+    }
+}
+
+void EnvPool::reset(std::size_t index) { start_episode(index); }
+
+void EnvPool::step_range(
+    std::size_t     begin,
+    std::size_t     end,
+    const uint16_t *actions) noexcept
+{
+    for (std::size_t index = begin; index < end; ++index)
+        envs[index].keyboard->set_keys(actions[index]);
+
+    if (engines.empty()) {
+        for (std::size_t index = begin; index < end; ++index)
+            envs[index].vm->run(instructions_per_frame);
+    }
+    else {
+        engines[begin / chunk].run(instructions_per_frame);
+    }
+
+    for (std::size_t index = begin; index < end; ++index) {
+        Env &env = envs[index];
+
+        ++env.frames;
+
+        done_flags[index] = !env.vm->working;
+        if (done_flags[index])
+            start_episode(index);
+        else
+            copy_frame(index);
+    }
+}
+
+/*
+ * Initial state is always valid, and loading a state never allocates, so it
+ * can't fail.
+ */
+void EnvPool::start_episode(std::size_t index) noexcept
+{
+    Env &env = envs[index];
+
+    env.vm->load_state(initial_state.data(), initial_state.size());
+    env.vm->seed_random(mix(seed + mix(index + mix(env.episode))));
+    env.keyboard->set_keys(0);
+
+    ++env.episode;
+    env.frames = 0;
+
+    copy_frame(index);
+}
+
+void EnvPool::copy_frame(std::size_t index) noexcept
+{
+    Framebuffer::word_t *dst = frames_buffer.data() + index * frame_words;
+
+    for (const auto &plane : envs[index].vm->display.data())
+        for (const auto &row : plane)
+            dst = std::copy(row.cbegin(), row.cend(), dst);
+}
@@ -0,0 +1,150 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENV_POOL_HPP_
+#define ENV_POOL_HPP_
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "lockstep.hpp"
+#include "quirks.hpp"
+#include "thread_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+enum class EnvEngine : uint8_t {
+    interpreter, // every VM by itself, ChipVM::run
+    lockstep     // groups of VMs, LockstepEngine
+};
+
+struct EnvOptions {
+    std::size_t  count                  = 1;
+    uint32_t     instructions_per_frame = 10;
+    QuirkProfile quirks                 = default_quirk_profile;
+    std::size_t  threads                = 0; // 0 means hardware concurrency
+    uint64_t     seed                   = 0;
+    EnvEngine    engine                 = EnvEngine::interpreter;
+    std::size_t  lockstep_width         = 16; // 8, 16 or 32
+};
+
+/*
+ * Lots of VMs running the same ROM as environments for reinforcement
+ * learning. Every step advances all of them by one 60 Hz frame in parallel
+ * and gathers their displays into one contiguous buffer. Environment, that
+ * stops working (faults, exits or runs off the RAM), is reset to the
+ * initial state right away and reported as done.
+ *
+ * Timers run in virtual time, one tick per frame, and the random generator
+ * of every episode is seeded from the seed, the environment index and the
+ * episode number, so runs are reproducible. Both engines give exactly the
+ * same results, the lockstep one is faster for ROMs, that spend most of the
+ * time in register and jump instructions.
+ */
+class EnvPool {
+public:
+    // Display words of an environment: plane by plane, row by row, as in
+    // Framebuffer::data
+    static constexpr std::size_t frame_words =
+        Framebuffer::planes * Framebuffer::max_height * Framebuffer::row_words;
+
+    /**
+     * Throws std::invalid_argument if there are no environments, the ROM
+     * doesn't fit the RAM or the lockstep width isn't supported.
+     */
+    EnvPool(const std::vector<uint8_t> &rom, const EnvOptions &options);
+
+    EnvPool(const EnvPool &) = delete;
+    EnvPool &operator=(const EnvPool &) = delete;
+
+    std::size_t size() const noexcept { return envs.size(); }
+
+    /**
+     * Advances every environment by a frame. Throws std::bad_alloc if the
+     * tasks can't be queued, the environments may be partially stepped then.
+     *
+     * \param actions Bitmap of the pressed keys (bit per key) for every
+     * environment
+     */
+    void step(const uint16_t *actions);
+
+    // Starts new episodes
+    void reset();
+    void reset(std::size_t index);
+
+    /**
+     * size() * frame_words words, updated by step() and reset(). Frame of
+     * the environment, that has been reset, is the first one of the new
+     * episode.
+     */
+    const Framebuffer::word_t *frames() const noexcept
+    {
+        return frames_buffer.data();
+    }
+
+    // Flag per environment, whether it has been reset during the last step
+    const uint8_t *done() const noexcept { return done_flags.data(); }
+
+    uint64_t episode_frames(std::size_t index) const noexcept
+    {
+        return envs[index].frames;
+    }
+
+    /**
+     * VM of the environment, e.g. for reading the score from its RAM.
+     */
+    const ChipVM &vm(std::size_t index) const noexcept
+    {
+        return *envs[index].vm;
+    }
+
+private:
+    struct Env {
+        std::unique_ptr<ChipVM>                             vm;
+        std::shared_ptr<HeadlessImpl::BitmapKeyboardDriver> keyboard;
+
+        uint64_t episode = 0;
+        uint64_t frames  = 0; // since the start of the episode
+    };
+
+    void step_range(
+        std::size_t     begin,
+        std::size_t     end,
+        const uint16_t *actions) noexcept;
+    void start_episode(std::size_t index) noexcept;
+    void copy_frame(std::size_t index) noexcept;
+
+    const uint32_t instructions_per_frame;
+    const uint64_t seed;
+
+    std::vector<Env>     envs;
+    std::vector<uint8_t> initial_state;
+
+    std::vector<Framebuffer::word_t> frames_buffer;
+    std::vector<uint8_t>             done_flags;
+
+    // Lockstep engine per chunk of environments, empty for the interpreter
+    std::vector<LockstepEngine> engines;
+    std::size_t                 chunk = 0; // environments per task
+
+    ThreadPool pool;
+};
+
+#endif /* !ENV_POOL_HPP_ */
@@ -0,0 +1,246 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAMEBUFFER_HPP_
+#define FRAMEBUFFER_HPP_
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+namespace C8Consts {
+enum {
+    DISPLAY_WIDTH        = 64,
+    DISPLAY_HEIGHT       = 32,
+    HIRES_DISPLAY_WIDTH  = 128, // SUPER-CHIP high resolution mode
+    HIRES_DISPLAY_HEIGHT = 64,
+    DISPLAY_PLANES       = 2, // XO-CHIP
+    SPRITE_WIDTH         = 8,
+    LARGE_SPRITE_WIDTH   = 16 // Dxy0
+};
+}
+
+/*
+ * Display of up to two bitplanes, every row of a plane is packed into
+ * 64-bit words, the most significant bit of the first word is the leftmost
+ * pixel. That way a row of a sprite is drawn with a couple of shifts, ANDs
+ * (collision) and XORs, and scrolling moves whole words, not pixels.
+ *
+ * Low resolution mode (64x32) uses only the first word of the first 32
+ * rows, the high resolution one (128x64) uses all of them.
+ */
+class Framebuffer {
+public:
+    using word_t = uint64_t;
+
+    static constexpr std::size_t word_bits  = sizeof(word_t) * CHAR_BIT;
+    static constexpr std::size_t max_width  = C8Consts::HIRES_DISPLAY_WIDTH;
+    static constexpr std::size_t max_height = C8Consts::HIRES_DISPLAY_HEIGHT;
+    static constexpr std::size_t planes     = C8Consts::DISPLAY_PLANES;
+    static constexpr std::size_t row_words  = max_width / word_bits;
+
+    static constexpr uint8_t all_planes = (1U << planes) - 1;
+
+    static_assert(
+        C8Consts::DISPLAY_WIDTH % word_bits == 0
+            && max_width % word_bits == 0,
+        "Display row must fit exactly into words");
+
+    using row_t   = std::array<word_t, row_words>;
+    using plane_t = std::array<row_t, max_height>;
+
+    bool hires() const noexcept { return hires_mode; }
+
+    // Switches the resolution, the display is cleared
+    void set_hires(bool hires) noexcept
+    {
+        hires_mode = hires;
+        clear();
+    }
+
+    std::size_t width() const noexcept
+    {
+        return hires_mode ? max_width
+                          : static_cast<std::size_t>(C8Consts::DISPLAY_WIDTH);
+    }
+
+    std::size_t height() const noexcept
+    {
+        return hires_mode ? max_height
+                          : static_cast<std::size_t>(C8Consts::DISPLAY_HEIGHT);
+    }
+
+    void clear(uint8_t plane_mask = all_planes) noexcept
+    {
+        for (std::size_t plane = 0; plane < planes; ++plane)
+            if (plane_mask & (1U << plane))
+                rows[plane].fill({});
+    }
+
+    /**
+     * \return Color of the pixel: bit 0 is set in the first plane, bit 1 in
+     * the second one
+     */
+    uint8_t pixel(std::size_t x, std::size_t y) const noexcept
+    {
+        const std::size_t word = x / word_bits;
+        const std::size_t bit  = word_bits - 1 - x % word_bits;
+
+        return (rows[0][y][word] >> bit & 1U)
+               | (rows[1][y][word] >> bit & 1U) << 1;
+    }
+
+    /**
+     * XORs row of the sprite (up to 16 pixels, starting from the most
+     * significant bit) onto the plane at (x, y), x must be less than the
+     * width. Pixels going beyond the right edge are clipped, or drawn at
+     * the left edge if `wrap` is set.
+     *
+     * \return Has any pixel been erased
+     */
+    bool draw_row(
+        std::size_t plane,
+        std::size_t x,
+        std::size_t y,
+        uint16_t    sprite_row,
+        bool        wrap = false) noexcept
+    {
+        constexpr std::size_t sprite_bits = sizeof sprite_row * CHAR_BIT;
+
+        const std::size_t word = x / word_bits, bit = x % word_bits;
+        const word_t      sprite = static_cast<word_t>(sprite_row)
+                              << (word_bits - sprite_bits);
+
+        row_t &dst = rows[plane][y];
+
+        bool erased = xor_word(dst[word], sprite >> bit);
+
+        // Part of the sprite, that goes to the next word
+        if (bit > word_bits - sprite_bits) {
+            const word_t spilled = sprite << (word_bits - bit);
+
+            if (word + 1 < width() / word_bits)
+                erased |= xor_word(dst[word + 1], spilled);
+            else if (wrap)
+                erased |= xor_word(dst[0], spilled);
+        }
+
+        return erased;
+    }
+
+    void scroll_down(std::size_t n, uint8_t plane_mask) noexcept
+    {
+        n = std::min(n, height());
+
+        for_each_plane(plane_mask, [&](plane_t &plane) {
+            std::copy_backward(
+                plane.begin(),
+                plane.begin() + (height() - n),
+                plane.begin() + height());
+            std::fill_n(plane.begin(), n, row_t{});
+        });
+    }
+
+    void scroll_up(std::size_t n, uint8_t plane_mask) noexcept
+    {
+        n = std::min(n, height());
+
+        for_each_plane(plane_mask, [&](plane_t &plane) {
+            std::copy(
+                plane.begin() + n, plane.begin() + height(), plane.begin());
+            std::fill_n(plane.begin() + (height() - n), n, row_t{});
+        });
+    }
+
+    /*
+     * Horizontal scrolls shift every word of the row, carrying the pixels
+     * over to the neighbor word. n must be less than a word.
+     */
+
+    void scroll_right(std::size_t n, uint8_t plane_mask) noexcept
+    {
+        if (n == 0)
+            return;
+
+        const std::size_t words = width() / word_bits;
+
+        for_each_plane(plane_mask, [&](plane_t &plane) {
+            for (std::size_t y = 0; y < height(); ++y) {
+                word_t carry = 0;
+
+                for (std::size_t i = 0; i < words; ++i) {
+                    const word_t pixels = plane[y][i];
+
+                    plane[y][i] = pixels >> n | carry;
+                    carry       = pixels << (word_bits - n);
+                }
+            }
+        });
+    }
+
+    void scroll_left(std::size_t n, uint8_t plane_mask) noexcept
+    {
+        if (n == 0)
+            return;
+
+        const std::size_t words = width() / word_bits;
+
+        for_each_plane(plane_mask, [&](plane_t &plane) {
+            for (std::size_t y = 0; y < height(); ++y) {
+                word_t carry = 0;
+
+                for (std::size_t i = words; i-- > 0;) {
+                    const word_t pixels = plane[y][i];
+
+                    plane[y][i] = pixels << n | carry;
+                    carry       = pixels >> (word_bits - n);
+                }
+            }
+        });
+    }
+
+    const std::array<plane_t, planes> &data() const noexcept { return rows; }
+    std::array<plane_t, planes> &      data() noexcept { return rows; }
+
+    bool operator==(const Framebuffer &) const = default;
+
+private:
+    // \return Has any pixel been erased
+    static bool xor_word(word_t &dst, word_t pixels) noexcept
+    {
+        const bool erased = (dst & pixels) != 0;
+        dst ^= pixels;
+
+        return erased;
+    }
+
+    template <class Func>
+    void for_each_plane(uint8_t plane_mask, Func &&func) noexcept
+    {
+        for (std::size_t plane = 0; plane < planes; ++plane)
+            if (plane_mask & (1U << plane))
+                func(rows[plane]);
+    }
+
+    std::array<plane_t, planes> rows{};
+    bool                        hires_mode = false;
+};
+
+#endif /* !FRAMEBUFFER_HPP_ */
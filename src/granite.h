@@ -0,0 +1,233 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRANITE_H_
+#define GRANITE_H_
+
+/*
+ * C API of the granite_core library, for embedding the VM into harnesses
+ * and other languages. VMs are headless: timers run in virtual time, keys
+ * are set as a bitmap and the display is read right from the VM.
+ *
+ * granite_env_pool runs lots of VMs with the same ROM as environments for
+ * reinforcement learning, stepping all of them by a frame at once (see
+ * EnvPool of env_pool.hpp).
+ *
+ * Functions never throw, a VM may be used by one thread at a time. Handles
+ * (granite_vm and granite_env_pool) passed to the functions must be the
+ * ones they have created, NULL ones are accepted only by the destroying
+ * functions. Other pointers are checked by the functions, that return a
+ * status.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented on incompatible changes of the API */
+#define GRANITE_API_VERSION 1
+
+typedef struct granite_vm       granite_vm;
+typedef struct granite_env_pool granite_env_pool;
+
+/* See the --quirks option */
+typedef enum granite_quirks {
+    GRANITE_QUIRKS_CHIP8,
+    GRANITE_QUIRKS_CHIP48,
+    GRANITE_QUIRKS_SUPERCHIP,
+    GRANITE_QUIRKS_XOCHIP,
+    GRANITE_QUIRKS_LEGACY
+} granite_quirks;
+
+typedef enum granite_status {
+    GRANITE_OK,
+    GRANITE_ERROR_OUT_OF_MEMORY,
+    GRANITE_ERROR_INVALID_ARGUMENT,
+    GRANITE_ERROR_ROM_TOO_LARGE,
+    GRANITE_ERROR_INVALID_STATE
+} granite_status;
+
+/* Same as the Fault enumeration of the VM */
+typedef enum granite_fault {
+    GRANITE_FAULT_NONE,
+    GRANITE_FAULT_STACK_OVERFLOW,
+    GRANITE_FAULT_STACK_UNDERFLOW,
+    GRANITE_FAULT_SEGMENTATION_FAULT,
+    GRANITE_FAULT_INVALID_KEY
+} granite_fault;
+
+/* Display words: 2 planes of 64 rows of 2 words, see granite_framebuffer */
+#define GRANITE_FRAMEBUFFER_PLANES    2
+#define GRANITE_FRAMEBUFFER_ROWS      64
+#define GRANITE_FRAMEBUFFER_ROW_WORDS 2
+#define GRANITE_FRAMEBUFFER_WORDS                                            \
+    (GRANITE_FRAMEBUFFER_PLANES * GRANITE_FRAMEBUFFER_ROWS                   \
+     * GRANITE_FRAMEBUFFER_ROW_WORDS)
+
+int granite_api_version(void);
+
+/**
+ * \return NULL if out of memory or the profile is unknown
+ */
+granite_vm *granite_create(granite_quirks quirks);
+void        granite_destroy(granite_vm *vm);
+
+/**
+ * Copies the ROM to the RAM at 0x200.
+ */
+granite_status granite_load_rom(
+    granite_vm *   vm,
+    const uint8_t *rom,
+    size_t         size);
+
+/**
+ * Executes up to `count` instructions, less if the VM stops (exits or
+ * faults).
+ *
+ * \return Number of executed instructions
+ */
+uint64_t granite_run_cycles(granite_vm *vm, uint64_t count);
+
+/**
+ * Timers are decremented once per this many instructions (10 by default).
+ */
+void granite_set_cycles_per_tick(granite_vm *vm, uint32_t cycles);
+
+/**
+ * Pressed keys, bit per key. LD Vx, K waits (retrying on every cycle)
+ * while none is pressed.
+ */
+void granite_set_keys(granite_vm *vm, uint16_t keys);
+
+void granite_seed_random(granite_vm *vm, uint64_t seed);
+
+int           granite_working(const granite_vm *vm);
+granite_fault granite_get_fault(const granite_vm *vm);
+uint64_t      granite_cycles(const granite_vm *vm);
+
+/**
+ * Live display of the VM, valid until the VM is destroyed:
+ * GRANITE_FRAMEBUFFER_WORDS words, plane by plane, row by row. Pixel x of a
+ * row is bit 63 - x % 64 of its word x / 64. Low resolution (64x32) uses
+ * the first word of the first 32 rows.
+ */
+const uint64_t *granite_framebuffer(const granite_vm *vm);
+
+int granite_display_width(const granite_vm *vm);
+int granite_display_height(const granite_vm *vm);
+
+/**
+ * Incremented every time the display is modified.
+ */
+uint64_t granite_frame_version(const granite_vm *vm);
+
+/**
+ * Serializes the VM state to the buffer.
+ *
+ * \return Size of the state, nothing is written if it's greater than
+ * `size`, so call it with NULL buffer to get the size
+ */
+size_t granite_save_state(
+    const granite_vm *vm,
+    uint8_t *         buffer,
+    size_t            size);
+
+/**
+ * Restores the state, saved by granite_save_state (of any VM).
+ */
+granite_status granite_load_state(
+    granite_vm *   vm,
+    const uint8_t *state,
+    size_t         size);
+
+/* Same as EnvEngine, both give the same results */
+typedef enum granite_env_engine {
+    GRANITE_ENV_ENGINE_INTERPRETER,
+    GRANITE_ENV_ENGINE_LOCKSTEP
+} granite_env_engine;
+
+/* Same as EnvOptions, see granite_env_default_options */
+typedef struct granite_env_options {
+    size_t             count; /* number of the environments */
+    uint32_t           instructions_per_frame;
+    granite_quirks     quirks;
+    size_t             threads; /* 0 means hardware concurrency */
+    uint64_t           seed;
+    granite_env_engine engine;
+    size_t             lockstep_width; /* 8, 16 or 32 */
+} granite_env_options;
+
+granite_env_options granite_env_default_options(void);
+
+/**
+ * Loads the ROM into every environment and starts their first episodes.
+ *
+ * \return NULL if the options are invalid, the ROM doesn't fit the RAM or
+ * out of memory
+ */
+granite_env_pool *granite_env_pool_create(
+    const uint8_t *            rom,
+    size_t                     size,
+    const granite_env_options *options);
+void granite_env_pool_destroy(granite_env_pool *envs);
+
+size_t granite_env_pool_size(const granite_env_pool *envs);
+
+/**
+ * Advances every environment by a frame. Environments, that stop working,
+ * are reset to a new episode and reported by granite_env_pool_done.
+ *
+ * \param actions Pressed keys (bit per key) for every environment
+ */
+granite_status granite_env_pool_step(
+    granite_env_pool *envs,
+    const uint16_t *  actions);
+
+/**
+ * Starts new episodes of all the environments.
+ */
+void granite_env_pool_reset(granite_env_pool *envs);
+
+/**
+ * Displays of all the environments, valid until the pool is destroyed and
+ * updated by every step: GRANITE_FRAMEBUFFER_WORDS words per environment,
+ * laid out as by granite_framebuffer.
+ */
+const uint64_t *granite_env_pool_frames(const granite_env_pool *envs);
+
+/**
+ * Flag per environment, whether it has been reset during the last step.
+ */
+const uint8_t *granite_env_pool_done(const granite_env_pool *envs);
+
+/**
+ * Frames since the start of the current episode of the environment.
+ *
+ * \param index Must be less than granite_env_pool_size(envs)
+ */
+uint64_t
+granite_env_pool_episode_frames(const granite_env_pool *envs, size_t index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !GRANITE_H_ */
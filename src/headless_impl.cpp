@@ -0,0 +1,244 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "headless_impl.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace HeadlessImpl;
+
+namespace {
+constexpr uint32_t sample_rate    = 22050;
+constexpr uint32_t tone_frequency = 750; // same as WindowsImpl
+
+// Unsigned 8-bit samples
+constexpr uint8_t tone_high = 0xC0, tone_low = 0x40, silence = 0x80;
+
+constexpr std::size_t wav_header_size = 44;
+
+void put_u16(uint8_t *dst, uint16_t value) noexcept
+{
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+}
+
+void put_u32(uint8_t *dst, uint32_t value) noexcept
+{
+    put_u16(dst, value & 0xFFFF);
+    put_u16(dst + 2, value >> 16);
+}
+
+/*
+ * Canonical 44 bytes long header of PCM WAV file, mono, 8 bits per sample.
+ */
+std::array<uint8_t, wav_header_size> wav_header(uint32_t data_size) noexcept
+{
+    std::array<uint8_t, wav_header_size> header{
+        'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 0, 0, 0, 0, 0, 0, 0, 0,
+        0,   0,   0,   0,   0, 0, 0, 0, 0, 0, 0, 0,
+        'd', 'a', 't', 'a', 0, 0, 0, 0};
+
+    put_u32(&header[4], wav_header_size - 8 + data_size);
+    put_u32(&header[16], 16);          // fmt chunk size
+    put_u16(&header[20], 1);           // PCM
+    put_u16(&header[22], 1);           // channels
+    put_u32(&header[24], sample_rate); // samples per second
+    put_u32(&header[28], sample_rate); // bytes per second
+    put_u16(&header[32], 1);           // bytes per sample
+    put_u16(&header[34], 8);           // bits per sample
+    put_u32(&header[40], data_size);
+
+    return header;
+}
+} // namespace
+
+FrameDumpDisplayDriver::FrameDumpDisplayDriver(std::string directory_)
+    : directory(std::move(directory_))
+{}
+
+/*
+ * Binary PBM stores rows MSB first with 1 being black, exactly like
+ * Framebuffer rows, so the row words (of all the planes combined) are just
+ * written in big-endian. Frames are of the current resolution.
+ */
+void FrameDumpDisplayDriver::render(const Framebuffer &display)
+{
+    std::array<char, 32> file_name;
+    std::snprintf(
+        file_name.data(), file_name.size(), "/frame_%06u.pbm", frames_count);
+
+    std::ofstream file(directory + file_name.data(), std::ios::binary);
+    if (!file)
+        throw std::runtime_error(
+            "Failed to write frame to " + directory + file_name.data());
+
+    file << "P4\n" << display.width() << ' ' << display.height() << '\n';
+
+    const std::size_t words = display.width() / Framebuffer::word_bits;
+
+    for (std::size_t y = 0; y < display.height(); ++y) {
+        for (std::size_t word = 0; word < words; ++word) {
+            Framebuffer::word_t pixels = 0;
+            for (const auto &plane : display.data())
+                pixels |= plane[y][word];
+
+            for (std::size_t i = sizeof pixels; i > 0; --i)
+                file.put(static_cast<char>(pixels >> ((i - 1) * 8)));
+        }
+    }
+
+    ++frames_count;
+}
+
+// ----------------------------------------------------------------------------
+
+std::vector<ScriptedKeyboardDriver::KeyEvent>
+ScriptedKeyboardDriver::parse_script(std::istream &script)
+{
+    std::vector<KeyEvent> events;
+
+    std::string line;
+    for (std::size_t line_number = 1; std::getline(script, line);
+         ++line_number) {
+        std::istringstream line_stream(line);
+
+        uint64_t    frame;
+        unsigned    key;
+        std::string action;
+
+        if (!(line_stream >> frame)) {
+            // Empty line or a comment
+            line_stream.clear();
+            std::string word;
+            if (!(line_stream >> word) || word.starts_with('#'))
+                continue;
+        }
+        else if (
+            line_stream >> std::hex >> key >> action && key <= 0xF
+            && (action == "down" || action == "up")) {
+            events.push_back(
+                {frame, static_cast<uint8_t>(key), action == "down"});
+            continue;
+        }
+
+        throw std::runtime_error(
+            "Malformed key script line " + std::to_string(line_number) + ": "
+            + line);
+    }
+
+    std::stable_sort(
+        events.begin(), events.end(), [](const auto &a, const auto &b) {
+            return a.frame < b.frame;
+        });
+
+    return events;
+}
+
+ScriptedKeyboardDriver::ScriptedKeyboardDriver(std::vector<KeyEvent> events_)
+    : events(std::move(events_))
+{}
+
+uint8_t ScriptedKeyboardDriver::wait_for_key()
+{
+    sync();
+
+    while (next_event < events.size()) {
+        const KeyEvent &event = events[next_event++];
+        apply(event);
+
+        if (!event.pressed)
+            return event.key;
+    }
+
+    return 0;
+}
+
+void ScriptedKeyboardDriver::apply(const KeyEvent &event) noexcept
+{
+    if (event.pressed)
+        pressed_keys |= 1U << event.key;
+    else
+        pressed_keys &= ~(1U << event.key);
+}
+
+// ----------------------------------------------------------------------------
+
+WavSoundDriver::WavSoundDriver(const std::string &file_name)
+    : file(file_name, std::ios::binary)
+{
+    if (!file)
+        throw std::runtime_error("Failed to open WAV file " + file_name);
+
+    // Sizes are filled in by shutdown()
+    const auto header = wav_header(0);
+    file.write(reinterpret_cast<const char *>(header.data()), header.size());
+}
+
+WavSoundDriver::~WavSoundDriver() { shutdown(); }
+
+void WavSoundDriver::beep_for(uint32_t duration)
+{
+    // Virtual time of the VM in samples
+    const uint64_t now = vm->cycles() * sample_rate
+                         / (uint64_t{vm->cycles_per_tick}
+                            * C8Consts::TIMERS_FREQUENCY);
+
+    if (now > samples_written)
+        write_samples(now - samples_written, false);
+
+    write_samples(uint64_t{duration} * sample_rate / 1000, true);
+}
+
+void WavSoundDriver::shutdown()
+{
+    if (file.is_open()) {
+        const auto header = wav_header(static_cast<uint32_t>(samples_written));
+
+        file.seekp(0);
+        file.write(
+            reinterpret_cast<const char *>(header.data()), header.size());
+        file.close();
+    }
+
+    IDriver::shutdown();
+}
+
+void WavSoundDriver::write_samples(uint64_t count, bool tone)
+{
+    constexpr uint64_t half_period = sample_rate / tone_frequency / 2;
+
+    for (; count > 0; --count, ++samples_written) {
+        uint8_t sample = silence;
+        if (tone)
+            sample = (samples_written / half_period) % 2 ? tone_low : tone_high;
+
+        file.put(static_cast<char>(sample));
+    }
+}
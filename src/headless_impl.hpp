@@ -0,0 +1,194 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef HEADLESS_IMPL_HPP_
+#define HEADLESS_IMPL_HPP_
+
+#include "chipvm.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <optional>
+#include <string>
+#include <vector>
+
+/*
+ * Drivers for running the VM without any window, sound or keyboard, e.g.
+ * for batch runs on servers. Null drivers do nothing, the others record the
+ * output to files and replay the input from a script.
+ */
+namespace HeadlessImpl {
+
+class NullDisplayDriver : public IDisplayDriver {
+public:
+    void render(const Framebuffer &) override {}
+};
+
+/*
+ * No key is ever pressed, but waiting for a key returns immediately as if
+ * key 0 was pressed, so the VM doesn't hang forever.
+ */
+class NullKeyboardDriver : public IKeyboardDriver {
+public:
+    bool    is_pressed(uint8_t) override { return false; }
+    uint8_t wait_for_key() override { return 0; }
+};
+
+/*
+ * Pressed keys are set all at once as a bitmap (bit per key), e.g. from the
+ * actions of an agent, see EnvPool. It never blocks: while no key is
+ * pressed, LD Vx, K just waits on the next cycle.
+ */
+class BitmapKeyboardDriver : public IKeyboardDriver {
+public:
+    void set_keys(uint16_t keys_) noexcept { keys = keys_; }
+
+    bool is_pressed(uint8_t key) override { return (keys >> key) & 1U; }
+
+    // Lowest pressed key or 0
+    uint8_t wait_for_key() override { return try_get_key().value_or(0); }
+
+    std::optional<uint8_t> try_get_key() override
+    {
+        if (keys == 0)
+            return std::nullopt;
+
+        return static_cast<uint8_t>(std::countr_zero(keys));
+    }
+
+private:
+    uint16_t keys = 0;
+};
+
+class NullSoundDriver : public ISoundDriver {
+public:
+    void beep_for(uint32_t) override {}
+};
+
+/*
+ * Writes every rendered frame to the directory as a binary PBM image
+ * (frame_000000.pbm, frame_000001.pbm, ...). The VM renders only frames,
+ * that have changed, see ChipVM::present.
+ */
+class FrameDumpDisplayDriver : public IDisplayDriver {
+public:
+    explicit FrameDumpDisplayDriver(std::string directory_);
+
+    void render(const Framebuffer &display) override;
+
+    uint32_t frames_written() const noexcept { return frames_count; }
+
+private:
+    const std::string directory;
+    uint32_t          frames_count = 0;
+};
+
+/*
+ * Replays key presses and releases from a script, timed in 60 Hz frames of
+ * the VM (i.e. timer ticks in virtual time). Script has one event per line:
+ *
+ *   <frame> <key 0-F> <down|up>
+ *
+ * Empty lines and lines starting with # are ignored. The VM has to be
+ * attached before running, as it's the source of time.
+ */
+class ScriptedKeyboardDriver : public IKeyboardDriver {
+public:
+    struct KeyEvent {
+        uint64_t frame;
+        uint8_t  key;
+        bool     pressed;
+    };
+
+    /**
+     * Throws std::runtime_error on a malformed line.
+     */
+    static std::vector<KeyEvent> parse_script(std::istream &script);
+
+    explicit ScriptedKeyboardDriver(std::vector<KeyEvent> events_);
+
+    void attach(const ChipVM &vm_) noexcept { vm = &vm_; }
+
+    bool is_pressed(uint8_t key) override
+    {
+        sync();
+        return (pressed_keys >> key) & 1U;
+    }
+
+    /**
+     * Nothing can happen while the VM waits, so it fast-forwards the script
+     * to the next key release. Returns key 0 if the script is over.
+     */
+    uint8_t wait_for_key() override;
+
+private:
+    // Applies the events, that are due by now
+    void sync() noexcept
+    {
+        while (next_event < events.size()
+               && events[next_event].frame * vm->cycles_per_tick
+                      <= vm->cycles())
+            apply(events[next_event++]);
+    }
+
+    void apply(const KeyEvent &event) noexcept;
+
+    const ChipVM *        vm = nullptr;
+    std::vector<KeyEvent> events; // sorted by frame
+    std::size_t           next_event   = 0;
+    uint16_t              pressed_keys = 0; // bit per key
+};
+
+/*
+ * Records beeps into a mono 8-bit PCM WAV file as a square wave, placing
+ * them according to the VM's virtual time, so the recording matches what
+ * would be heard when running at the normal speed. The VM has to be
+ * attached before running.
+ */
+class WavSoundDriver : public ISoundDriver {
+public:
+    /**
+     * Throws std::runtime_error if the file can't be opened.
+     */
+    explicit WavSoundDriver(const std::string &file_name);
+    ~WavSoundDriver();
+
+    void attach(const ChipVM &vm_) noexcept { vm = &vm_; }
+
+    void beep_for(uint32_t duration) override;
+
+    /**
+     * Finalizes the file, called by the destructor too.
+     */
+    void shutdown() override;
+
+private:
+    void write_samples(uint64_t count, bool tone);
+
+    const ChipVM *vm = nullptr;
+    std::ofstream file;
+    uint64_t      samples_written = 0;
+};
+
+} // namespace HeadlessImpl
+
+#endif /* !HEADLESS_IMPL_HPP_ */
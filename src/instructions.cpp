@@ -16,453 +16,802 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-// As it's a huge method, it is taken out into separated file.
+
+// As it's a huge bunch of methods, they are taken out into separated file.
 
 #include "chipvm.hpp"
+#include "decode.hpp"
 
 #include <algorithm>
-#include <chrono>
+#include <bit>
+#include <climits>
 #include <cstddef>
 #include <cstdint>
-#include <functional> // std::ref
-#include <stdexcept>
-#include <thread>
-#include <vector>
 
-using namespace std::chrono;
 using instr_t = ChipVM::instr_t;
 
-uint16_t decode_addr(instr_t instr) noexcept { return instr & 0xFFF; }
-uint8_t  decode_reg_x(instr_t instr) noexcept { return (instr & 0x0F00) >> 8; }
-uint8_t  decode_reg_y(instr_t instr) noexcept { return (instr & 0x00F0) >> 4; }
-uint8_t  decode_imm(instr_t instr) noexcept { return instr & 0x00FF; }
-uint8_t  decode_nibble(instr_t instr) noexcept { return instr & 0x000F; }
+/*
+ * Every handler receives the instruction with operands already decoded (see
+ * ChipVM::decode_for below), program counter is already pointing to the next
+ * instruction at the moment of the call.
+ *
+ * Handlers are instantiated for every quirk profile (see quirks.hpp).
+ */
+template <class Quirks>
+struct ChipVM::Ops {
+    // Unknown instructions and SYS addr are ignored
+    static void nop(ChipVM &, const DecodedInstr &) {}
+
+    // CLS
+    static void cls(ChipVM &vm, const DecodedInstr &)
+    {
+        vm.display.clear(vm.plane_mask);
+        ++vm.frame_ver;
+    }
+
+    // SCD nibble (SUPER-CHIP)
+    static void scd(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.display.scroll_down(op.nibble, vm.plane_mask);
+        ++vm.frame_ver;
+    }
+
+    // SCU nibble (XO-CHIP)
+    static void scu(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.display.scroll_up(op.nibble, vm.plane_mask);
+        ++vm.frame_ver;
+    }
+
+    // SCR (SUPER-CHIP)
+    static void scr(ChipVM &vm, const DecodedInstr &)
+    {
+        vm.display.scroll_right(4, vm.plane_mask);
+        ++vm.frame_ver;
+    }
+
+    // SCL (SUPER-CHIP)
+    static void scl(ChipVM &vm, const DecodedInstr &)
+    {
+        vm.display.scroll_left(4, vm.plane_mask);
+        ++vm.frame_ver;
+    }
+
+    // EXIT (SUPER-CHIP)
+    static void exit(ChipVM &vm, const DecodedInstr &) { vm.working = false; }
+
+    // LOW (SUPER-CHIP)
+    static void low(ChipVM &vm, const DecodedInstr &)
+    {
+        vm.display.set_hires(false);
+        ++vm.frame_ver;
+    }
+
+    // HIGH (SUPER-CHIP)
+    static void high(ChipVM &vm, const DecodedInstr &)
+    {
+        vm.display.set_hires(true);
+        ++vm.frame_ver;
+    }
+
+    // RET
+    static void ret(ChipVM &vm, const DecodedInstr &)
+    {
+        // stack[0] is never used, see CALL
+        if (vm.sp == 0)
+            return vm.raise(Fault::stack_underflow);
+
+        vm.pc = vm.stack[vm.sp--];
+    }
+
+    // JP addr
+    static void jp(ChipVM &vm, const DecodedInstr &op) { vm.pc = op.addr; }
+
+    // CALL addr
+    static void call(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.sp + 1U >= vm.stack.size())
+            return vm.raise(Fault::stack_overflow);
+
+        vm.stack[++vm.sp] = vm.pc;
+        vm.pc             = op.addr;
+
+        GRANITE_STAT(
+            vm.exec_stats.stack_high_water =
+                std::max(vm.exec_stats.stack_high_water, vm.sp));
+    }
+
+    // SE Vx, byte
+    static void se_imm(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.regs[op.x] == op.imm)
+            skip(vm);
+    }
+
+    // SNE Vx, byte
+    static void sne_imm(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.regs[op.x] != op.imm)
+            skip(vm);
+    }
+
+    // SE Vx, Vy
+    static void se_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.regs[op.x] == vm.regs[op.y])
+            skip(vm);
+    }
+
+    // SAVE Vx - Vy (XO-CHIP), I isn't changed
+    static void save_range(ChipVM &vm, const DecodedInstr &op)
+    {
+        const std::size_t count = (op.x > op.y ? op.x - op.y : op.y - op.x) + 1;
+
+        if (vm.i_reg + count >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        // Registers are stored in reverse order, if x > y
+        for (std::size_t i = 0; i < count; ++i)
+            vm.ram[vm.i_reg + i] = vm.regs[op.x > op.y ? op.x - i : op.x + i];
+
+        vm.invalidate_code(vm.i_reg, count);
+    }
+
+    // LOAD Vx - Vy (XO-CHIP)
+    static void load_range(ChipVM &vm, const DecodedInstr &op)
+    {
+        const std::size_t count = (op.x > op.y ? op.x - op.y : op.y - op.x) + 1;
+
+        if (vm.i_reg + count >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        for (std::size_t i = 0; i < count; ++i)
+            vm.regs[op.x > op.y ? op.x - i : op.x + i] = vm.ram[vm.i_reg + i];
+    }
+
+    // LD Vx, byte
+    static void ld_imm(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] = op.imm;
+    }
+
+    // ADD Vx, byte
+    static void add_imm(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] += op.imm;
+    }
+
+    // LD Vx, Vy
+    static void ld_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] = vm.regs[op.y];
+    }
+
+    // OR Vx, Vy
+    static void or_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] |= vm.regs[op.y];
+
+        if constexpr (Quirks::logic_vf_reset)
+            vm.regs[0xF] = 0;
+    }
+
+    // AND Vx, Vy
+    static void and_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] &= vm.regs[op.y];
+
+        if constexpr (Quirks::logic_vf_reset)
+            vm.regs[0xF] = 0;
+    }
 
-void ChipVM::process_instruction(const instr_t instr)
+    // XOR Vx, Vy
+    static void xor_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] ^= vm.regs[op.y];
+
+        if constexpr (Quirks::logic_vf_reset)
+            vm.regs[0xF] = 0;
+    }
+
+    // ADD Vx, Vy
+    static void add_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        const uint16_t wide_sum = vm.regs[op.x] + vm.regs[op.y];
+
+        vm.regs[0xF] = wide_sum > UINT8_MAX ? 1 : 0;
+        vm.regs[op.x] += vm.regs[op.y];
+    }
+
+    // SUB Vx, Vy
+    static void sub_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[0xF] = vm.regs[op.x] > vm.regs[op.y] ? 1 : 0;
+        vm.regs[op.x] -= vm.regs[op.y];
+    }
+
+    // SHR Vx {, Vy}
+    static void shr(ChipVM &vm, const DecodedInstr &op)
+    {
+        const uint8_t src = vm.regs[Quirks::shift_vy ? op.y : op.x];
+
+        vm.regs[0xF]  = src & 1U;
+        vm.regs[op.x] = src >> 1;
+    }
+
+    // SUBN Vx, Vy
+    static void subn_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[0xF]  = vm.regs[op.y] > vm.regs[op.x] ? 1 : 0;
+        vm.regs[op.x] = vm.regs[op.y] - vm.regs[op.x];
+    }
+
+    // SHL Vx {, Vy}
+    static void shl(ChipVM &vm, const DecodedInstr &op)
+    {
+        constexpr unsigned msb_shift =
+            sizeof(typename decltype(vm.regs)::value_type) * CHAR_BIT - 1;
+
+        const uint8_t src = vm.regs[Quirks::shift_vy ? op.y : op.x];
+
+        vm.regs[0xF]  = src >> msb_shift;
+        vm.regs[op.x] = src << 1;
+    }
+
+    // SNE Vx, Vy
+    static void sne_reg(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.regs[op.x] != vm.regs[op.y])
+            skip(vm);
+    }
+
+    // LD I, addr
+    static void ld_i(ChipVM &vm, const DecodedInstr &op) { vm.i_reg = op.addr; }
+
+    // JP V0, addr (or JP Vx, addr)
+    static void jp_v0(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.pc = vm.regs[Quirks::jump_vx ? op.x : 0x0] + op.addr;
+    }
+
+    // RND Vx, byte
+    static void rnd(ChipVM &vm, const DecodedInstr &op)
+    {
+        // High bits of xorshift64* are the best ones
+        vm.regs[op.x] = (vm.random_gen() >> 56) & op.imm;
+    }
+
+    // DRW Vx, Vy, nibble
+    static void drw(ChipVM &vm, const DecodedInstr &op)
+    {
+        draw<C8Consts::SPRITE_WIDTH>(vm, op, op.nibble);
+    }
+
+    // DRW Vx, Vy, 0 (SUPER-CHIP 16x16 sprite)
+    static void drw_large(ChipVM &vm, const DecodedInstr &op)
+    {
+        draw<C8Consts::LARGE_SPRITE_WIDTH>(
+            vm, op, C8Consts::LARGE_SPRITE_WIDTH);
+    }
+
+    /*
+     * Sprite is drawn onto every selected plane, data of the next plane
+     * follows the previous one.
+     */
+    template <std::size_t width>
+    static void draw(ChipVM &vm, const DecodedInstr &op, std::size_t height)
+    {
+        /*
+         * Sprite row is one or two RAM cells (which is typically is 8 bit),
+         * that are drawn as a whole by Framebuffer::draw_row.
+         */
+        static_assert(
+            sizeof(typename decltype(vm.ram)::value_type) * CHAR_BIT
+                == C8Consts::SPRITE_WIDTH,
+            "Sprite width is not equal to RAM cell size: the rendering may "
+            "not work as expected. See source code comments for details.");
+
+        constexpr std::size_t row_size = width / C8Consts::SPRITE_WIDTH;
+
+        const std::size_t plane_size = height * row_size;
+        const std::size_t planes     = std::popcount(vm.plane_mask);
+
+        if (vm.i_reg + plane_size * planes >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        // Starting position wraps around, while the sprite itself is
+        // clipped (or wraps around as well with the XO-CHIP quirks)
+        const std::size_t screen_height = vm.display.height();
+        const std::size_t x = vm.regs[op.x] % vm.display.width(),
+                          y = vm.regs[op.y] % screen_height;
+        const std::size_t rows =
+            Quirks::wrap_sprites ? height
+                                 : std::min(height, screen_height - y);
+
+        bool        erased = false;
+        std::size_t addr   = vm.i_reg;
+
+        for (std::size_t plane = 0; plane < Framebuffer::planes; ++plane) {
+            if (!(vm.plane_mask & (1U << plane)))
+                continue;
+
+            for (std::size_t row = 0; row < rows; ++row) {
+                const uint8_t *cells = &vm.ram[addr + row * row_size];
+                const uint16_t sprite_row =
+                    row_size == 2 ? cells[0] << 8 | cells[1] : cells[0] << 8;
+
+                const std::size_t row_y =
+                    Quirks::wrap_sprites ? (y + row) % screen_height : y + row;
+
+                erased |= vm.display.draw_row(
+                    plane, x, row_y, sprite_row, Quirks::wrap_sprites);
+            }
+
+            addr += plane_size;
+        }
+
+        vm.regs[0xF] = erased ? 1 : 0;
+        ++vm.frame_ver;
+
+        GRANITE_STAT(vm.exec_stats.drw_collisions += erased);
+    }
+
+    // SKP Vx
+    static void skp(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.regs[op.x] > 0xF)
+            return vm.raise(Fault::invalid_key);
+
+        if (vm.keyboard_driver->is_pressed(vm.regs[op.x]))
+            skip(vm);
+    }
+
+    // SKNP Vx
+    static void sknp(ChipVM &vm, const DecodedInstr &op)
+    {
+        if (vm.regs[op.x] > 0xF)
+            return vm.raise(Fault::invalid_key);
+
+        if (!vm.keyboard_driver->is_pressed(vm.regs[op.x]))
+            skip(vm);
+    }
+
+    // LD Vx, DT
+    static void ld_vx_dt(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.regs[op.x] = vm.dt;
+    }
+
+    // LD Vx, K
+    static void ld_vx_k(ChipVM &vm, const DecodedInstr &op)
+    {
+        GRANITE_STAT(++vm.exec_stats.key_waits);
+
+        if (const auto key = vm.keyboard_driver->try_get_key())
+            vm.regs[op.x] = *key;
+        else
+            vm.pc -= sizeof(instr_t); // wait on the next cycle
+    }
+
+    // LD DT, Vx
+    static void ld_dt_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.dt = vm.regs[op.x];
+        GRANITE_STAT(++vm.exec_stats.timer_writes);
+    }
+
+    // LD ST, Vx
+    static void ld_st_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.st = vm.regs[op.x];
+        GRANITE_STAT(++vm.exec_stats.timer_writes);
+    }
+
+    // ADD I, Vx
+    static void add_i_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.i_reg += vm.regs[op.x];
+    }
+
+    // LD F, Vx
+    static void ld_f_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        // Fonts are stored at the beginning of RAM
+        vm.i_reg = vm.regs[op.x] * C8Consts::FONT_CHAR_SIZE;
+    }
+
+    // LD HF, Vx (SUPER-CHIP)
+    static void ld_hf_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.i_reg = C8Consts::LARGE_FONT_START
+                   + vm.regs[op.x] * C8Consts::LARGE_CHAR_SIZE;
+    }
+
+    // LD B, Vx
+    static void ld_b_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        // Hundreds, tens and ones
+        constexpr std::size_t digits = 3;
+
+        if (vm.i_reg + digits >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        const uint8_t n = vm.regs[op.x];
+
+        vm.ram[vm.i_reg]     = n / 100;
+        vm.ram[vm.i_reg + 1] = n / 10 % 10;
+        vm.ram[vm.i_reg + 2] = n % 10;
+
+        vm.invalidate_code(vm.i_reg, digits);
+    }
+
+    // LD [I], Vx
+    static void ld_mem_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        // + 1 is needed because specification says to save/load
+        // registers V0 THROUGH Vx (inclusively)
+        const uint8_t regs_count = op.x + 1;
+
+        // Assuming register size equals to RAM cell size
+        if (vm.i_reg + regs_count >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        std::copy_n(vm.regs.begin(), regs_count, vm.ram.begin() + vm.i_reg);
+
+        vm.invalidate_code(vm.i_reg, regs_count);
+        increment_i(vm, op);
+    }
+
+    // LD Vx, [I]
+    static void ld_vx_mem(ChipVM &vm, const DecodedInstr &op)
+    {
+        const uint8_t regs_count = op.x + 1;
+
+        // Assuming register size equals to RAM cell size
+        if (vm.i_reg + regs_count >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        std::copy_n(vm.ram.begin() + vm.i_reg, regs_count, vm.regs.begin());
+        increment_i(vm, op);
+    }
+
+    // LD R, Vx (SUPER-CHIP)
+    static void ld_r_vx(ChipVM &vm, const DecodedInstr &op)
+    {
+        std::copy_n(vm.regs.begin(), op.x + 1, vm.flags.begin());
+    }
+
+    // LD Vx, R (SUPER-CHIP)
+    static void ld_vx_r(ChipVM &vm, const DecodedInstr &op)
+    {
+        std::copy_n(vm.flags.begin(), op.x + 1, vm.regs.begin());
+    }
+
+    // LD I, long addr (XO-CHIP), the address is the next word
+    static void ld_i_long(ChipVM &vm, const DecodedInstr &)
+    {
+        if (vm.pc + sizeof(instr_t) > vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        vm.i_reg = vm.ram[vm.pc] << 8 | vm.ram[vm.pc + 1];
+        vm.inc_pc();
+    }
+
+    // PLANE n (XO-CHIP)
+    static void plane(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.plane_mask = op.x & Framebuffer::all_planes;
+    }
+
+    // AUDIO (XO-CHIP), loads the audio pattern from [I]
+    static void audio(ChipVM &vm, const DecodedInstr &)
+    {
+        if (vm.i_reg + vm.audio_pattern.size() >= vm.ram.size())
+            return vm.raise(Fault::segmentation_fault);
+
+        std::copy_n(
+            vm.ram.begin() + vm.i_reg,
+            vm.audio_pattern.size(),
+            vm.audio_pattern.begin());
+    }
+
+    // PITCH Vx (XO-CHIP)
+    static void pitch(ChipVM &vm, const DecodedInstr &op)
+    {
+        vm.pitch = vm.regs[op.x];
+    }
+
+    // Skips the next instruction, that is two words long if it's F000 nnnn
+    static void skip(ChipVM &vm)
+    {
+        if constexpr (Quirks::instruction_set == InstructionSet::xochip) {
+            if (vm.pc + sizeof(instr_t) <= vm.ram.size()
+                && vm.ram[vm.pc] == 0xF0 && vm.ram[vm.pc + 1] == 0x00)
+                vm.inc_pc();
+        }
+
+        vm.skip();
+    }
+
+    // After LD [I], Vx and LD Vx, [I]
+    static void increment_i(ChipVM &vm, const DecodedInstr &op)
+    {
+        if constexpr (Quirks::load_store_increment == IndexIncrement::by_x)
+            vm.i_reg += op.x;
+        else if constexpr (
+            Quirks::load_store_increment == IndexIncrement::by_x_plus_one)
+            vm.i_reg += op.x + 1;
+    }
+};
+
+void ChipVM::set_quirks(QuirkProfile profile) noexcept
 {
-    switch ((instr & 0xF000) >> 12) {
+    std::size_t ram_size = 0;
+
+    quirk_profile = profile;
+    decoder = visit_quirks(profile, [&ram_size](auto quirks) -> decoder_t {
+        ram_size = decltype(quirks)::ram_size;
+        return &decode_for<decltype(quirks)>;
+    });
+
+    ram.resize(ram_size);
+    decoded.resize(ram_size); // within the reserved capacity
+
+    invalidate_code(0, ram.size());
+}
+
+template <class Quirks>
+DecodedInstr ChipVM::decode_for(const instr_t instr) noexcept
+{
+    using Ops = ChipVM::Ops<Quirks>;
+
+    constexpr bool superchip =
+        Quirks::instruction_set != InstructionSet::chip8;
+    constexpr bool xochip = Quirks::instruction_set == InstructionSet::xochip;
+
+    DecodedInstr op;
+
+    op.handler = &Ops::nop;
+    op.instr   = instr;
+    op.addr    = decode_addr(instr);
+    op.x       = decode_reg_x(instr);
+    op.y       = decode_reg_y(instr);
+    op.imm     = decode_imm(instr);
+    op.nibble  = decode_nibble(instr);
+
+    switch (decode_opcode(instr)) {
         case 0x0:
-            switch (instr & 0x00FF) {
-                // CLS
+            switch (op.imm) {
                 case 0xE0:
-                    std::fill(display.begin(), display.end(), 0);
+                    op.handler = &Ops::cls;
                     break;
 
-                // RET
                 case 0xEE:
-                    try {
-                        pc = stack.at(sp--);
-                    }
-                    catch (const std::out_of_range &) {
-                        throw std::runtime_error("Stack underflow");
-                    }
+                    op.handler = &Ops::ret;
                     break;
             }
+
+            if constexpr (superchip) {
+                if (op.x != 0x0)
+                    break;
+
+                switch (op.imm) {
+                    case 0xFB:
+                        op.handler = &Ops::scr;
+                        break;
+
+                    case 0xFC:
+                        op.handler = &Ops::scl;
+                        break;
+
+                    case 0xFD:
+                        op.handler = &Ops::exit;
+                        break;
+
+                    case 0xFE:
+                        op.handler = &Ops::low;
+                        break;
+
+                    case 0xFF:
+                        op.handler = &Ops::high;
+                        break;
+                }
+
+                if (op.y == 0xC)
+                    op.handler = &Ops::scd;
+                else if (xochip && op.y == 0xD)
+                    op.handler = &Ops::scu;
+            }
             break;
 
-        // JP addr
         case 0x1:
-            pc = decode_addr(instr);
+            op.handler = &Ops::jp;
             break;
 
-        // CALL addr
         case 0x2:
-            try {
-                stack.at(++sp) = pc;
-                pc             = decode_addr(instr);
-            }
-            catch (const std::out_of_range &) {
-                throw std::runtime_error("Stack overflow");
-            }
+            op.handler = &Ops::call;
             break;
 
-        // SE Vx, byte
         case 0x3:
-        {
-            const uint8_t reg  = decode_reg_x(instr);
-            const uint8_t data = decode_imm(instr);
-
-            if (regs[reg] == data)
-                inc_pc();
+            op.handler = &Ops::se_imm;
             break;
-        }
 
-        // SNE Vx, byte
         case 0x4:
-        {
-            const uint8_t reg  = decode_reg_x(instr);
-            const uint8_t data = decode_imm(instr);
-
-            if (regs[reg] != data)
-                inc_pc();
+            op.handler = &Ops::sne_imm;
             break;
-        }
 
-        // SE Vx, Vy
         case 0x5:
-        {
-            const uint8_t reg_x = decode_reg_x(instr),
-                          reg_y = decode_reg_y(instr);
+            op.handler = &Ops::se_reg;
 
-            if (regs[reg_x] == regs[reg_y])
-                inc_pc();
+            if constexpr (xochip) {
+                if (op.nibble == 0x2)
+                    op.handler = &Ops::save_range;
+                else if (op.nibble == 0x3)
+                    op.handler = &Ops::load_range;
+            }
             break;
-        }
 
-        // LD Vx, byte
         case 0x6:
-        {
-            const uint8_t reg  = decode_reg_x(instr);
-            const uint8_t data = decode_imm(instr);
-
-            regs[reg] = data;
+            op.handler = &Ops::ld_imm;
             break;
-        }
 
-        // ADD Vx, byte
         case 0x7:
-        {
-            const uint8_t reg  = decode_reg_x(instr);
-            const uint8_t data = decode_imm(instr);
-
-            regs[reg] += data;
+            op.handler = &Ops::add_imm;
             break;
-        }
 
         // Registers operations
         case 0x8:
-        {
-            const uint8_t reg_x = decode_reg_x(instr),
-                          reg_y = decode_reg_y(instr);
-
-            switch (instr & 0x000F) {
-                // LD Vx, Vy
+            switch (op.nibble) {
                 case 0x0:
-                    regs[reg_x] = regs[reg_y];
+                    op.handler = &Ops::ld_reg;
                     break;
 
-                // OR Vx, Vy
                 case 0x1:
-                    regs[reg_x] |= regs[reg_y];
+                    op.handler = &Ops::or_reg;
                     break;
 
-                // AND Vx, Vy
                 case 0x2:
-                    regs[reg_x] &= regs[reg_y];
+                    op.handler = &Ops::and_reg;
                     break;
 
-                // XOR Vx, Vy
                 case 0x3:
-                    regs[reg_x] ^= regs[reg_y];
+                    op.handler = &Ops::xor_reg;
                     break;
 
-                // ADD Vx, Vy
                 case 0x4:
-                {
-                    const uint16_t wide_sum = regs[reg_x] + regs[reg_y];
-
-                    regs[0xF] = wide_sum > UINT8_MAX ? 1 : 0;
-                    regs[reg_x] += regs[reg_y];
+                    op.handler = &Ops::add_reg;
                     break;
-                }
 
-                // SUB Vx, Vy
                 case 0x5:
-                    regs[0xF] = regs[reg_x] > regs[reg_y] ? 1 : 0;
-                    regs[reg_x] -= regs[reg_y];
+                    op.handler = &Ops::sub_reg;
                     break;
 
-                // SHR
                 case 0x6:
-                    regs[0xF] = regs[reg_x] & 0xF;
-                    regs[reg_x] >>= 1;
+                    op.handler = &Ops::shr;
                     break;
 
-                // SUBN Vx, Vy
                 case 0x7:
-                    regs[0xF]   = regs[reg_y] > regs[reg_x] ? 1 : 0;
-                    regs[reg_x] = regs[reg_y] - regs[reg_x];
+                    op.handler = &Ops::subn_reg;
                     break;
 
-                // SHL Vx
                 case 0xE:
-                {
-                    constexpr uint8_t msb_mask =
-                        1U << sizeof(decltype(regs)::value_type) * CHAR_BIT - 1;
-
-                    regs[0xF] = regs[reg_x] & msb_mask;
-                    regs[reg_x] <<= 1;
+                    op.handler = &Ops::shl;
                     break;
-                }
             }
             break;
-        }
 
         case 0x9:
-            switch (instr & 0x000F) {
-                // SNE Vx, Vy
-                case 0x0:
-                {
-                    const uint8_t reg_x = decode_reg_x(instr),
-                                  reg_y = decode_reg_y(instr);
-
-                    if (regs[reg_x] != regs[reg_y])
-                        inc_pc();
-                    break;
-                }
-            }
+            if (op.nibble == 0x0)
+                op.handler = &Ops::sne_reg;
             break;
 
-        // LD I, addr
         case 0xA:
-            i_reg = decode_addr(instr);
+            op.handler = &Ops::ld_i;
             break;
 
-        // JP V0, addr
         case 0xB:
-            pc = regs[0x0] + decode_addr(instr);
+            op.handler = &Ops::jp_v0;
             break;
 
-        // RND Vx, byte
         case 0xC:
-        {
-            const uint8_t reg  = decode_reg_x(instr);
-            const uint8_t data = decode_imm(instr);
-
-            std::uniform_int_distribution<> dis(0, 255);
-
-            regs[reg] = dis(*random_gen) & data;
+            op.handler = &Ops::rnd;
             break;
-        }
 
-        // DRW Vx, Vy, nibble
         case 0xD:
-        {
-            const uint8_t reg_x = decode_reg_x(instr),
-                          reg_y = decode_reg_y(instr),
-                          count = decode_nibble(instr);
-
-            uint8_t x = regs[reg_x], y = regs[reg_y];
-
-            if (i_reg + count >= ram.size())
-                throw std::runtime_error(
-                    "Segmentation fault (sprite is out of range of RAM)");
-
-            /*
-             * As src (see below) denotes byte in RAM (which is typically is 8
-             * bit), bit shifting, that fetches pixel bit, will fail, because
-             * maximum value the byte can be shifted right is SPRITE_WIDTH - 1.
-             */
-            static_assert(
-                sizeof(decltype(ram)::value_type) * CHAR_BIT
-                    == C8Consts::SPRITE_WIDTH,
-                "Sprite width is not equal to RAM cell size: the rendering may "
-                "not work as expected. See source code comments for details.");
-
-            const auto src_beg = ram.begin() + i_reg;
-            auto       src     = src_beg;
-            auto       dst     = display.end();
-
-            /*
-             * src denotes bits, packed into byte
-             * dst denotes bool
-             *
-             * Range-safety of src is ensured by the if check at the
-             * beginning of instruction processing routine, safety of dst -
-             * by get_display_pixel method - it returnes off-the-end
-             * iterator if desired pixel is out of range.
-             */
-
-            regs[0xF] = 0;
-            while (src != src_beg + count) {
-                dst = get_display_pixel(x, y);
-
-                for (std::size_t i = C8Consts::SPRITE_WIDTH; i > 0; --i) {
-                    if (dst == display.end())
-                        break;
-
-                    // Fetch i - 1 bit from the right
-                    bool src_pixel = (*src >> (i - 1)) & 1U;
-
-                    // If pixel erased
-                    if (*dst && src_pixel)
-                        regs[0xF] = 1;
-
-                    // XOR pixel, according to the specification
-                    *dst = *dst ^ src_pixel;
-                    ++dst;
-                }
-
-                // If above loop was finished due to end of display
-                if (dst == display.end())
-                    break;
-
-                ++y;
-                ++src;
-            }
-
+            op.handler =
+                superchip && op.nibble == 0x0 ? &Ops::drw_large : &Ops::drw;
             break;
-        }
 
         case 0xE:
-        {
-            const uint8_t reg = decode_reg_x(instr);
-
-            switch (instr & 0x00FF) {
-                // SKP Vx
+            switch (op.imm) {
                 case 0x9E:
-                    if (keyboard_driver->is_pressed(regs[reg]))
-                        inc_pc();
+                    op.handler = &Ops::skp;
                     break;
 
-                // SKNP Vx
                 case 0xA1:
-                    if (!keyboard_driver->is_pressed(regs[reg]))
-                        inc_pc();
+                    op.handler = &Ops::sknp;
                     break;
             }
             break;
-        }
 
         case 0xF:
-        {
-            const uint8_t reg = decode_reg_x(instr);
-
-            switch (instr & 0x00FF) {
-                // LD Vx, DT
+            switch (op.imm) {
                 case 0x07:
-                    regs[reg] = dt.load();
+                    op.handler = &Ops::ld_vx_dt;
                     break;
 
-                // LD Vx, K
                 case 0x0A:
-                    regs[reg] = keyboard_driver->wait_for_key();
+                    op.handler = &Ops::ld_vx_k;
                     break;
 
-                // LD DT, Vx
                 case 0x15:
-                {
-                    bool thread_started = dt.load() > 0;
-
-                    dt.store(regs[reg]);
-
-                    if (!thread_started) {
-                        std::thread delay_timer_thread(
-                            [](std::atomic<uint8_t> &dt) {
-                                while (dt.load() > 0) {
-                                    --dt;
-
-                                    std::this_thread::sleep_for(milliseconds(
-                                        1000 / C8Consts::TIMERS_FREQUENCY));
-                                }
-                            },
-                            std::ref(dt));
-
-                        delay_timer_thread.detach();
-                    }
+                    op.handler = &Ops::ld_dt_vx;
                     break;
-                }
 
-                // LD ST, Vx
                 case 0x18:
-                {
-                    bool thread_started = st.load() > 0;
-
-                    st.store(regs[reg]);
-
-                    if (!thread_started) {
-                        std::thread sound_timer_thread(
-                            [](std::atomic<uint8_t> &        st,
-                               std::shared_ptr<ISoundDriver> sound_driver) {
-                                constexpr uint32_t frequency =
-                                    1000 / C8Consts::TIMERS_FREQUENCY;
-
-                                while (st.load() > 0) {
-                                    --st;
-                                    sound_driver->beep_for(frequency);
-
-                                    std::this_thread::sleep_for(
-                                        milliseconds(frequency));
-                                }
-                            },
-                            std::ref(st),
-                            sound_driver);
-
-                        sound_timer_thread.detach();
-                    }
+                    op.handler = &Ops::ld_st_vx;
                     break;
-                }
 
-                // ADD I, Vx
                 case 0x1E:
-                    i_reg += regs[reg];
+                    op.handler = &Ops::add_i_vx;
                     break;
 
-                // LD F, Vx
                 case 0x29:
-                    // Fonts are stored at the beginning of RAM
-                    i_reg = regs[reg] * C8Consts::FONT_CHAR_SIZE;
+                    op.handler = &Ops::ld_f_vx;
                     break;
 
-                // LD B, Vx
                 case 0x33:
-                {
-                    uint8_t              n = regs[reg];
-                    std::vector<uint8_t> bcd;
+                    op.handler = &Ops::ld_b_vx;
+                    break;
 
-                    while (n > 0) {
-                        bcd.push_back(n % 10);
-                        n /= 10;
-                    }
+                case 0x55:
+                    op.handler = &Ops::ld_mem_vx;
+                    break;
 
-                    // Hundreds, tens and ones
-                    constexpr decltype(bcd)::size_type digits = 3;
-                    while (bcd.size() < digits)
-                        bcd.push_back(0);
+                case 0x65:
+                    op.handler = &Ops::ld_vx_mem;
+                    break;
+            }
 
-                    if (i_reg + bcd.size() >= ram.size())
-                        throw std::runtime_error("Segmentation fault (too "
-                                                 "large BCD representation)");
+            if constexpr (superchip) {
+                switch (op.imm) {
+                    case 0x30:
+                        op.handler = &Ops::ld_hf_vx;
+                        break;
 
-                    std::reverse(bcd.begin(), bcd.end());
-                    std::copy(bcd.begin(), bcd.end(), ram.begin() + i_reg);
+                    case 0x75:
+                        op.handler = &Ops::ld_r_vx;
+                        break;
 
-                    break;
+                    case 0x85:
+                        op.handler = &Ops::ld_vx_r;
+                        break;
                 }
+            }
 
-                // LD [I], Vx
-                case 0x55:
-                {
-                    // + 1 is needed because specification says to save/load
-                    // registers V0 THROUGH Vx (inclusively)
-                    const uint8_t regs_count = reg + 1;
-
-                    // Assuming register size equals to RAM cell size
-                    if (i_reg + regs_count >= ram.size())
-                        throw std::runtime_error(
-                            "Segmentation fault (registers doesn't fit the "
-                            "RAM)");
-
-                    std::copy_n(regs.begin(), regs_count, ram.begin() + i_reg);
-                    break;
-                }
+            if constexpr (xochip) {
+                switch (op.imm) {
+                    case 0x00:
+                        if (op.x == 0x0)
+                            op.handler = &Ops::ld_i_long;
+                        break;
 
-                // LD Vx, [I]
-                case 0x65:
-                {
-                    const uint8_t regs_count = reg + 1;
+                    case 0x01:
+                        op.handler = &Ops::plane;
+                        break;
 
-                    // Assuming register size equals to RAM cell size
-                    if (i_reg + regs_count >= ram.size())
-                        throw std::runtime_error(
-                            "Segmentation fault (tried to load registers "
-                            "outside the RAM)");
+                    case 0x02:
+                        if (op.x == 0x0)
+                            op.handler = &Ops::audio;
+                        break;
 
-                    std::copy_n(ram.begin() + i_reg, regs_count, regs.begin());
-                    break;
+                    case 0x3A:
+                        op.handler = &Ops::pitch;
+                        break;
                 }
             }
             break;
-        }
     }
+
+    return op;
 }
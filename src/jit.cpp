@@ -0,0 +1,482 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "jit.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+// Compiled blocks bypass the statistics, so instrumented builds don't JIT
+#if defined(__x86_64__) && defined(__linux__) && !defined(GRANITE_STATS)
+#define GRANITE_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace {
+constexpr std::size_t arena_size       = 1 << 20;
+constexpr std::size_t code_page_size   = 0x40;
+constexpr std::size_t max_block_length = 64;
+
+// Longest instruction sequence, that Emitter produces for a single opcode
+constexpr std::size_t max_instr_code = 64;
+
+/*
+ * Register allocation of the translated code:
+ *   rbx - pointer to V0..VF
+ *   r12 - pointer to JitEngine (for fallback calls)
+ *   r13 - pointer to I register
+ */
+class Emitter {
+public:
+    Emitter() { code.reserve(max_block_length * max_instr_code); }
+
+    void bytes(std::initializer_list<uint8_t> data)
+    {
+        code.insert(code.end(), data);
+    }
+
+    template <typename T>
+    void imm(T value)
+    {
+        for (std::size_t i = 0; i < sizeof value; ++i)
+            code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+
+    void prologue()
+    {
+        bytes({0x53});             // push rbx
+        bytes({0x41, 0x54});       // push r12
+        bytes({0x41, 0x55});       // push r13
+        bytes({0x49, 0x89, 0xFC}); // mov r12, rdi
+        bytes({0x48, 0x89, 0xF3}); // mov rbx, rsi
+        bytes({0x49, 0x89, 0xD5}); // mov r13, rdx
+    }
+
+    void epilogue()
+    {
+        bytes({0x41, 0x5D}); // pop r13
+        bytes({0x41, 0x5C}); // pop r12
+        bytes({0x5B});       // pop rbx
+        bytes({0xC3});       // ret
+    }
+
+    // Flag of 8xy4, 8xy5 and 8xy7 is written before the result, exactly
+    // like the interpreter does it, so VF as an operand behaves the same
+    void reg_arith(
+        uint8_t flag_op,
+        uint8_t setcc,
+        uint8_t op,
+        uint8_t a,
+        uint8_t b,
+        uint8_t dst)
+    {
+        bytes({0x8A, 0x43, a});          // mov al, [rbx + a]
+        bytes({flag_op, 0x43, b});       // add/cmp al, [rbx + b]
+        bytes({0x0F, setcc, 0xC1});      // setc/seta cl
+        bytes({0x88, 0x4B, 0xF});        // mov [rbx + 0xF], cl
+        bytes({0x8A, 0x43, a});          // mov al, [rbx + a]
+        bytes({op, 0x43, b});            // add/sub al, [rbx + b]
+        bytes({0x88, 0x43, dst});        // mov [rbx + dst], al
+    }
+
+    void call_fallback(
+        uint16_t instr,
+        uint16_t addr,
+        uint16_t unretired,
+        uint64_t fn)
+    {
+        bytes({0x4C, 0x89, 0xE7}); // mov rdi, r12
+        bytes({0xBE});             // mov esi, imm32
+        imm<uint32_t>(instr);
+        bytes({0xBA}); // mov edx, imm32
+        imm<uint32_t>(addr);
+        bytes({0xB9}); // mov ecx, imm32
+        imm<uint32_t>(unretired);
+        bytes({0x48, 0xB8}); // mov rax, imm64
+        imm(fn);
+        bytes({0xFF, 0xD0}); // call rax
+        bytes({0x85, 0xC0}); // test eax, eax
+        bytes({0x74, 0x06}); // jz over the epilogue
+        epilogue();
+    }
+
+    std::vector<uint8_t> code;
+};
+
+/*
+ * Instructions, that can't be a part of a block: they jump, skip, wait for
+ * a key, write to RAM or are two words long.
+ */
+bool is_terminator(ChipVM::instr_t instr) noexcept
+{
+    switch ((instr & 0xF000) >> 12) {
+        case 0x0:
+            return (instr & 0x00FF) == 0xEE;
+
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        case 0x4:
+        case 0x5:
+        case 0x9:
+        case 0xB:
+        case 0xE:
+            return true;
+
+        case 0xF:
+            switch (instr & 0x00FF) {
+                case 0x00:
+                case 0x0A:
+                case 0x33:
+                case 0x55:
+                    return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
+} // namespace
+
+#ifdef GRANITE_JIT_X86_64
+
+JitEngine::JitEngine(ChipVM &vm_)
+    : vm(vm_),
+      // RAM is resized by ChipVM::set_quirks, so cover the largest one
+      blocks(C8Consts::XO_CHIP_RAM_SIZE),
+      code_pages(C8Consts::XO_CHIP_RAM_SIZE / code_page_size + 1)
+{
+    void *mem = mmap(
+        nullptr,
+        arena_size,
+        PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+
+    if (mem == MAP_FAILED)
+        throw std::runtime_error("Failed to allocate executable memory");
+
+    arena = static_cast<uint8_t *>(mem);
+
+    vm.code_write_callback = [this](uint16_t addr, std::size_t len) {
+        on_code_write(addr, len);
+    };
+}
+
+JitEngine::~JitEngine()
+{
+    vm.code_write_callback = nullptr;
+    munmap(arena, arena_size);
+}
+
+bool JitEngine::supported() noexcept { return true; }
+
+#else
+
+JitEngine::JitEngine(ChipVM &vm_) : vm(vm_)
+{
+    throw std::runtime_error("JIT is not supported on this platform");
+}
+
+JitEngine::~JitEngine() {}
+
+bool JitEngine::supported() noexcept { return false; }
+
+#endif
+
+uint64_t JitEngine::run(uint64_t count)
+{
+    uint64_t executed = 0;
+
+    // Compiled blocks don't report instructions to the tracer
+    if (vm.tracer) {
+        const uint64_t start = vm.cycles();
+        while (vm.working && vm.cycles() - start < count)
+            vm.cycle();
+
+        return vm.cycles() - start;
+    }
+
+    while (vm.working && executed < count) {
+        // Let the interpreter decide what to do at the end of RAM
+        if (vm.pc + sizeof(ChipVM::instr_t) >= vm.ram.size()) {
+            vm.cycle();
+            break;
+        }
+
+        // Blocks start at the jump targets, where the idle loops do too
+        if (const uint64_t skipped = vm.skip_idle(count - executed)) {
+            executed += skipped;
+            continue;
+        }
+
+        const uint16_t start = vm.pc;
+        const Block &  block = compile(start);
+
+        if (block.code) {
+            const uint32_t stopped =
+                block.code(this, vm.regs.data(), &vm.i_reg);
+
+            if (stopped) {
+                // VM has faulted in the middle of the block, account the
+                // instructions up to the faulted one, like cycle() does
+                executed += (stopped_at - start) / sizeof(ChipVM::instr_t) + 1;
+                vm.retire(1);
+                break;
+            }
+
+            vm.pc = block.end;
+            vm.retire(block.tail);
+            executed += block.length;
+        }
+
+        // Block may run up to the end of RAM, that has no terminator. The VM
+        // is halted there on the next iteration, only if there's budget left,
+        // like ChipVM::run does.
+        if (vm.pc + sizeof(ChipVM::instr_t) >= vm.ram.size())
+            continue;
+
+        // Terminator of the block
+        const uint64_t before = vm.cycles();
+        vm.cycle();
+        executed += vm.cycles() - before;
+    }
+
+    return executed;
+}
+
+void JitEngine::flush() noexcept
+{
+    std::fill(blocks.begin(), blocks.end(), Block{});
+    std::fill(code_pages.begin(), code_pages.end(), false);
+    arena_used = 0;
+}
+
+/*
+ * Timers are brought to the state the interpreter would have before
+ * executing the instruction, so timer reads are exact. The instruction
+ * itself is retired by the next fallback call or at the end of the block.
+ *
+ * Program counter is set as well, so it points to the right place if the
+ * VM faults. Handlers report faults by stopping the VM, not by throwing.
+ */
+uint32_t JitEngine::fallback(
+    JitEngine *engine,
+    uint16_t   instr,
+    uint16_t   addr,
+    uint16_t   unretired) noexcept
+{
+    ChipVM &vm = engine->vm;
+
+    vm.retire(unretired);
+
+    vm.pc = addr + sizeof(ChipVM::instr_t);
+    vm.process_instruction(instr);
+
+    if (vm.working)
+        return 0;
+
+    engine->stopped_at = addr;
+    return 1;
+}
+
+const JitEngine::Block &JitEngine::compile(uint16_t addr)
+{
+    if (blocks[addr].compiled)
+        return blocks[addr];
+
+    const auto fallback_fn = reinterpret_cast<uint64_t>(&JitEngine::fallback);
+
+    const bool logic_vf_reset = visit_quirks(vm.quirks(), [](auto quirks) {
+        return decltype(quirks)::logic_vf_reset;
+    });
+
+    Emitter  emitter;
+    uint16_t pc     = addr;
+    uint16_t length = 0;
+
+    // Natively executed instructions, that are not yet passed to
+    // ChipVM::retire
+    uint16_t unretired = 0;
+
+    emitter.prologue();
+
+    while (length < max_block_length
+           && pc + sizeof(ChipVM::instr_t) < vm.ram.size()) {
+        const ChipVM::instr_t instr = vm.ram[pc] << 8 | vm.ram[pc + 1];
+
+        if (is_terminator(instr))
+            break;
+
+        const uint8_t x   = (instr & 0x0F00) >> 8;
+        const uint8_t y   = (instr & 0x00F0) >> 4;
+        const uint8_t kk  = instr & 0x00FF;
+        const auto    nnn = static_cast<uint16_t>(instr & 0x0FFF);
+
+        switch ((instr & 0xF000) >> 12) {
+            // LD Vx, byte
+            case 0x6:
+                emitter.bytes({0xC6, 0x43, x, kk});
+                break;
+
+            // ADD Vx, byte
+            case 0x7:
+                emitter.bytes({0x80, 0x43, x, kk});
+                break;
+
+            case 0x8:
+                switch (instr & 0x000F) {
+                    // LD Vx, Vy
+                    case 0x0:
+                        emitter.bytes({0x8A, 0x43, y});
+                        emitter.bytes({0x88, 0x43, x});
+                        break;
+
+                    // OR, AND, XOR Vx, Vy (VF = 0 with the CHIP-8 quirks)
+                    case 0x1:
+                    case 0x2:
+                    case 0x3:
+                    {
+                        constexpr uint8_t opcodes[] = {0x08, 0x20, 0x30};
+
+                        emitter.bytes({0x8A, 0x43, y});
+                        emitter.bytes({opcodes[(instr & 0xF) - 1], 0x43, x});
+
+                        if (logic_vf_reset)
+                            emitter.bytes({0xC6, 0x43, 0xF, 0x00});
+                        break;
+                    }
+
+                    // ADD Vx, Vy (VF = carry)
+                    case 0x4:
+                        emitter.reg_arith(0x02, 0x92, 0x02, x, y, x);
+                        break;
+
+                    // SUB Vx, Vy (VF = Vx > Vy)
+                    case 0x5:
+                        emitter.reg_arith(0x3A, 0x97, 0x2A, x, y, x);
+                        break;
+
+                    // SUBN Vx, Vy (VF = Vy > Vx)
+                    case 0x7:
+                        emitter.reg_arith(0x3A, 0x97, 0x2A, y, x, x);
+                        break;
+
+                    default:
+                        emitter.call_fallback(
+                            instr, pc, unretired, fallback_fn);
+                        unretired = 0;
+                        break;
+                }
+                break;
+
+            // LD I, addr
+            case 0xA:
+                emitter.bytes({0x66, 0x41, 0xC7, 0x45, 0x00});
+                emitter.imm(nnn);
+                break;
+
+            case 0xF:
+                switch (kk) {
+                    // ADD I, Vx
+                    case 0x1E:
+                        emitter.bytes({0x0F, 0xB6, 0x43, x});
+                        emitter.bytes({0x66, 0x41, 0x01, 0x45, 0x00});
+                        break;
+
+                    // LD F, Vx
+                    case 0x29:
+                        emitter.bytes({0x0F, 0xB6, 0x43, x});
+                        emitter.bytes({0x8D, 0x04, 0x80});
+                        emitter.bytes({0x66, 0x41, 0x89, 0x45, 0x00});
+                        break;
+
+                    default:
+                        emitter.call_fallback(
+                            instr, pc, unretired, fallback_fn);
+                        unretired = 0;
+                        break;
+                }
+                break;
+
+            // CLS, SYS addr (0x0), RND (0xC), DRW (0xD)
+            default:
+                emitter.call_fallback(instr, pc, unretired, fallback_fn);
+                unretired = 0;
+                break;
+        }
+
+        pc += sizeof(ChipVM::instr_t);
+        ++length;
+        ++unretired;
+    }
+
+    emitter.bytes({0x31, 0xC0}); // xor eax, eax
+    emitter.epilogue();
+
+    Block block;
+    block.end      = pc;
+    block.length   = length;
+    block.tail     = unretired;
+    block.compiled = true;
+
+    if (length > 0) {
+        static_assert(max_block_length * max_instr_code < arena_size);
+
+        if (arena_used + emitter.code.size() > arena_size)
+            flush();
+
+        std::memcpy(
+            arena + arena_used, emitter.code.data(), emitter.code.size());
+        block.code = reinterpret_cast<block_fn>(arena + arena_used);
+        arena_used += emitter.code.size();
+
+        for (std::size_t page = addr / code_page_size;
+             page <= (pc + 1) / code_page_size;
+             ++page)
+            code_pages[page] = true;
+    }
+
+    return blocks[addr] = block;
+}
+
+/*
+ * Self-modifying code is rare enough to simply throw away everything,
+ * once a page with translated code gets written.
+ */
+void JitEngine::on_code_write(uint16_t addr, std::size_t len) noexcept
+{
+    const std::size_t last = std::min(addr + len, vm.ram.size()) - 1;
+
+    for (std::size_t page = addr / code_page_size;
+         page <= last / code_page_size;
+         ++page) {
+        if (code_pages[page]) {
+            flush();
+            return;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef JIT_HPP_
+#define JIT_HPP_
+
+#include "chipvm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Optional execution engine, that translates straight-line runs of CHIP-8
+ * instructions into native x86-64 code. Block ends right before the first
+ * instruction, that changes control flow, blocks or writes to RAM - such
+ * instruction is executed by the interpreter (ChipVM::cycle).
+ *
+ * Only Linux on x86-64 is supported (and not builds with GRANITE_STATS),
+ * check JitEngine::supported() before creating one.
+ */
+class JitEngine {
+public:
+    explicit JitEngine(ChipVM &vm_);
+    ~JitEngine();
+
+    JitEngine(const JitEngine &) = delete;
+    JitEngine &operator=(const JitEngine &) = delete;
+
+    static bool supported() noexcept;
+
+    /**
+     * Executes at least `count` instructions (the last block is always
+     * finished), unless VM stops working earlier.
+     *
+     * \return Number of executed instructions
+     */
+    uint64_t run(uint64_t count);
+
+    /**
+     * Drops all the translated blocks.
+     */
+    void flush() noexcept;
+
+private:
+    using block_fn = uint32_t (*)(JitEngine *, uint8_t *, uint16_t *);
+
+    struct Block {
+        block_fn code     = nullptr; // nullptr if block is empty
+        uint16_t end      = 0;       // address of the terminating instruction
+        uint16_t length   = 0;       // number of translated instructions
+        uint16_t tail     = 0;       // ones after the last fallback call
+        bool     compiled = false;
+    };
+
+    // Called from the translated code for the instructions it can't handle
+    static uint32_t fallback(
+        JitEngine *engine,
+        uint16_t   instr,
+        uint16_t   addr,
+        uint16_t   unretired) noexcept;
+
+    const Block &compile(uint16_t addr);
+    void         on_code_write(uint16_t addr, std::size_t len) noexcept;
+
+    ChipVM &vm;
+
+    std::vector<Block> blocks;     // indexed by the block start address
+    std::vector<bool>  code_pages; // pages, that have translated code
+
+    uint8_t *   arena      = nullptr; // executable memory
+    std::size_t arena_used = 0;
+
+    // Set by fallback, if it has stopped the block
+    uint16_t stopped_at = 0;
+};
+
+#endif /* !JIT_HPP_ */
@@ -0,0 +1,122 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_jit_test - differential test of JitEngine: every test program
+ * runs under every quirk profile by the JIT, by ChipVM::cycle and by
+ * ChipVM::run, with a few random seeds and pressed keys. Save states must
+ * be the same after every slice of instructions. Skipped (exit code 77)
+ * where the JIT isn't supported.
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "jit.hpp"
+#include "quirks.hpp"
+#include "test_programs.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+
+namespace {
+using TestPrograms::Program;
+
+constexpr std::size_t vms_per_program = 4;
+
+// Instructions executed between the comparisons, the JIT may go further
+// to finish the block
+constexpr uint64_t slices[]{1, 10, 100, 1000, 4000};
+
+std::unique_ptr<ChipVM>
+make_vm(QuirkProfile quirks, const Program &program, std::size_t index)
+{
+    auto keyboard = std::make_shared<HeadlessImpl::BitmapKeyboardDriver>();
+    keyboard->set_keys(index % 3 ? 1U << index % 16 : 0);
+
+    auto vm = std::make_unique<ChipVM>(
+        std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+        keyboard,
+        std::make_shared<HeadlessImpl::NullSoundDriver>());
+
+    vm->set_quirks(quirks);
+    vm->timer_mode      = TimerMode::virtual_time;
+    vm->cycles_per_tick = 7;
+    vm->seed_random(index + 1);
+
+    TestPrograms::load(*vm, program);
+
+    return vm;
+}
+
+/** \return false if the JIT has diverged from the interpreter */
+bool check(QuirkProfile quirks, const Program &program, std::size_t index)
+{
+    auto jit_vm   = make_vm(quirks, program, index);
+    auto cycle_vm = make_vm(quirks, program, index);
+    auto run_vm   = make_vm(quirks, program, index);
+
+    JitEngine jit(*jit_vm);
+
+    uint64_t executed = 0;
+    for (const uint64_t slice : slices) {
+        // JIT finishes the last block, but may stop earlier, e.g. at the end
+        // of the RAM, that the interpreter only notices with budget left
+        const uint64_t count = std::max(jit.run(slice), slice);
+        executed += count;
+
+        for (uint64_t n = 0; n < count && cycle_vm->working; ++n)
+            cycle_vm->cycle();
+
+        run_vm->run(count);
+
+        const auto state = jit_vm->save_state();
+        if (state == cycle_vm->save_state() && state == run_vm->save_state())
+            continue;
+
+        std::cerr << quirk_profile_name(quirks) << ' ' << program.name
+                  << ": VM " << index << " differs after " << executed
+                  << " instructions\n";
+        return false;
+    }
+
+    return true;
+}
+} // namespace
+
+int main()
+{
+    if (!JitEngine::supported()) {
+        std::cerr << "JIT is not supported on this platform\n";
+        return 77;
+    }
+
+    bool passed = true;
+
+    const auto programs = TestPrograms::programs(64);
+
+    for (const QuirkProfile quirks : TestPrograms::profiles)
+        for (const Program &program : programs)
+            for (std::size_t index = 0; index < vms_per_program; ++index)
+                passed &= check(quirks, program, index);
+
+    return passed ? 0 : 1;
+}
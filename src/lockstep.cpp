@@ -0,0 +1,510 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "lockstep.hpp"
+#include "quirks.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+template <class Quirks, std::size_t Width>
+struct LockstepEngine::Kernel {
+    using instr_t = ChipVM::instr_t;
+    using mask_t  = std::array<uint8_t, Width>; // 1 for the executing lanes
+
+    // Added to the program counters of the lanes, that are done
+    static constexpr uint32_t idle = 1U << 16;
+
+    static uint64_t run(Group &group, uint32_t count)
+    {
+        for (std::size_t lane = 0; lane < Width; ++lane) {
+            ChipVM *vm = group.vms[lane];
+
+            group.left[lane]      = vm && vm->working ? count : 0;
+            group.unretired[lane] = 0;
+
+            // Lanes past the last VM read the RAM of the first one
+            group.ram[lane] = (vm ? vm : group.vms[0])->ram.data();
+            if (vm)
+                load_lane(group, lane);
+        }
+
+        uint64_t executed = 0;
+        while (step(group, executed))
+            continue;
+
+        for (std::size_t lane = 0; lane < Width; ++lane) {
+            ChipVM *vm = group.vms[lane];
+
+            if (vm) {
+                store_lane(group, lane);
+                vm->retire(group.unretired[lane]);
+            }
+        }
+
+        return executed;
+    }
+
+    /**
+     * Executes an instruction on some of the lanes, adding their number to
+     * `executed`.
+     *
+     * \return false if all the lanes are done
+     */
+    static bool step(Group &group, uint64_t &executed)
+    {
+        // Reconverge on the lowest address, lanes, that are ahead, wait
+        uint32_t target = idle;
+        for (std::size_t lane = 0; lane < Width; ++lane) {
+            const uint32_t done = group.left[lane] == 0;
+            target              = std::min(target, group.pc[lane] | done << 16);
+        }
+
+        if (target >= idle)
+            return false;
+
+        mask_t mask;
+        for (std::size_t lane = 0; lane < Width; ++lane)
+            mask[lane] = (group.left[lane] != 0) & (group.pc[lane] == target);
+
+        // Same as ChipVM::cycle, running off the RAM stops the VM
+        if (target + sizeof(instr_t) >= Quirks::ram_size) {
+            for (std::size_t lane = 0; lane < Width; ++lane) {
+                if (mask[lane]) {
+                    group.vms[lane]->working = false;
+                    group.left[lane]         = 0;
+                }
+            }
+
+            return true;
+        }
+
+        const std::size_t first =
+            std::find(mask.cbegin(), mask.cend(), 1) - mask.cbegin();
+        const instr_t instr = fetch(group, first, target);
+
+        // Lanes, that have modified their code, go their own way
+        mask_t  diverged;
+        uint8_t any_diverged = 0;
+        for (std::size_t lane = 0; lane < Width; ++lane) {
+            diverged[lane] = mask[lane] & (fetch(group, lane, target) != instr);
+            any_diverged |= diverged[lane];
+        }
+
+        if (any_diverged) [[unlikely]] {
+            for_each_lane(diverged, [&](std::size_t lane) {
+                mask[lane] = 0;
+                ++executed;
+
+                advance_lane(group, lane);
+                fallback(group, lane, fetch(group, lane, target));
+            });
+        }
+
+        for (std::size_t lane = 0; lane < Width; ++lane) {
+            group.pc[lane] += mask[lane] * sizeof(instr_t);
+            group.left[lane] -= mask[lane];
+            group.unretired[lane] += mask[lane];
+            executed += mask[lane];
+        }
+
+        execute(group, mask, instr);
+
+        return true;
+    }
+
+    static void execute(Group &group, const mask_t &mask, instr_t instr)
+    {
+        // Keeps the per-opcode counters of the VMs exact
+        if constexpr (stats_enabled)
+            return fallback(group, mask, instr);
+
+        const uint16_t addr   = instr & 0xFFF;
+        const uint8_t  x      = (instr & 0x0F00) >> 8;
+        const uint8_t  y      = (instr & 0x00F0) >> 4;
+        const uint8_t  imm    = instr & 0x00FF;
+        const uint8_t  nibble = instr & 0x000F;
+
+        uint8_t *const vx = group.regs[x].data();
+        uint8_t *const vy = group.regs[y].data();
+        uint8_t *const vf = group.regs[0xF].data();
+
+        switch (instr >> 12) {
+            // JP addr
+            case 0x1:
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    group.pc[lane] = mask[lane] ? addr : group.pc[lane];
+                return;
+
+            // SE Vx, byte
+            case 0x3: {
+                mask_t taken;
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    taken[lane] = mask[lane] & (vx[lane] == imm);
+
+                return skip(group, taken);
+            }
+
+            // SNE Vx, byte
+            case 0x4: {
+                mask_t taken;
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    taken[lane] = mask[lane] & (vx[lane] != imm);
+
+                return skip(group, taken);
+            }
+
+            // SE Vx, Vy (5xy2 and 5xy3 are XO-CHIP memory instructions)
+            case 0x5: {
+                if (Quirks::instruction_set == InstructionSet::xochip
+                    && (nibble == 0x2 || nibble == 0x3))
+                    break;
+
+                mask_t taken;
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    taken[lane] = mask[lane] & (vx[lane] == vy[lane]);
+
+                return skip(group, taken);
+            }
+
+            // LD Vx, byte
+            case 0x6:
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    vx[lane] = mask[lane] ? imm : vx[lane];
+                return;
+
+            // ADD Vx, byte
+            case 0x7:
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    vx[lane] += mask[lane] ? imm : 0;
+                return;
+
+            // Registers operations, in the same order as the handlers do
+            // them, as x or y may be 0xF
+            case 0x8:
+                return alu(mask, vx, vy, vf, nibble);
+
+            // SNE Vx, Vy
+            case 0x9: {
+                if (nibble != 0x0)
+                    return; // ignored, as every unknown instruction
+
+                mask_t taken;
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    taken[lane] = mask[lane] & (vx[lane] != vy[lane]);
+
+                return skip(group, taken);
+            }
+
+            // LD I, addr
+            case 0xA:
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    group.i_reg[lane] = mask[lane] ? addr : group.i_reg[lane];
+                return;
+
+            // JP V0, addr (or JP Vx, addr)
+            case 0xB: {
+                const uint8_t *base =
+                    group.regs[Quirks::jump_vx ? x : 0].data();
+
+                for (std::size_t lane = 0; lane < Width; ++lane)
+                    group.pc[lane] =
+                        mask[lane] ? base[lane] + addr : group.pc[lane];
+                return;
+            }
+
+            case 0xF:
+                switch (imm) {
+                    // ADD I, Vx
+                    case 0x1E:
+                        for (std::size_t lane = 0; lane < Width; ++lane)
+                            group.i_reg[lane] += mask[lane] ? vx[lane] : 0;
+                        return;
+
+                    // LD F, Vx
+                    case 0x29:
+                        for (std::size_t lane = 0; lane < Width; ++lane)
+                            group.i_reg[lane] =
+                                mask[lane]
+                                    ? vx[lane] * C8Consts::FONT_CHAR_SIZE
+                                    : group.i_reg[lane];
+                        return;
+                }
+                break;
+        }
+
+        fallback(group, mask, instr);
+    }
+
+    /**
+     * Flag register is written before the result, as by the handlers, so if
+     * Vx or Vy is VF, the result is computed from the new flag.
+     */
+    static void alu(
+        const mask_t & mask,
+        uint8_t *      vx,
+        const uint8_t *vy,
+        uint8_t *      vf,
+        uint8_t        nibble)
+    {
+        const bool x_is_vf = vx == vf;
+        const bool y_is_vf = vy == vf;
+
+        switch (nibble) {
+            case 0x0:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x = vx[lane], y = vy[lane];
+
+                    vx[lane] = mask[lane] ? y : x;
+                }
+                break;
+
+            case 0x1:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x = vx[lane], y = vy[lane];
+
+                    vx[lane] = mask[lane] ? x | y : x;
+                    reset_vf(mask, vf, lane);
+                }
+                break;
+
+            case 0x2:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x = vx[lane], y = vy[lane];
+
+                    vx[lane] = mask[lane] ? x & y : x;
+                    reset_vf(mask, vf, lane);
+                }
+                break;
+
+            case 0x3:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x = vx[lane], y = vy[lane];
+
+                    vx[lane] = mask[lane] ? x ^ y : x;
+                    reset_vf(mask, vf, lane);
+                }
+                break;
+
+            case 0x4:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x    = vx[lane], y = vy[lane];
+                    const uint8_t flag = x + y > UINT8_MAX ? 1 : 0;
+                    const uint8_t sum  =
+                        (x_is_vf ? flag : x) + (y_is_vf ? flag : y);
+
+                    vf[lane] = mask[lane] ? flag : vf[lane];
+                    vx[lane] = mask[lane] ? sum : vx[lane];
+                }
+                break;
+
+            case 0x5:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x    = vx[lane], y = vy[lane];
+                    const uint8_t flag = x > y ? 1 : 0;
+                    const uint8_t diff =
+                        (x_is_vf ? flag : x) - (y_is_vf ? flag : y);
+
+                    vf[lane] = mask[lane] ? flag : vf[lane];
+                    vx[lane] = mask[lane] ? diff : vx[lane];
+                }
+                break;
+
+            case 0x6:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t src = Quirks::shift_vy ? vy[lane] : vx[lane];
+
+                    vf[lane] = mask[lane] ? src & 1U : vf[lane];
+                    vx[lane] = mask[lane] ? src >> 1 : vx[lane];
+                }
+                break;
+
+            case 0x7:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t x    = vx[lane], y = vy[lane];
+                    const uint8_t flag = y > x ? 1 : 0;
+                    const uint8_t diff =
+                        (y_is_vf ? flag : y) - (x_is_vf ? flag : x);
+
+                    vf[lane] = mask[lane] ? flag : vf[lane];
+                    vx[lane] = mask[lane] ? diff : vx[lane];
+                }
+                break;
+
+            case 0xE:
+                for (std::size_t lane = 0; lane < Width; ++lane) {
+                    const uint8_t src = Quirks::shift_vy ? vy[lane] : vx[lane];
+
+                    vf[lane] = mask[lane] ? src >> 7 : vf[lane];
+                    vx[lane] = mask[lane] ? src << 1 : vx[lane];
+                }
+                break;
+        }
+    }
+
+    // 8xy1 - 8xy3 reset VF after the operation under some profiles
+    static void reset_vf(const mask_t &mask, uint8_t *vf, std::size_t lane)
+    {
+        if constexpr (Quirks::logic_vf_reset) {
+            const uint8_t flag = vf[lane];
+            vf[lane]           = mask[lane] ? 0 : flag;
+        }
+    }
+
+    template <class Func>
+    static void for_each_lane(const mask_t &mask, Func &&func)
+    {
+        for (std::size_t lane = 0; lane < Width; ++lane)
+            if (mask[lane])
+                func(lane);
+    }
+
+    // Same as ChipVM::Ops::skip, the program counters are already advanced
+    static void skip(Group &group, const mask_t &taken)
+    {
+        if constexpr (Quirks::instruction_set == InstructionSet::xochip) {
+            // F000 nnnn is two words long
+            for (std::size_t lane = 0; lane < Width; ++lane) {
+                const uint16_t next = group.pc[lane];
+
+                if (taken[lane] && next + sizeof(instr_t) <= Quirks::ram_size
+                    && fetch(group, lane, next) == 0xF000)
+                    group.pc[lane] += sizeof(instr_t);
+            }
+        }
+
+        for (std::size_t lane = 0; lane < Width; ++lane)
+            group.pc[lane] += taken[lane] * sizeof(instr_t);
+    }
+
+    static void fallback(Group &group, const mask_t &mask, instr_t instr)
+    {
+        for_each_lane(mask, [&](std::size_t lane) {
+            fallback(group, lane, instr);
+        });
+    }
+
+    /**
+     * Executes the instruction by the VM of the lane, its program counter
+     * must be already advanced.
+     */
+    static void fallback(Group &group, std::size_t lane, instr_t instr)
+    {
+        ChipVM &vm = *group.vms[lane];
+
+        // Instruction may read the timers, so retire all the previous ones
+        store_lane(group, lane);
+        vm.retire(group.unretired[lane] - 1);
+        group.unretired[lane] = 1;
+
+        vm.process_instruction(instr);
+
+        load_lane(group, lane);
+        if (!vm.working)
+            group.left[lane] = 0;
+    }
+
+    static void advance_lane(Group &group, std::size_t lane)
+    {
+        group.pc[lane] += sizeof(instr_t);
+        --group.left[lane];
+        ++group.unretired[lane];
+    }
+
+    static instr_t fetch(const Group &group, std::size_t lane, uint16_t addr)
+    {
+        const uint8_t *ram = group.ram[lane];
+        return ram[addr] << 8 | ram[addr + 1];
+    }
+
+    static void load_lane(Group &group, std::size_t lane)
+    {
+        const ChipVM &vm = *group.vms[lane];
+
+        for (std::size_t reg = 0; reg < vm.regs.size(); ++reg)
+            group.regs[reg][lane] = vm.regs[reg];
+
+        group.pc[lane]    = vm.pc;
+        group.i_reg[lane] = vm.i_reg;
+    }
+
+    static void store_lane(const Group &group, std::size_t lane)
+    {
+        ChipVM &vm = *group.vms[lane];
+
+        for (std::size_t reg = 0; reg < vm.regs.size(); ++reg)
+            vm.regs[reg] = group.regs[reg][lane];
+
+        vm.pc    = group.pc[lane];
+        vm.i_reg = group.i_reg[lane];
+    }
+};
+
+LockstepEngine::LockstepEngine(std::vector<ChipVM *> vms_, std::size_t width)
+    : vms(std::move(vms_))
+{
+    if (width != 8 && width != 16 && width != 32)
+        throw std::invalid_argument("Group width must be 8, 16 or 32");
+
+    const QuirkProfile profile =
+        vms.empty() ? default_quirk_profile : vms.front()->quirks();
+
+    if (std::any_of(vms.cbegin(), vms.cend(), [profile](const ChipVM *vm) {
+            return vm->quirks() != profile;
+        }))
+        throw std::invalid_argument("VMs must have the same quirk profile");
+
+    runner = visit_quirks(profile, [width](auto quirks) -> runner_t {
+        using Quirks = decltype(quirks);
+
+        switch (width) {
+            case 8:
+                return &Kernel<Quirks, 8>::run;
+            case 16:
+                return &Kernel<Quirks, 16>::run;
+            default:
+                return &Kernel<Quirks, 32>::run;
+        }
+    });
+
+    groups.resize((vms.size() + width - 1) / width);
+    for (std::size_t i = 0; i < vms.size(); ++i)
+        groups[i / width].vms[i % width] = vms[i];
+}
+
+uint64_t LockstepEngine::run(uint64_t count)
+{
+    uint64_t executed = 0;
+
+    // Lanes count instructions in 32 bits
+    for (uint64_t chunk = 0; count > 0; count -= chunk) {
+        chunk = std::min<uint64_t>(count, UINT32_MAX);
+
+        for (Group &group : groups)
+            executed += runner(group, chunk);
+    }
+
+    return executed;
+}
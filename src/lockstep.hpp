@@ -0,0 +1,98 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOCKSTEP_HPP_
+#define LOCKSTEP_HPP_
+
+#include "chipvm.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Execution engine for lots of VMs running the same ROM. Registers, program
+ * counters and index registers of a group of 8, 16 or 32 VMs are stored
+ * structure-of-arrays, and the group executes in lockstep: every step picks
+ * the lowest program counter of the group, decodes the instruction there
+ * once and executes it for all the VMs at that address (the rest are
+ * masked out). Register and jump instructions are executed by loops over
+ * the lanes, that the compiler vectorizes; everything else (drawing, memory,
+ * timers, keys, the stack) is passed to ChipVM::process_instruction of the
+ * VM, so results are exactly the same as of ChipVM::cycle.
+ *
+ * Tracer isn't supported, builds with GRANITE_STATS pass every instruction
+ * to the VM to keep the statistics exact.
+ */
+class LockstepEngine {
+public:
+    static constexpr std::size_t max_width = 32;
+
+    /**
+     * VMs must outlive the engine and have the same quirk profile.
+     *
+     * \param width Number of VMs in a group: 8, 16 or 32
+     *
+     * Throws std::invalid_argument if the width isn't supported or the
+     * profiles differ.
+     */
+    explicit LockstepEngine(
+        std::vector<ChipVM *> vms_,
+        std::size_t           width = 16);
+
+    /**
+     * Executes `count` instructions on every VM, unless it stops working
+     * earlier. State of the VMs is loaded before and stored back after, so
+     * they may be modified between the calls.
+     *
+     * \return Number of executed instructions of all the VMs
+     */
+    uint64_t run(uint64_t count);
+
+    std::size_t size() const noexcept { return vms.size(); }
+
+private:
+    struct Group {
+        // Register r of the lane l is regs[r][l]
+        alignas(64)
+            std::array<std::array<uint8_t, max_width>, C8Consts::REGS_COUNT>
+                regs{};
+
+        alignas(64) std::array<uint16_t, max_width> pc{};
+        alignas(64) std::array<uint16_t, max_width> i_reg{};
+
+        std::array<uint32_t, max_width> left{};      // instructions to execute
+        std::array<uint32_t, max_width> unretired{}; // see ChipVM::retire
+
+        std::array<ChipVM *, max_width>        vms{}; // nullptr past the last
+        std::array<const uint8_t *, max_width> ram{}; // RAM of every VM
+    };
+
+    // Instructions of the group, see lockstep.cpp
+    template <class Quirks, std::size_t Width>
+    struct Kernel;
+
+    using runner_t = uint64_t (*)(Group &group, uint32_t count);
+
+    std::vector<ChipVM *> vms;
+    std::vector<Group>    groups;
+    runner_t              runner = nullptr;
+};
+
+#endif /* !LOCKSTEP_HPP_ */
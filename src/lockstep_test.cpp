@@ -0,0 +1,125 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_lockstep_test - differential test of LockstepEngine: every test
+ * program runs on groups of 8, 16 and 32 VMs (the last group is partial)
+ * under every quirk profile, and the same VMs run by ChipVM::cycle and by
+ * ChipVM::run. VMs have their own random seeds and pressed keys, so they
+ * diverge inside of the groups. Save states of all three must be the same
+ * after every slice of instructions.
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "lockstep.hpp"
+#include "quirks.hpp"
+#include "test_programs.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+using TestPrograms::Program;
+
+constexpr std::size_t widths[]{8, 16, 32};
+
+// Instructions executed between the comparisons
+constexpr uint64_t slices[]{1, 10, 100, 1000, 4000};
+
+std::unique_ptr<ChipVM>
+make_vm(QuirkProfile quirks, const Program &program, std::size_t index)
+{
+    auto keyboard = std::make_shared<HeadlessImpl::BitmapKeyboardDriver>();
+    keyboard->set_keys(index % 3 ? 1U << index % 16 : 0);
+
+    auto vm = std::make_unique<ChipVM>(
+        std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+        keyboard,
+        std::make_shared<HeadlessImpl::NullSoundDriver>());
+
+    vm->set_quirks(quirks);
+    vm->timer_mode      = TimerMode::virtual_time;
+    vm->cycles_per_tick = 7;
+    vm->seed_random(index + 1);
+
+    TestPrograms::load(*vm, program);
+
+    return vm;
+}
+
+/** \return false if any of the VMs has diverged from the interpreter */
+bool check(QuirkProfile quirks, std::size_t width, const Program &program)
+{
+    const std::size_t count = width * 2 + 3;
+
+    std::vector<std::unique_ptr<ChipVM>> lockstep_vms, cycle_vms, run_vms;
+    std::vector<ChipVM *>                ptrs;
+    for (std::size_t i = 0; i < count; ++i) {
+        ptrs.push_back(
+            lockstep_vms.emplace_back(make_vm(quirks, program, i)).get());
+        cycle_vms.push_back(make_vm(quirks, program, i));
+        run_vms.push_back(make_vm(quirks, program, i));
+    }
+
+    LockstepEngine engine(ptrs, width);
+
+    uint64_t executed = 0;
+    for (const uint64_t slice : slices) {
+        engine.run(slice);
+        executed += slice;
+
+        for (std::size_t i = 0; i < count; ++i) {
+            for (uint64_t n = 0; n < slice && cycle_vms[i]->working; ++n)
+                cycle_vms[i]->cycle();
+
+            run_vms[i]->run(slice);
+
+            const auto state = lockstep_vms[i]->save_state();
+            if (state == cycle_vms[i]->save_state()
+                && state == run_vms[i]->save_state())
+                continue;
+
+            std::cerr << quirk_profile_name(quirks) << " x" << width << ' '
+                      << program.name << ": VM " << i << " differs after "
+                      << executed << " instructions\n";
+            return false;
+        }
+    }
+
+    return true;
+}
+} // namespace
+
+int main()
+{
+    bool passed = true;
+
+    const auto programs = TestPrograms::programs(16);
+
+    for (const QuirkProfile quirks : TestPrograms::profiles)
+        for (const std::size_t width : widths)
+            for (const Program &program : programs)
+                passed &= check(quirks, width, program);
+
+    return passed ? 0 : 1;
+}
@@ -17,68 +17,115 @@
  */
 
 #include "chipvm.hpp"
+#include "mapped_file.hpp"
+#include "quirks.hpp"
+#include "scheduler.hpp"
 #include "sfml_impl.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
-#include "windows_impl.hpp"
 
 #ifdef _WIN32
+#include "windows_impl.hpp"
+
 #include <Windows.h>
 #include <cstdlib> // for __argc and __argv
+#else
+#include "headless_impl.hpp"
 #endif
 
+#include <algorithm>
 #include <atomic>
-#include <cerrno>
-#include <chrono>
-#include <cstring>
-#include <fstream>
 #include <functional>
-#include <iterator>
 #include <memory>
+#include <optional>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <thread>
 
-bool load_image(std::shared_ptr<ChipVM> vm, const std::string &file_name)
+namespace {
+struct Options {
+    SchedulerOptions scheduler;
+    std::string      trace_file;
+    QuirkProfile     quirks = default_quirk_profile;
+    std::string      image;
+};
+
+const char usage[] =
+    "Usage: granite [--ipf N] [--speed MULTIPLIER] [--turbo] "
+    "[--rewind SECONDS] [--trace FILE] [--quirks PROFILE] <image>\n\n"
+    "  --ipf N               instructions per 60 Hz frame\n"
+    "  --speed MULTIPLIER    fast-forward (or slow down) emulation\n"
+    "  --turbo               run as fast as possible\n"
+    "  --rewind SECONDS      keep history, Backspace steps back a second\n"
+    "  --trace FILE          record executed instructions, see granite-trace\n"
+    "  --quirks PROFILE      chip8, chip48, superchip, xochip or legacy "
+    "(default)";
+
+std::optional<Options> parse_args(int argc, char *argv[])
 {
+    Options options;
+
     try {
-        using ram_cell_t       = decltype(vm->ram)::value_type;
-        using input_iterator_t = std::istreambuf_iterator<char>;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg       = argv[i];
+            const bool        has_value = i + 1 < argc;
+
+            if (arg == "--ipf" && has_value)
+                options.scheduler.instructions_per_frame =
+                    std::stoul(argv[++i]);
+            else if (arg == "--speed" && has_value)
+                options.scheduler.speed = std::stod(argv[++i]);
+            else if (arg == "--turbo")
+                options.scheduler.turbo = true;
+            else if (arg == "--rewind" && has_value)
+                options.scheduler.rewind_seconds = std::stoul(argv[++i]);
+            else if (arg == "--trace" && has_value)
+                options.trace_file = argv[++i];
+            else if (arg == "--quirks" && has_value) {
+                const auto quirks = parse_quirk_profile(argv[++i]);
+                if (!quirks)
+                    return std::nullopt;
+
+                options.quirks = *quirks;
+            }
+            else if (arg.starts_with("--") || !options.image.empty())
+                return std::nullopt;
+            else
+                options.image = arg;
+        }
+    }
+    catch (const std::logic_error &) {
+        return std::nullopt;
+    }
 
-        std::ifstream image_file;
+    if (options.image.empty())
+        return std::nullopt;
 
-        image_file.exceptions(
-            image_file.exceptions() | std::ios::failbit | std::ios::badbit);
-        image_file.open(file_name, std::ios::binary | std::ios::ate);
+    return options;
+}
+} // namespace
 
-        // Check whether the image size is less than RAM size
-        const auto               ram_size = vm->ram.size() * sizeof(ram_cell_t);
-        const decltype(ram_size) image_size = image_file.tellg();
+bool load_image(std::shared_ptr<ChipVM> vm, const std::string &file_name)
+{
+    try {
+        const MappedFile image(file_name);
 
-        if (image_size > ram_size - C8Consts::USER_SPACE) {
+        // Check whether the image size is less than RAM size
+        if (image.size() > vm->ram.size() - C8Consts::USER_SPACE) {
             print_msg("Image doesn't fit the RAM.", MessageType::error);
             return false;
         }
 
-        image_file.seekg(0, std::ios::beg);
-
-        // I am a paranoid lol
-        static_assert(
-            sizeof(input_iterator_t::value_type) == sizeof(ram_cell_t),
-            "istreambuf_iterator type have to be the same length as VM's RAM "
-            "cell (this should have never happened, basically it's an "
-            "assertion that "
-            "sizeof(char) == sizeof(uint_8)).");
-
         // Finally load image to RAM, starting from USER_SPACE
         std::copy(
-            input_iterator_t(image_file),
-            input_iterator_t(),
+            image.data(),
+            image.data() + image.size(),
             vm->ram.begin() + C8Consts::USER_SPACE);
     }
-    catch (const std::ios_base::failure &) {
+    catch (const std::runtime_error &ex) {
         print_msg(
-            std::string("Failed to read image file:\n\t")
-                + std::strerror(errno),
+            std::string("Failed to read image file:\n\t") + ex.what(),
             MessageType::error);
         return false;
     }
@@ -88,11 +135,9 @@ bool load_image(std::shared_ptr<ChipVM> vm, const std::string &file_name)
 
 int main(int argc, char *argv[])
 {
-
-    if (argc < 2) {
-        print_msg(
-            "Please specify chip8 image as an argument.",
-            MessageType::error);
+    const auto options = parse_args(argc, argv);
+    if (!options) {
+        print_msg(usage, MessageType::error);
         return 0;
     }
 
@@ -104,23 +149,56 @@ int main(int argc, char *argv[])
         &SFMLImpl::KeyboardDriver::press_callback,
         keyboard_driver,
         std::placeholders::_1));
+    display_driver->subscribe_for_key_release(std::bind(
+        &SFMLImpl::KeyboardDriver::release_callback,
+        keyboard_driver,
+        std::placeholders::_1));
 
+#ifdef _WIN32
     auto sound_driver = std::make_shared<WindowsImpl::SoundDriver>();
+#else
+    // There's no sound driver for other platforms yet
+    auto sound_driver = std::make_shared<HeadlessImpl::NullSoundDriver>();
+#endif
 
     // Initialize virtual machine
     auto vm =
         std::make_shared<ChipVM>(display_driver, keyboard_driver, sound_driver);
+    vm->set_quirks(options->quirks);
 
-    if (!load_image(vm, argv[1]))
+    if (!load_image(vm, options->image))
         return 1;
 
+    std::unique_ptr<Tracer> tracer;
+    if (!options->trace_file.empty()) {
+        try {
+            tracer     = std::make_unique<Tracer>(options->trace_file);
+            vm->tracer = tracer.get();
+        }
+        catch (const std::runtime_error &ex) {
+            print_msg(ex.what(), MessageType::error);
+            return 1;
+        }
+    }
+
+    Scheduler scheduler(*vm, options->scheduler);
+
+    display_driver->subscribe_for_key_press(
+        [&scheduler](sf::Keyboard::Key key) {
+            if (key == sf::Keyboard::BackSpace)
+                scheduler.rewind(C8Consts::REFRESH_RATE);
+        });
+
     // Work on the VM
-    std::thread vm_thread([vm] {
+    std::thread vm_thread([vm, &scheduler] {
         try {
-            while (vm->working) {
-                vm->cycle();
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            }
+            scheduler.run();
+
+            if (vm->fault != Fault::none)
+                print_msg(
+                    std::string("Runtime error:\n\t")
+                        + fault_message(vm->fault),
+                    MessageType::error);
 
             vm->display_driver->shutdown();
         }
@@ -135,11 +213,19 @@ int main(int argc, char *argv[])
 
     // Shutdown the VM and other drivers if display driver finishes its work
     vm->working = false;
+    scheduler.stop();
     vm->keyboard_driver->shutdown();
     vm->sound_driver->shutdown();
 
     vm_thread.join();
 
+    if constexpr (stats_enabled) {
+        std::ostringstream stats;
+        vm->stats().dump(stats);
+
+        print_msg(stats.str(), MessageType::info);
+    }
+
     return 0;
 }
 
@@ -0,0 +1,123 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &file_name)
+{
+    const HANDLE file = CreateFileA(
+        file_name.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open " + file_name);
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to get the size of " + file_name);
+    }
+
+    length = static_cast<std::size_t>(file_size.QuadPart);
+
+    // Empty files can't be mapped
+    if (length > 0) {
+        mapping =
+            CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+            bytes = static_cast<const uint8_t *>(
+                MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+
+    CloseHandle(file);
+
+    if (length > 0 && !bytes) {
+        if (mapping)
+            CloseHandle(mapping);
+        throw std::runtime_error("Failed to map " + file_name);
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes)
+        UnmapViewOfFile(bytes);
+    if (mapping)
+        CloseHandle(mapping);
+}
+#else
+MappedFile::MappedFile(const std::string &file_name)
+{
+    const int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error(
+            "Failed to open " + file_name + ": " + std::strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int error = errno;
+        close(fd);
+        throw std::runtime_error(
+            "Failed to stat " + file_name + ": " + std::strerror(error));
+    }
+
+    length = static_cast<std::size_t>(st.st_size);
+
+    // Empty files can't be mapped
+    void *addr = MAP_FAILED;
+    if (length > 0)
+        addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    const int error = errno;
+    close(fd); // the mapping stays valid
+
+    if (length > 0 && addr == MAP_FAILED)
+        throw std::runtime_error(
+            "Failed to map " + file_name + ": " + std::strerror(error));
+
+    if (length > 0)
+        bytes = static_cast<const uint8_t *>(addr);
+}
+
+MappedFile::~MappedFile()
+{
+    if (bytes)
+        munmap(const_cast<uint8_t *>(bytes), length);
+}
+#endif
@@ -0,0 +1,56 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+/*
+ * Whole file mapped read-only into memory, so it's read by the page cache
+ * without copying it through streams.
+ */
+class MappedFile {
+public:
+    /**
+     * Throws std::runtime_error if the file can't be opened or mapped.
+     */
+    explicit MappedFile(const std::string &file_name);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const noexcept { return bytes; }
+    std::size_t    size() const noexcept { return length; }
+
+    std::span<const uint8_t> span() const noexcept { return {bytes, length}; }
+
+private:
+    const uint8_t *bytes  = nullptr; // nullptr if the file is empty
+    std::size_t    length = 0;
+
+#ifdef _WIN32
+    void *mapping = nullptr; // HANDLE of the file mapping
+#endif
+};
+
+#endif /* !MAPPED_FILE_HPP_ */
@@ -0,0 +1,199 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite-pack - packs lots of ROMs into a single indexed file (see
+ * RomPack), or lists the ROMs of a pack as CSV:
+ *
+ *   granite-pack [--quirks PROFILE] [--ipf N] --output PACK
+ *                <ROM or directory>...
+ *   granite-pack --list PACK
+ *
+ * --quirks and --ipf are stored with the ROMs, that follow them, so packs
+ * of mixed variants are built in one go. The same ROM is stored once.
+ */
+
+#include "mapped_file.hpp"
+#include "quirks.hpp"
+#include "rom_pack.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+struct Input {
+    std::string  path;
+    QuirkProfile quirks;
+    uint32_t     ipf;
+};
+
+struct Options {
+    std::string        output;
+    std::string        list;
+    std::vector<Input> inputs;
+};
+
+void print_usage()
+{
+    std::cerr << "Usage: granite-pack [--quirks PROFILE] [--ipf N]"
+                 " --output PACK <ROM or directory>...\n"
+                 "       granite-pack --list PACK\n";
+}
+
+std::optional<Options> parse_args(int argc, char *argv[])
+{
+    Options      options;
+    QuirkProfile quirks = default_quirk_profile;
+    uint32_t     ipf    = 0;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg       = argv[i];
+            const bool        has_value = i + 1 < argc;
+
+            if (arg == "--output" && has_value)
+                options.output = argv[++i];
+            else if (arg == "--list" && has_value)
+                options.list = argv[++i];
+            else if (arg == "--ipf" && has_value)
+                ipf = std::stoul(argv[++i]);
+            else if (arg == "--quirks" && has_value) {
+                const auto profile = parse_quirk_profile(argv[++i]);
+                if (!profile)
+                    return std::nullopt;
+
+                quirks = *profile;
+            }
+            else if (arg.starts_with("--"))
+                return std::nullopt;
+            else
+                options.inputs.push_back({arg, quirks, ipf});
+        }
+    }
+    catch (const std::logic_error &) {
+        return std::nullopt;
+    }
+
+    // Either packing or listing
+    if (options.output.empty() == options.list.empty()
+        || options.inputs.empty() != options.output.empty())
+        return std::nullopt;
+
+    return options;
+}
+
+void add_rom(
+    RomPackBuilder &   builder,
+    const fs::path &   path,
+    const std::string &name,
+    const Input &      input)
+{
+    const MappedFile file(path.string());
+
+    const std::vector<uint8_t> image(file.data(), file.data() + file.size());
+
+    if (!builder.add(name, image, input.quirks, input.ipf))
+        std::cerr << "Skipping " << path.string() << ", same as another ROM\n";
+}
+
+void pack(const Options &options)
+{
+    RomPackBuilder builder;
+
+    for (const Input &input : options.inputs) {
+        if (!fs::is_directory(input.path)) {
+            add_rom(
+                builder,
+                input.path,
+                fs::path(input.path).filename().generic_string(),
+                input);
+            continue;
+        }
+
+        std::vector<fs::path> paths;
+        for (const auto &entry : fs::recursive_directory_iterator(input.path))
+            if (entry.is_regular_file())
+                paths.push_back(entry.path());
+
+        std::sort(paths.begin(), paths.end());
+
+        // Named by the path inside the directory
+        for (const fs::path &path : paths)
+            add_rom(
+                builder,
+                path,
+                path.lexically_relative(input.path).generic_string(),
+                input);
+    }
+
+    builder.write(options.output);
+
+    std::cerr << "Packed " << builder.size() << " ROMs into " << options.output
+              << '\n';
+}
+
+void list(const std::string &file_name)
+{
+    const RomPack pack(file_name);
+
+    std::cout << "hash,name,size,quirks,ipf\n";
+
+    for (std::size_t i = 0; i < pack.size(); ++i) {
+        const RomInfo rom = pack.rom(i);
+
+        std::cout << std::hex << std::setfill('0') << std::setw(16) << rom.hash
+                  << std::dec << ",\"" << rom.name << "\"," << rom.image.size()
+                  << ',' << quirk_profile_name(rom.quirks) << ',' << rom.ipf
+                  << '\n';
+    }
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const auto options = parse_args(argc, argv);
+    if (!options) {
+        print_usage();
+        return 1;
+    }
+
+    try {
+        if (options->list.empty())
+            pack(*options);
+        else
+            list(options->list);
+    }
+    catch (const std::exception &ex) {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QUIRKS_HPP_
+#define QUIRKS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <optional>
+#include <string_view>
+
+// RAM size depends on the profile, see ram_size of the policies below
+namespace C8Consts {
+enum {
+    RAM_SIZE         = 0x1000,
+    XO_CHIP_RAM_SIZE = 0x10000
+};
+}
+
+// Values are stored in save states and ROM packs, new profiles go last
+enum class QuirkProfile : uint8_t { chip8, chip48, superchip, xochip, legacy };
+
+// Instructions, that are decoded on top of the CHIP-8 ones
+enum class InstructionSet : uint8_t {
+    chip8,
+    superchip, // high resolution, scrolling, 16x16 sprites, RPL flags
+    xochip     // SUPER-CHIP ones, bitplanes, audio and 64 KB of RAM
+};
+
+// How much Fx55 and Fx65 advance the I register
+enum class IndexIncrement : uint8_t { none, by_x, by_x_plus_one };
+
+/*
+ * Behavior of the instructions, that CHIP-8 variants disagree on. Every
+ * profile is a policy type and the instruction handlers are instantiated
+ * for each of them, so quirks cost no runtime checks.
+ */
+namespace Quirks {
+
+// Original COSMAC VIP interpreter
+struct Chip8 {
+    static constexpr QuirkProfile profile = QuirkProfile::chip8;
+
+    // 8xy6 and 8xyE shift Vy into Vx (otherwise Vx is shifted in place)
+    static constexpr bool shift_vy = true;
+
+    static constexpr IndexIncrement load_store_increment =
+        IndexIncrement::by_x_plus_one;
+
+    // Bnnn jumps to xnn + Vx (otherwise to nnn + V0)
+    static constexpr bool jump_vx = false;
+
+    // 8xy1, 8xy2 and 8xy3 reset VF
+    static constexpr bool logic_vf_reset = true;
+
+    // Sprites going beyond the edges wrap around (otherwise are clipped)
+    static constexpr bool wrap_sprites = false;
+
+    static constexpr InstructionSet instruction_set = InstructionSet::chip8;
+    static constexpr std::size_t    ram_size        = C8Consts::RAM_SIZE;
+};
+
+// HP-48 interpreter
+struct Chip48 {
+    static constexpr QuirkProfile profile = QuirkProfile::chip48;
+
+    static constexpr bool shift_vy = false;
+
+    static constexpr IndexIncrement load_store_increment =
+        IndexIncrement::by_x;
+
+    static constexpr bool jump_vx        = true;
+    static constexpr bool logic_vf_reset = false;
+    static constexpr bool wrap_sprites   = false;
+
+    static constexpr InstructionSet instruction_set = InstructionSet::chip8;
+    static constexpr std::size_t    ram_size        = C8Consts::RAM_SIZE;
+};
+
+// SUPER-CHIP 1.1, as most of the modern games expect it
+struct SuperChip {
+    static constexpr QuirkProfile profile = QuirkProfile::superchip;
+
+    static constexpr bool shift_vy = false;
+
+    static constexpr IndexIncrement load_store_increment =
+        IndexIncrement::none;
+
+    static constexpr bool jump_vx        = true;
+    static constexpr bool logic_vf_reset = false;
+    static constexpr bool wrap_sprites   = false;
+
+    static constexpr InstructionSet instruction_set =
+        InstructionSet::superchip;
+    static constexpr std::size_t ram_size = C8Consts::RAM_SIZE;
+};
+
+// XO-CHIP, as implemented by Octo
+struct XoChip {
+    static constexpr QuirkProfile profile = QuirkProfile::xochip;
+
+    static constexpr bool shift_vy = true;
+
+    static constexpr IndexIncrement load_store_increment =
+        IndexIncrement::by_x_plus_one;
+
+    static constexpr bool jump_vx        = false;
+    static constexpr bool logic_vf_reset = false;
+    static constexpr bool wrap_sprites   = true;
+
+    static constexpr InstructionSet instruction_set = InstructionSet::xochip;
+    static constexpr std::size_t    ram_size = C8Consts::XO_CHIP_RAM_SIZE;
+};
+
+// What granite did before the profiles, the default one, so ROMs run the
+// same as they used to: SUPER-CHIP, but Bnnn jumps to nnn + V0
+struct Legacy {
+    static constexpr QuirkProfile profile = QuirkProfile::legacy;
+
+    static constexpr bool shift_vy = false;
+
+    static constexpr IndexIncrement load_store_increment =
+        IndexIncrement::none;
+
+    static constexpr bool jump_vx        = false;
+    static constexpr bool logic_vf_reset = false;
+    static constexpr bool wrap_sprites   = false;
+
+    static constexpr InstructionSet instruction_set =
+        InstructionSet::superchip;
+    static constexpr std::size_t ram_size = C8Consts::RAM_SIZE;
+};
+
+} // namespace Quirks
+
+constexpr QuirkProfile default_quirk_profile = QuirkProfile::legacy;
+
+/**
+ * Calls func with the policy type object of the profile.
+ */
+template <class Func>
+decltype(auto) visit_quirks(QuirkProfile profile, Func &&func)
+{
+    switch (profile) {
+        case QuirkProfile::chip8:
+            return func(Quirks::Chip8{});
+        case QuirkProfile::chip48:
+            return func(Quirks::Chip48{});
+        case QuirkProfile::xochip:
+            return func(Quirks::XoChip{});
+        case QuirkProfile::legacy:
+            return func(Quirks::Legacy{});
+        case QuirkProfile::superchip:
+            break;
+    }
+
+    return func(Quirks::SuperChip{});
+}
+
+inline InstructionSet instruction_set(QuirkProfile profile) noexcept
+{
+    return visit_quirks(
+        profile, [](auto quirks) { return decltype(quirks)::instruction_set; });
+}
+
+inline const char *quirk_profile_name(QuirkProfile profile) noexcept
+{
+    switch (profile) {
+        case QuirkProfile::chip8:
+            return "chip8";
+        case QuirkProfile::chip48:
+            return "chip48";
+        case QuirkProfile::superchip:
+            return "superchip";
+        case QuirkProfile::xochip:
+            return "xochip";
+        case QuirkProfile::legacy:
+            return "legacy";
+    }
+
+    return "unknown";
+}
+
+inline std::optional<QuirkProfile>
+parse_quirk_profile(std::string_view name) noexcept
+{
+    for (const auto profile :
+         {QuirkProfile::chip8,
+          QuirkProfile::chip48,
+          QuirkProfile::superchip,
+          QuirkProfile::xochip,
+          QuirkProfile::legacy}) {
+        if (name == quirk_profile_name(profile))
+            return profile;
+    }
+
+    return std::nullopt;
+}
+
+#endif /* !QUIRKS_HPP_ */
@@ -0,0 +1,213 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "rewind.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace {
+// Shorter runs of unchanged bytes are kept inside the literal to save on
+// the headers
+constexpr std::size_t min_unchanged_run = 4;
+
+void put_varint(std::vector<uint8_t> &dst, std::size_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        dst.push_back(static_cast<uint8_t>(value | 0x80));
+
+    dst.push_back(static_cast<uint8_t>(value));
+}
+
+std::size_t get_varint(const uint8_t *&src)
+{
+    std::size_t value = 0;
+
+    for (unsigned shift = 0;; shift += 7) {
+        const uint8_t byte = *src++;
+        value |= static_cast<std::size_t>(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+/*
+ * Delta is a sequence of (skip, length, length XORed bytes) records, skip
+ * and length being varints. Skip counts from the end of the previous
+ * record. Both states must be of the same size.
+ */
+void encode_delta(
+    const std::vector<uint8_t> &base,
+    const std::vector<uint8_t> &state,
+    std::vector<uint8_t> &      delta)
+{
+    delta.clear();
+
+    const std::size_t size = state.size();
+
+    for (std::size_t pos = 0, prev_end = 0;;) {
+        while (pos < size && state[pos] == base[pos])
+            ++pos;
+
+        if (pos == size)
+            break;
+
+        std::size_t end = pos, unchanged = 0;
+        for (; end < size && unchanged < min_unchanged_run; ++end)
+            unchanged = state[end] == base[end] ? unchanged + 1 : 0;
+        end -= unchanged;
+
+        put_varint(delta, pos - prev_end);
+        put_varint(delta, end - pos);
+        for (; pos < end; ++pos)
+            delta.push_back(state[pos] ^ base[pos]);
+
+        prev_end = end;
+    }
+}
+
+void apply_delta(std::vector<uint8_t> &state, const std::vector<uint8_t> &delta)
+{
+    const uint8_t *src = delta.data();
+    const uint8_t *end = src + delta.size();
+
+    for (std::size_t pos = 0; src < end;) {
+        pos += get_varint(src);
+
+        for (std::size_t len = get_varint(src); len > 0; --len)
+            state[pos++] ^= *src++;
+    }
+}
+} // namespace
+
+RewindBuffer::RewindBuffer(
+    std::size_t capacity_,
+    std::size_t keyframe_interval_)
+    : capacity(std::max<std::size_t>(1, capacity_)),
+      keyframe_interval(std::max<std::size_t>(1, keyframe_interval_))
+{}
+
+void RewindBuffer::push(const ChipVM &vm)
+{
+    vm.save_state(scratch);
+
+    // Size of the state depends on the RAM size of the quirk profile, so
+    // switching the profile starts a new keyframe too
+    if (segments.empty()
+        || segments.back().deltas.size() + 1 >= keyframe_interval
+        || segments.back().keyframe.size() != scratch.size()) {
+        segments.push_back({take_buffer(spare_keyframes), {}});
+        std::swap(segments.back().keyframe, scratch);
+    }
+    else {
+        Segment &segment = segments.back();
+
+        segment.deltas.push_back(take_buffer(spare_deltas));
+        encode_delta(segment.keyframe, scratch, segment.deltas.back());
+    }
+
+    ++frames_count;
+
+    while (frames_count > capacity && segments.size() > 1)
+        drop_oldest();
+}
+
+std::size_t RewindBuffer::rewind(ChipVM &vm, std::size_t frames)
+{
+    std::size_t dropped = 0;
+
+    for (; dropped < frames && frames_count > 1; ++dropped, --frames_count) {
+        Segment &segment = segments.back();
+
+        if (segment.deltas.empty()) {
+            recycle(spare_keyframes, std::move(segment.keyframe));
+            segments.pop_back();
+        }
+        else {
+            recycle(spare_deltas, std::move(segment.deltas.back()));
+            segment.deltas.pop_back();
+        }
+    }
+
+    if (segments.empty())
+        return 0;
+
+    const Segment &segment = segments.back();
+
+    scratch = segment.keyframe;
+    if (!segment.deltas.empty())
+        apply_delta(scratch, segment.deltas.back());
+
+    vm.load_state(scratch.data(), scratch.size());
+
+    return dropped;
+}
+
+void RewindBuffer::clear()
+{
+    while (!segments.empty())
+        drop_oldest();
+}
+
+std::size_t RewindBuffer::memory_usage() const noexcept
+{
+    std::size_t usage = 0;
+
+    for (const Segment &segment : segments) {
+        usage += segment.keyframe.capacity();
+
+        for (const buffer_t &delta : segment.deltas)
+            usage += delta.capacity();
+    }
+
+    return usage;
+}
+
+void RewindBuffer::drop_oldest()
+{
+    Segment &segment = segments.front();
+    frames_count -= 1 + segment.deltas.size();
+
+    recycle(spare_keyframes, std::move(segment.keyframe));
+    for (buffer_t &delta : segment.deltas)
+        recycle(spare_deltas, std::move(delta));
+
+    segments.pop_front();
+}
+
+RewindBuffer::buffer_t RewindBuffer::take_buffer(std::vector<buffer_t> &pool)
+{
+    if (pool.empty())
+        return {};
+
+    buffer_t buffer = std::move(pool.back());
+    pool.pop_back();
+
+    return buffer;
+}
+
+void RewindBuffer::recycle(std::vector<buffer_t> &pool, buffer_t &&buffer)
+{
+    buffer.clear();
+    pool.push_back(std::move(buffer));
+}
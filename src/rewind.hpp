@@ -0,0 +1,96 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef REWIND_HPP_
+#define REWIND_HPP_
+
+#include "chipvm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/*
+ * Bounded history of the VM states, one per pushed frame. States are
+ * grouped into segments: every keyframe_interval-th state (and every state
+ * of a size other than the previous one) is stored as is, the rest are
+ * stored as XOR against that keyframe, run-length encoded.
+ * Consecutive frames differ in a handful of bytes, so a delta is usually a
+ * few dozen bytes instead of a full save state.
+ *
+ * The oldest segment is dropped as a whole, so the history may be up to
+ * keyframe_interval frames shorter than the capacity.
+ */
+class RewindBuffer {
+public:
+    explicit RewindBuffer(
+        std::size_t capacity_,
+        std::size_t keyframe_interval_ = C8Consts::REFRESH_RATE);
+
+    /**
+     * Records the current state of the VM as the newest frame.
+     */
+    void push(const ChipVM &vm);
+
+    /**
+     * Drops the newest frames and restores the VM to the state it had that
+     * many frames ago. The oldest frame is never dropped.
+     *
+     * \return How many frames it actually stepped back
+     */
+    std::size_t rewind(ChipVM &vm, std::size_t frames = 1);
+
+    void clear();
+
+    std::size_t size() const noexcept { return frames_count; }
+
+    /**
+     * Bytes of the stored states and deltas.
+     */
+    std::size_t memory_usage() const noexcept;
+
+private:
+    using buffer_t = std::vector<uint8_t>;
+
+    struct Segment {
+        buffer_t              keyframe;
+        std::vector<buffer_t> deltas; // of the frames following the keyframe
+    };
+
+    void drop_oldest();
+
+    // Recycling storage of the dropped frames to not allocate every frame.
+    // Keyframes and deltas are pooled separately, so a delta doesn't hold
+    // the memory of a full state.
+    static buffer_t take_buffer(std::vector<buffer_t> &pool);
+    static void     recycle(std::vector<buffer_t> &pool, buffer_t &&buffer);
+
+    const std::size_t capacity;
+    const std::size_t keyframe_interval;
+
+    std::deque<Segment> segments;
+    std::size_t         frames_count = 0;
+
+    std::vector<buffer_t> spare_keyframes;
+    std::vector<buffer_t> spare_deltas;
+    buffer_t              scratch; // state being pushed or restored
+};
+
+#endif /* !REWIND_HPP_ */
@@ -0,0 +1,112 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_rewind_test - pushes frames of a running VM to RewindBuffer,
+ * switching the quirk profile (and so the RAM and state size) on the way,
+ * then rewinds them back one by one and a few at once. Every restored state
+ * must be byte for byte the save state of that frame.
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "quirks.hpp"
+#include "rewind.hpp"
+#include "test_programs.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace {
+constexpr std::size_t capacity          = 100;
+constexpr std::size_t keyframe_interval = 8;
+constexpr std::size_t frames            = 150;
+
+// Instructions per frame
+constexpr uint64_t frame_cycles = 37;
+
+struct ProfileSwitch {
+    std::size_t  frame;
+    QuirkProfile quirks;
+};
+
+// Both are still in the history at the end, RAM grows and then shrinks
+constexpr ProfileSwitch profile_switches[]{
+    {60, QuirkProfile::xochip},
+    {91, QuirkProfile::chip48}};
+} // namespace
+
+int main()
+{
+    ChipVM vm(
+        std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+        std::make_shared<HeadlessImpl::NullKeyboardDriver>(),
+        std::make_shared<HeadlessImpl::NullSoundDriver>());
+
+    vm.timer_mode = TimerMode::virtual_time;
+    vm.seed_random(1);
+    TestPrograms::load(vm, TestPrograms::divergent_branches);
+
+    RewindBuffer                      history(capacity, keyframe_interval);
+    std::vector<std::vector<uint8_t>> states; // of every pushed frame
+
+    for (std::size_t frame = 0; frame < frames; ++frame) {
+        for (const ProfileSwitch &profile_switch : profile_switches)
+            if (profile_switch.frame == frame)
+                vm.set_quirks(profile_switch.quirks);
+
+        vm.run(frame_cycles);
+
+        history.push(vm);
+        states.push_back(vm.save_state());
+    }
+
+    if (history.size() > capacity
+        || history.size() + keyframe_interval <= capacity) {
+        std::cerr << history.size() << " frames kept out of " << capacity
+                  << '\n';
+        return 1;
+    }
+
+    bool passed = true;
+
+    // Restored state must be the one of the newest frame left
+    const auto check = [&](std::size_t expected_steps, std::size_t steps) {
+        const std::size_t kept = history.size();
+        if (steps != expected_steps || vm.save_state() != states[kept - 1]) {
+            std::cerr << "Rewinding to the frame " << kept - 1
+                      << " of the history has failed\n";
+            passed = false;
+        }
+    };
+
+    // History keeps the newest frames, drop the states, that it doesn't
+    states.erase(states.begin(), states.end() - history.size());
+
+    check(5, history.rewind(vm, 5));
+    while (history.size() > 1)
+        check(1, history.rewind(vm));
+
+    // Oldest frame stays
+    check(0, history.rewind(vm));
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "rom_pack.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+template <class T>
+T get(const uint8_t *src) noexcept
+{
+    T value = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        value |= static_cast<T>(src[i]) << (i * CHAR_BIT);
+
+    return value;
+}
+
+template <class T>
+void put(std::vector<uint8_t> &dst, T value)
+{
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        dst.push_back(static_cast<uint8_t>(value >> (i * CHAR_BIT)));
+}
+
+// Offsets of the entry fields
+enum EntryField {
+    entry_hash         = 0,
+    entry_image_offset = 8,
+    entry_name_offset  = 16,
+    entry_image_size   = 24,
+    entry_ipf          = 28,
+    entry_name_size    = 32,
+    entry_quirks       = 34
+};
+} // namespace
+
+uint64_t rom_hash(std::span<const uint8_t> image) noexcept
+{
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (const uint8_t byte : image) {
+        hash ^= byte;
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+RomPack::RomPack(const std::string &file_name) : file(file_name)
+{
+    const uint8_t *   data = file.data();
+    const std::size_t size = file.size();
+
+    const auto malformed = [&file_name] {
+        return std::runtime_error("Malformed ROM pack " + file_name);
+    };
+
+    if (size < header_size || !std::equal(magic, magic + 4, data))
+        throw malformed();
+
+    if (get<uint32_t>(data + 4) != version)
+        throw std::runtime_error(
+            "Unsupported version of ROM pack " + file_name);
+
+    count = get<uint32_t>(data + 8);
+    slots = get<uint32_t>(data + 12);
+
+    // Widened, so the sizes can't overflow
+    const uint64_t tables_end =
+        header_size + uint64_t{count} * entry_size + uint64_t{slots} * 4;
+
+    if (!std::has_single_bit(slots) || slots <= count || tables_end > size)
+        throw malformed();
+
+    const uint8_t *entries = data + header_size;
+    for (std::size_t i = 0; i < count; ++i) {
+        const uint8_t *entry = entries + i * entry_size;
+
+        const uint64_t image_offset = get<uint64_t>(entry + entry_image_offset);
+        const uint64_t image_size   = get<uint32_t>(entry + entry_image_size);
+        const uint64_t name_offset  = get<uint64_t>(entry + entry_name_offset);
+        const uint64_t name_size    = get<uint16_t>(entry + entry_name_size);
+
+        if (image_offset > size || image_size > size - image_offset
+            || name_offset > size || name_size > size - name_offset
+            || entry[entry_quirks] > static_cast<uint8_t>(QuirkProfile::legacy))
+            throw malformed();
+    }
+
+    // Every entry is in the table once, the rest of the slots are empty
+    const uint8_t *table  = entries + count * entry_size;
+    std::size_t    filled = 0;
+
+    for (std::size_t slot = 0; slot < slots; ++slot) {
+        const uint32_t value = get<uint32_t>(table + slot * 4);
+        if (value > count)
+            throw malformed();
+
+        filled += value != 0;
+    }
+
+    if (filled != count)
+        throw malformed();
+}
+
+RomInfo RomPack::rom(std::size_t index) const noexcept
+{
+    const uint8_t *data  = file.data();
+    const uint8_t *entry = data + header_size + index * entry_size;
+
+    RomInfo info;
+    info.hash = get<uint64_t>(entry + entry_hash);
+    info.name = std::string_view(
+        reinterpret_cast<const char *>(
+            data + get<uint64_t>(entry + entry_name_offset)),
+        get<uint16_t>(entry + entry_name_size));
+    info.image = std::span<const uint8_t>(
+        data + get<uint64_t>(entry + entry_image_offset),
+        get<uint32_t>(entry + entry_image_size));
+    info.quirks = static_cast<QuirkProfile>(entry[entry_quirks]);
+    info.ipf    = get<uint32_t>(entry + entry_ipf);
+
+    return info;
+}
+
+std::optional<RomInfo> RomPack::find(uint64_t hash) const noexcept
+{
+    const uint8_t *   entries = file.data() + header_size;
+    const uint8_t *   table   = entries + count * entry_size;
+    const std::size_t mask    = slots - 1;
+
+    // There's always an empty slot, so probing stops
+    for (std::size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+        const uint32_t value = get<uint32_t>(table + slot * 4);
+        if (value == 0)
+            return std::nullopt;
+
+        const std::size_t index = value - 1;
+        if (get<uint64_t>(entries + index * entry_size + entry_hash) == hash)
+            return rom(index);
+    }
+}
+
+bool RomPackBuilder::add(
+    std::string          name,
+    std::vector<uint8_t> image,
+    QuirkProfile         quirks,
+    uint32_t             ipf)
+{
+    if (name.size() > UINT16_MAX || image.size() > UINT32_MAX)
+        throw std::invalid_argument("ROM or its name is too large");
+
+    const uint64_t hash = rom_hash(image);
+    if (!hashes.insert(hash).second)
+        return false;
+
+    roms.push_back({hash, std::move(name), std::move(image), quirks, ipf});
+    return true;
+}
+
+void RomPackBuilder::write(const std::string &file_name) const
+{
+    const std::size_t slots = std::bit_ceil(roms.size() * 2 + 1);
+
+    std::vector<uint32_t> table(slots, 0);
+    for (std::size_t i = 0; i < roms.size(); ++i) {
+        std::size_t slot = roms[i].hash & (slots - 1);
+        while (table[slot] != 0)
+            slot = (slot + 1) & (slots - 1);
+
+        table[slot] = static_cast<uint32_t>(i + 1);
+    }
+
+    std::vector<uint8_t> pack;
+    pack.insert(pack.end(), RomPack::magic, RomPack::magic + 4);
+    put<uint32_t>(pack, RomPack::version);
+    put<uint32_t>(pack, static_cast<uint32_t>(roms.size()));
+    put<uint32_t>(pack, static_cast<uint32_t>(slots));
+
+    // Names and images go right after the tables
+    uint64_t offset = RomPack::header_size
+                      + roms.size() * RomPack::entry_size + slots * 4;
+
+    for (const Rom &rom : roms) {
+        put<uint64_t>(pack, rom.hash);
+        put<uint64_t>(pack, offset + rom.name.size());
+        put<uint64_t>(pack, offset);
+        put<uint32_t>(pack, static_cast<uint32_t>(rom.image.size()));
+        put<uint32_t>(pack, rom.ipf);
+        put<uint16_t>(pack, static_cast<uint16_t>(rom.name.size()));
+        put<uint8_t>(pack, static_cast<uint8_t>(rom.quirks));
+        pack.insert(pack.end(), 5, 0);
+
+        offset += rom.name.size() + rom.image.size();
+    }
+
+    for (const uint32_t slot : table)
+        put<uint32_t>(pack, slot);
+
+    for (const Rom &rom : roms) {
+        pack.insert(pack.end(), rom.name.cbegin(), rom.name.cend());
+        pack.insert(pack.end(), rom.image.cbegin(), rom.image.cend());
+    }
+
+    std::ofstream out(file_name, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(pack.data()), pack.size());
+
+    if (!out)
+        throw std::runtime_error("Failed to write ROM pack " + file_name);
+}
@@ -0,0 +1,120 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROM_PACK_HPP_
+#define ROM_PACK_HPP_
+
+#include "mapped_file.hpp"
+#include "quirks.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * FNV-1a of the ROM image, the key of the ROM in packs.
+ */
+uint64_t rom_hash(std::span<const uint8_t> image) noexcept;
+
+struct RomInfo {
+    uint64_t                 hash = 0;
+    std::string_view         name;
+    std::span<const uint8_t> image;
+    QuirkProfile             quirks = default_quirk_profile;
+    uint32_t                 ipf    = 0; // instructions per frame, 0 if unset
+};
+
+/*
+ * Lots of ROMs in a single mapped file, with a hash table of their content
+ * hashes, so a ROM is found in O(1) without touching the others. Layout
+ * (all the numbers are little-endian):
+ *
+ *   header   "GRPK", u32 version, u32 number of ROMs, u32 number of slots
+ *   entries  entry_size bytes per ROM: u64 hash, u64 image offset,
+ *            u64 name offset, u32 image size, u32 instructions per frame,
+ *            u16 name size, u8 quirk profile, 5 reserved bytes
+ *   slots    u32 per slot: index of the entry plus one, 0 if empty. Number
+ *            of slots is a power of two greater than the number of ROMs,
+ *            entries are placed by linear probing from hash % slots.
+ *   names and images, referred by the offsets from the file start
+ */
+class RomPack {
+public:
+    static constexpr char        magic[4]    = {'G', 'R', 'P', 'K'};
+    static constexpr uint32_t    version     = 1;
+    static constexpr std::size_t header_size = 16;
+    static constexpr std::size_t entry_size  = 40;
+
+    /**
+     * Maps the pack and validates it as a whole, so the lookups don't
+     * check anything. Throws std::runtime_error if it can't be read or is
+     * malformed.
+     */
+    explicit RomPack(const std::string &file_name);
+
+    std::size_t size() const noexcept { return count; }
+
+    RomInfo rom(std::size_t index) const noexcept;
+
+    std::optional<RomInfo> find(uint64_t hash) const noexcept;
+
+private:
+    MappedFile  file;
+    std::size_t count = 0, slots = 0;
+};
+
+/*
+ * Collects ROMs in memory and writes them as a pack.
+ */
+class RomPackBuilder {
+public:
+    /**
+     * \return false if the same ROM has already been added
+     */
+    bool add(
+        std::string          name,
+        std::vector<uint8_t> image,
+        QuirkProfile         quirks,
+        uint32_t             ipf = 0);
+
+    std::size_t size() const noexcept { return roms.size(); }
+
+    /**
+     * Throws std::runtime_error if the file can't be written.
+     */
+    void write(const std::string &file_name) const;
+
+private:
+    struct Rom {
+        uint64_t             hash;
+        std::string          name;
+        std::vector<uint8_t> image;
+        QuirkProfile         quirks;
+        uint32_t             ipf;
+    };
+
+    std::vector<Rom>             roms;
+    std::unordered_set<uint64_t> hashes;
+};
+
+#endif /* !ROM_PACK_HPP_ */
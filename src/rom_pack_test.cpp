@@ -0,0 +1,241 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_rom_pack_test - ROM packs: every ROM of a built pack is found by
+ * its hash with the name, image, profile and instructions per frame it was
+ * added with, ROMs, that aren't in the pack, aren't found. Packs, that are
+ * corrupted in the header, the entries or the hash table, are rejected.
+ */
+
+#include "quirks.hpp"
+#include "rom_pack.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+using bytes_t = std::vector<uint8_t>;
+
+struct Rom {
+    std::string  name;
+    bytes_t      image;
+    QuirkProfile quirks;
+    uint32_t     ipf;
+};
+
+const std::string pack_name =
+    (std::filesystem::temp_directory_path() / "granite_rom_pack_test.grpk")
+        .string();
+
+std::vector<Rom> make_roms(std::size_t count)
+{
+    std::vector<Rom> roms;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        bytes_t image(i * 7 % 64 + 1);
+        for (std::size_t j = 0; j < image.size(); ++j)
+            image[j] = static_cast<uint8_t>(i * 31 + j * 17);
+
+        // The first one has an empty name
+        roms.push_back(
+            {i ? "rom" + std::to_string(i) : "",
+             std::move(image),
+             static_cast<QuirkProfile>(i % 5),
+             static_cast<uint32_t>(i * 100)});
+    }
+
+    return roms;
+}
+
+void build(const std::vector<Rom> &roms)
+{
+    RomPackBuilder builder;
+    for (const Rom &rom : roms)
+        builder.add(rom.name, rom.image, rom.quirks, rom.ipf);
+
+    builder.write(pack_name);
+}
+
+bytes_t read_pack()
+{
+    std::ifstream in(pack_name, std::ios::binary);
+    return bytes_t(std::istreambuf_iterator<char>(in), {});
+}
+
+void write_pack(const bytes_t &pack)
+{
+    std::ofstream out(pack_name, std::ios::binary);
+    out.write(reinterpret_cast<const char *>(pack.data()), pack.size());
+}
+
+bool same(const RomInfo &info, const Rom &rom)
+{
+    return info.hash == rom_hash(rom.image) && info.name == rom.name
+           && bytes_t(info.image.begin(), info.image.end()) == rom.image
+           && info.quirks == rom.quirks && info.ipf == rom.ipf;
+}
+
+/** \return false if any ROM isn't found as it was added */
+bool check_lookup(std::size_t count)
+{
+    const std::vector<Rom> roms = make_roms(count);
+    build(roms);
+
+    const RomPack pack(pack_name);
+    if (pack.size() != count) {
+        std::cerr << count << " ROMs: pack has " << pack.size() << '\n';
+        return false;
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto found = pack.find(rom_hash(roms[i].image));
+
+        if (!same(pack.rom(i), roms[i]) || !found || !same(*found, roms[i])) {
+            std::cerr << count << " ROMs: ROM " << i << " differs\n";
+            return false;
+        }
+    }
+
+    const bytes_t absent{0xDE, 0xAD};
+    if (pack.find(rom_hash(absent))) {
+        std::cerr << count << " ROMs: absent ROM is found\n";
+        return false;
+    }
+
+    return true;
+}
+
+/** \return false if the same ROM is added twice */
+bool check_duplicates()
+{
+    RomPackBuilder builder;
+
+    if (!builder.add("a", {1, 2}, QuirkProfile::chip8)
+        || builder.add("b", {1, 2}, QuirkProfile::xochip)
+        || builder.size() != 1) {
+        std::cerr << "Duplicate ROM is added\n";
+        return false;
+    }
+
+    return true;
+}
+
+// Offsets in the pack, see the layout in rom_pack.hpp
+constexpr std::size_t rom_count      = 5;
+constexpr std::size_t count_offset   = 8, slots_offset = 12;
+constexpr std::size_t entries_offset = RomPack::header_size;
+constexpr std::size_t table_offset =
+    entries_offset + rom_count * RomPack::entry_size;
+
+// Index of the first slot of the table, that is empty (or filled)
+std::size_t find_slot(const bytes_t &pack, bool filled)
+{
+    std::size_t slot = 0;
+    while ((pack[table_offset + slot * 4] != 0) != filled)
+        ++slot;
+
+    return slot;
+}
+
+struct Corruption {
+    const char *                       name;
+    std::function<void(bytes_t &pack)> corrupt;
+};
+
+const std::vector<Corruption> corruptions{
+    {"shorter than the header", [](bytes_t &pack) { pack.resize(8); }},
+    {"truncated", [](bytes_t &pack) { pack.pop_back(); }},
+    {"wrong magic", [](bytes_t &pack) { pack[0] = 'X'; }},
+    {"wrong version", [](bytes_t &pack) { ++pack[4]; }},
+    {"more ROMs than slots", [](bytes_t &pack) { pack[count_offset] = 16; }},
+    {"slots not a power of two",
+     [](bytes_t &pack) { ++pack[slots_offset]; }},
+    {"tables beyond the end",
+     [](bytes_t &pack) {
+         // 2^20 slots, a power of two
+         pack[slots_offset]     = 0;
+         pack[slots_offset + 2] = 0x10;
+     }},
+    {"image beyond the end",
+     [](bytes_t &pack) { pack[entries_offset + 8 + 7] = 0x10; }},
+    {"name beyond the end",
+     [](bytes_t &pack) { pack[entries_offset + 16 + 7] = 0x10; }},
+    {"unknown profile",
+     [](bytes_t &pack) { pack[entries_offset + 34] = 0xFF; }},
+    {"slot out of the entries",
+     [](bytes_t &pack) {
+         pack[table_offset + find_slot(pack, false) * 4] = rom_count + 1;
+     }},
+    {"extra slot",
+     [](bytes_t &pack) {
+         pack[table_offset + find_slot(pack, false) * 4] = 1;
+     }},
+    {"missing slot",
+     [](bytes_t &pack) {
+         const std::size_t slot = find_slot(pack, true);
+         for (std::size_t i = 0; i < 4; ++i)
+             pack[table_offset + slot * 4 + i] = 0;
+     }}};
+
+/** \return false if the corrupted pack is opened */
+bool check_rejected(const Corruption &corruption)
+{
+    build(make_roms(rom_count));
+
+    bytes_t pack = read_pack();
+    corruption.corrupt(pack);
+    write_pack(pack);
+
+    try {
+        RomPack rejected(pack_name);
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+
+    std::cerr << "Pack, that is " << corruption.name << ", is opened\n";
+    return false;
+}
+} // namespace
+
+int main()
+{
+    bool passed = true;
+
+    for (const std::size_t count : {0, 1, 5, 100})
+        passed &= check_lookup(count);
+
+    passed &= check_duplicates();
+
+    for (const Corruption &corruption : corruptions)
+        passed &= check_rejected(corruption);
+
+    std::filesystem::remove(pack_name);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+using namespace std::chrono;
+
+namespace {
+constexpr auto frame_period =
+    duration_cast<steady_clock::duration>(seconds(1)) / C8Consts::REFRESH_RATE;
+
+// If we're late for more than that, the lag is dropped instead of trying to
+// catch up with a burst of frames
+constexpr auto max_lag = frame_period * 5;
+
+// Frames executed between clock checks in turbo mode
+constexpr uint64_t turbo_batch = 16;
+} // namespace
+
+Scheduler::Scheduler(ChipVM &vm_, const SchedulerOptions &options)
+    : vm(vm_),
+      instructions_per_frame(std::max(1U, options.instructions_per_frame)),
+      speed(options.speed),
+      turbo(options.turbo)
+{
+    if (options.rewind_seconds > 0)
+        history = std::make_unique<RewindBuffer>(
+            options.rewind_seconds * C8Consts::REFRESH_RATE);
+}
+
+void Scheduler::run()
+{
+    vm.timer_mode      = TimerMode::virtual_time;
+    vm.cycles_per_tick = instructions_per_frame;
+
+    auto   next_frame   = steady_clock::now();
+    double frame_credit = 0;
+
+    if (history)
+        history->push(vm);
+
+    while (vm.working && !stopping) {
+        if (const uint32_t frames = pending_rewind.exchange(0);
+            frames > 0 && history) {
+            history->rewind(vm, frames);
+            vm.present();
+        }
+
+        if (turbo) {
+            run_frames(turbo_batch);
+
+            // Still present only once per refresh
+            const auto now = steady_clock::now();
+            if (now >= next_frame) {
+                vm.present();
+                next_frame = now + frame_period;
+            }
+            continue;
+        }
+
+        // Fractional speeds accumulate, e.g. 0.5 runs a frame every other
+        // refresh
+        frame_credit += std::max(0.0, speed.load());
+        const auto frames = static_cast<uint64_t>(frame_credit);
+        frame_credit -= frames;
+
+        run_frames(frames);
+        vm.present();
+
+        next_frame += frame_period;
+
+        const auto now = steady_clock::now();
+        if (now - next_frame > max_lag)
+            next_frame = now;
+        else
+            std::this_thread::sleep_until(next_frame);
+    }
+}
+
+void Scheduler::run_frames(uint64_t frames)
+{
+    for (uint64_t frame = 0; frame < frames; ++frame) {
+        if (!vm.working || stopping)
+            return;
+
+        // Idle loops are skipped, so idle frames cost next to nothing
+        vm.run(instructions_per_frame);
+
+        if (history)
+            history->push(vm);
+    }
+}
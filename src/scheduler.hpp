@@ -0,0 +1,90 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SCHEDULER_HPP_
+#define SCHEDULER_HPP_
+
+#include "chipvm.hpp"
+#include "rewind.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+struct SchedulerOptions {
+    // Speed of the emulated machine (and the timers period)
+    uint32_t instructions_per_frame = 10;
+
+    // Fast-forward multiplier, e.g. 2.0 runs two frames per display refresh
+    double speed = 1.0;
+
+    // Run as fast as possible, still presenting at the display refresh rate
+    bool turbo = false;
+
+    // Seconds of history kept for rewinding, 0 disables recording
+    uint32_t rewind_seconds = 0;
+};
+
+/*
+ * Runs the VM in 60 Hz frames: executes instructions_per_frame instructions
+ * (fast-forwarding the idle loops, see ChipVM::skip_idle), presents the
+ * display and sleeps until the next frame. Frames are paced
+ * against the steady clock with drift compensation, i.e. oversleeping one
+ * frame makes the next one shorter.
+ *
+ * Timers are switched to virtual time and tick once per frame, so they
+ * stay in sync with the emulated speed when fast-forwarding.
+ */
+class Scheduler {
+public:
+    explicit Scheduler(
+        ChipVM &                vm_,
+        const SchedulerOptions &options = SchedulerOptions{});
+
+    /**
+     * Blocks until the VM stops working or stop() is called.
+     */
+    void run();
+    void stop() noexcept { stopping = true; }
+
+    // May be changed from other threads while running
+    void set_speed(double speed_) noexcept { speed = speed_; }
+    void set_turbo(bool turbo_) noexcept { turbo = turbo_; }
+
+    /**
+     * Steps the VM back by the given number of frames before the next one,
+     * if rewinding is enabled. Requests made meanwhile add up.
+     */
+    void rewind(uint32_t frames) noexcept { pending_rewind += frames; }
+
+private:
+    void run_frames(uint64_t frames);
+
+    ChipVM &       vm;
+    const uint32_t instructions_per_frame;
+
+    std::atomic<double> speed;
+    std::atomic<bool>   turbo;
+    std::atomic<bool>   stopping = false;
+
+    std::unique_ptr<RewindBuffer> history; // nullptr if rewinding is off
+    std::atomic<uint32_t>         pending_rewind = 0;
+};
+
+#endif /* !SCHEDULER_HPP_ */
@@ -0,0 +1,128 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_scheduler_test - runs a ROM, that exits after a known number of
+ * instructions, by Scheduler in turbo mode, checking that it stops with the
+ * VM and that the timers tick once per frame. Then stops an endless ROM
+ * from another thread.
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "scheduler.hpp"
+#include "test_programs.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+namespace {
+constexpr uint32_t instructions_per_frame = 10;
+
+const TestPrograms::Program counter{
+    "counter",
+    {
+        0x60FF, // 200: LD V0, 255
+        0xF015, // 202: LD DT, V0
+        0x7101, // 204: ADD V1, 1
+        0x3100, // 206: SE V1, 0
+        0x1204, // 208: JP 0x204
+        0x00FD  // 20A: EXIT
+    }};
+
+// LD and LD DT, 256 iterations of the loop, the last one skips the jump,
+// and EXIT
+constexpr uint64_t counter_cycles = 2 + 256 * 3 - 1 + 1;
+
+const TestPrograms::Program endless{"endless", {0x1200}}; // JP 0x200
+
+std::unique_ptr<ChipVM> make_vm(const TestPrograms::Program &program)
+{
+    auto vm = std::make_unique<ChipVM>(
+        std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+        std::make_shared<HeadlessImpl::NullKeyboardDriver>(),
+        std::make_shared<HeadlessImpl::NullSoundDriver>());
+
+    TestPrograms::load(*vm, program);
+
+    return vm;
+}
+
+/** \return false if the ROM hasn't run to its end with the right timers */
+bool check_turbo()
+{
+    auto vm = make_vm(counter);
+
+    SchedulerOptions options;
+    options.instructions_per_frame = instructions_per_frame;
+    options.turbo                  = true;
+
+    Scheduler(*vm, options).run();
+
+    // Timers tick every instructions_per_frame instructions since the
+    // start, the delay timer is set after the first two
+    const uint64_t ticks = counter_cycles / instructions_per_frame;
+
+    if (vm->working || vm->fault != Fault::none
+        || vm->cycles() != counter_cycles || vm->dt != 0xFF - ticks) {
+        std::cerr << "Turbo run: " << vm->cycles() << " instructions, delay"
+                  << " timer " << +vm->dt << ", fault: "
+                  << fault_message(vm->fault) << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+/** \return false if the scheduler hasn't stopped */
+bool check_stop()
+{
+    auto vm = make_vm(endless);
+
+    Scheduler scheduler(*vm);
+
+    std::thread stopper([&scheduler] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        scheduler.stop();
+    });
+
+    scheduler.run();
+    stopper.join();
+
+    if (!vm->working) {
+        std::cerr << "Endless ROM has stopped by itself\n";
+        return false;
+    }
+
+    return true;
+}
+} // namespace
+
+int main()
+{
+    bool passed = true;
+
+    passed &= check_turbo();
+    passed &= check_stop();
+
+    return passed ? 0 : 1;
+}
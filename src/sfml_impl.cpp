@@ -22,6 +22,7 @@
 #include <array>
 #include <cstdint>
 #include <mutex>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -47,20 +48,48 @@ const std::array<KB::Key, 16> key_mapping{
     KB::S,       // D
     KB::Q,       // E
     KB::E};      // F
+
+std::optional<uint8_t> map_key(sf::Keyboard::Key key)
+{
+    const auto key_it =
+        std::find(key_mapping.cbegin(), key_mapping.cend(), key);
+
+    if (key_it == key_mapping.end())
+        return std::nullopt;
+
+    return static_cast<uint8_t>(std::distance(key_mapping.cbegin(), key_it));
 }
+} // namespace
 
 DisplayDriver::DisplayDriver(
     const std::string &   window_title,
     const DisplayOptions &options)
     : scale(options.scale),
-      background_color(options.background_color),
-      pixel_color(options.pixel_color),
+      palette{
+          sf::Color(options.background_color),
+          sf::Color(options.pixel_color),
+          sf::Color(options.plane2_color),
+          sf::Color(options.overlap_color)},
       window(
           sf::VideoMode(options.width, options.height),
           window_title,
-          sf::Style::Titlebar | sf::Style::Close)
+          sf::Style::Titlebar | sf::Style::Close),
+      texture_pixels(Framebuffer::max_width * Framebuffer::max_height * 4)
 {
     window.setVerticalSyncEnabled(true);
+
+    if (!texture.create(Framebuffer::max_width, Framebuffer::max_height))
+        throw std::runtime_error("Failed to create display texture");
+
+    // Scale is given for the low resolution
+    const float texture_scale =
+        scale / (Framebuffer::max_width / C8Consts::DISPLAY_WIDTH);
+
+    texture.setSmooth(false);
+    sprite.setTexture(texture);
+    sprite.setScale(texture_scale, texture_scale);
+
+    upload(Framebuffer{});
 }
 
 void DisplayDriver::work()
@@ -75,65 +104,84 @@ void DisplayDriver::work()
                         callback(event.key.code);
                     break;
 
+                case sf::Event::KeyReleased:
+                    for (const auto &callback : key_release_subscribers)
+                        callback(event.key.code);
+                    break;
+
                 case sf::Event::Closed:
                     window.close();
                     break;
             }
         }
 
-        window.clear(background_color);
-
-        {
-            std::scoped_lock lk(render_mutex);
-            for (const auto &pixel : pixels)
-                window.draw(pixel);
-        }
+        if (frames.update())
+            upload(frames.front());
 
+        window.clear(palette[0]);
+        window.draw(sprite);
         window.display();
     }
 }
 
-void DisplayDriver::subscribe_for_key_press(key_press_callback_t callback)
+void DisplayDriver::subscribe_for_key_press(key_callback_t callback)
 {
     key_press_subscribers.push_back(callback);
 }
 
-void DisplayDriver::render(const std::vector<bool> &display)
+void DisplayDriver::subscribe_for_key_release(key_callback_t callback)
 {
-    std::vector<sf::RectangleShape> temp_pixels;
-    const sf::Vector2f              pixel_size{scale, scale};
+    key_release_subscribers.push_back(callback);
+}
 
-    for (std::size_t i = 0; i < display.size(); ++i) {
-        if (!display[i])
-            continue;
+void DisplayDriver::render(const Framebuffer &display)
+{
+    frames.back() = display;
+    frames.publish();
+}
 
-        const std::size_t x = i % C8Consts::DISPLAY_WIDTH,
-                          y = i / C8Consts::DISPLAY_WIDTH;
+void DisplayDriver::upload(const Framebuffer &display)
+{
+    auto dst = texture_pixels.begin();
 
-        auto &pixel = temp_pixels.emplace_back(pixel_size);
-        pixel.setFillColor(pixel_color);
-        pixel.setPosition({x * scale, y * scale});
-    }
+    // Low resolution pixels are drawn as 2x2 ones
+    const unsigned shift = display.hires() ? 0 : 1;
 
-    {
-        std::scoped_lock lk(render_mutex);
-        temp_pixels.swap(pixels);
+    for (std::size_t y = 0; y < Framebuffer::max_height; ++y) {
+        for (std::size_t x = 0; x < Framebuffer::max_width; ++x) {
+            const sf::Color &color =
+                palette[display.pixel(x >> shift, y >> shift)];
+
+            *dst++ = color.r;
+            *dst++ = color.g;
+            *dst++ = color.b;
+            *dst++ = color.a;
+        }
     }
+
+    texture.update(texture_pixels.data());
 }
 
 // ----------------------------------------------------------------------------
 
 void KeyboardDriver::press_callback(sf::Keyboard::Key key)
 {
-    const auto key_it =
-        std::find(key_mapping.cbegin(), key_mapping.cend(), key);
+    if (const auto chip_key = map_key(key))
+        pressed_keys.fetch_or(1U << *chip_key, std::memory_order_relaxed);
+}
 
-    if (key_it == key_mapping.end())
+void KeyboardDriver::release_callback(sf::Keyboard::Key key)
+{
+    const auto chip_key = map_key(key);
+    if (!chip_key)
         return;
 
+    pressed_keys.fetch_and(~(1U << *chip_key), std::memory_order_relaxed);
+
     {
-        std::scoped_lock lk(key_press_mut);
-        last_pressed_key = std::distance(key_mapping.cbegin(), key_it);
+        std::scoped_lock lk(key_release_mut);
+        ++releases_count;
+        last_released_key = *chip_key;
     }
 
     cv.notify_one();
@@ -141,25 +189,26 @@ void KeyboardDriver::press_callback(sf::Keyboard::Key key)
 
 bool KeyboardDriver::is_pressed(uint8_t key)
 {
-    if (key >= key_mapping.size())
-        throw std::runtime_error(
-            "Key was not found in mapping (index: " + std::to_string(key)
-            + ")");
-
-    return sf::Keyboard::isKeyPressed(key_mapping[key]);
+    return (pressed_keys.load(std::memory_order_relaxed) >> key) & 1U;
 }
 
 uint8_t KeyboardDriver::wait_for_key()
 {
-    std::unique_lock<std::mutex> lk(key_press_mut);
-    cv.wait(lk);
+    std::unique_lock<std::mutex> lk(key_release_mut);
+
+    // Only a release, that happened after the call, counts
+    const uint64_t seen = releases_count;
+    cv.wait(lk, [&] { return releases_count != seen || !working; });
 
-    return last_pressed_key;
+    return last_released_key;
 }
 
 void KeyboardDriver::shutdown()
 {
-    cv.notify_one();
+    {
+        std::scoped_lock lk(key_release_mut);
+        IDriver::shutdown();
+    }
 
-    IDriver::shutdown();
+    cv.notify_one();
 }
@@ -20,9 +20,12 @@
 #define SFML_IMPL_HPP_
 
 #include "chipvm.hpp"
+#include "triple_buffer.hpp"
 
 #include <SFML/Graphics.hpp>
 
+#include <array>
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
@@ -40,10 +43,12 @@ struct DisplayOptions {
     // RGBA format
     uint32_t background_color = 0xF5F5F5FF;
     uint32_t pixel_color      = 0x37474FFF;
+    uint32_t plane2_color     = 0xFF8A65FF; // XO-CHIP second plane
+    uint32_t overlap_color    = 0x8D6E63FF; // both planes
 };
 
 class DisplayDriver : public IDisplayDriver {
-    using key_press_callback_t = std::function<void(sf::Keyboard::Key)>;
+    using key_callback_t = std::function<void(sf::Keyboard::Key)>;
 
 public:
     /*
@@ -59,34 +64,62 @@ public:
      * Blocking function, that processes event loop and rendering
      */
     void work();
-    void subscribe_for_key_press(key_press_callback_t callback);
+    void subscribe_for_key_press(key_callback_t callback);
+    void subscribe_for_key_release(key_callback_t callback);
 
-    void render(const std::vector<bool> &display) override;
+    void render(const Framebuffer &display) override;
 
 private:
-    const float      scale;
-    const sf::Color  background_color, pixel_color;
-    sf::RenderWindow window;
+    // Converts the frame to RGBA and updates the texture (UI thread only)
+    void upload(const Framebuffer &display);
 
-    std::vector<sf::RectangleShape> pixels;
-    std::mutex                      render_mutex;
+    const float                    scale;
+    const std::array<sf::Color, 4> palette; // indexed by the pixel color
+    sf::RenderWindow               window;
 
-    std::vector<key_press_callback_t> key_press_subscribers;
+    // Display is uploaded to the texture and drawn as a single scaled
+    // sprite, always in the high resolution
+    sf::Texture            texture;
+    sf::Sprite             sprite;
+    std::vector<sf::Uint8> texture_pixels; // RGBA
+
+    // Frames from the VM, it never waits for the UI thread
+    TripleBuffer<Framebuffer> frames;
+
+    std::vector<key_callback_t> key_press_subscribers;
+    std::vector<key_callback_t> key_release_subscribers;
 };
 
+/*
+ * Keeps a bitmap of pressed keys, that is updated from the display event
+ * loop (subscribe press_callback and release_callback to the display
+ * driver), so checking a key doesn't involve the OS.
+ */
 class KeyboardDriver : public IKeyboardDriver {
 public:
     void press_callback(sf::Keyboard::Key key);
+    void release_callback(sf::Keyboard::Key key);
 
-    bool    is_pressed(uint8_t key) override;
+    /**
+     * Key index must be less than 16, it's checked by the VM.
+     */
+    bool is_pressed(uint8_t key) override;
+
+    /**
+     * Blocks until some key is released.
+     */
     uint8_t wait_for_key() override;
     void    shutdown() override;
 
 private:
-    std::condition_variable cv;
-    std::mutex              key_press_mut;
+    // Bit per CHIP-8 key
+    std::atomic<uint16_t> pressed_keys = 0;
 
-    uint8_t last_pressed_key = 0;
+    // Release edges for wait_for_key, guarded by key_release_mut
+    std::mutex              key_release_mut;
+    std::condition_variable cv;
+    uint64_t                releases_count    = 0;
+    uint8_t                 last_released_key = 0;
 };
 } // namespace SFMLImpl
 
@@ -0,0 +1,154 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite_state_test - save states: a state saved under every quirk profile
+ * is loaded into a VM of the other profile, saved back unchanged, and both
+ * VMs go on the same way. Malformed blobs (truncated, extended, with a
+ * wrong magic, version or field) are rejected, leaving the VM untouched.
+ */
+
+#include "chipvm.hpp"
+#include "headless_impl.hpp"
+#include "quirks.hpp"
+#include "test_programs.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+using state_t = std::vector<uint8_t>;
+
+// Offsets in the blob, see the layout in chipvm.cpp
+constexpr std::size_t version_offset = 4;
+constexpr std::size_t profile_offset = 16;
+
+std::unique_ptr<ChipVM> make_vm(QuirkProfile quirks, uint64_t seed)
+{
+    auto vm = std::make_unique<ChipVM>(
+        std::make_shared<HeadlessImpl::NullDisplayDriver>(),
+        std::make_shared<HeadlessImpl::NullKeyboardDriver>(),
+        std::make_shared<HeadlessImpl::NullSoundDriver>());
+
+    vm->set_quirks(quirks);
+    vm->timer_mode = TimerMode::virtual_time;
+    vm->seed_random(seed);
+
+    TestPrograms::load(*vm, TestPrograms::divergent_branches);
+    vm->run(1000 + seed);
+
+    return vm;
+}
+
+// Profile, that has the other RAM size
+QuirkProfile other_profile(QuirkProfile quirks)
+{
+    return quirks == QuirkProfile::xochip ? QuirkProfile::chip8
+                                          : QuirkProfile::xochip;
+}
+
+/** \return false if the state hasn't survived the round trip */
+bool check_round_trip(QuirkProfile quirks)
+{
+    const auto    saved  = make_vm(quirks, 1);
+    const state_t state  = saved->save_state();
+    auto          loaded = make_vm(other_profile(quirks), 2);
+
+    if (!loaded->load_state(state.data(), state.size())
+        || loaded->save_state() != state || loaded->quirks() != quirks) {
+        std::cerr << quirk_profile_name(quirks) << ": round trip has failed\n";
+        return false;
+    }
+
+    // Random generator and the rest go on from the same point
+    saved->run(1000);
+    loaded->run(1000);
+
+    if (loaded->save_state() != saved->save_state()) {
+        std::cerr << quirk_profile_name(quirks)
+                  << ": VMs differ after the round trip\n";
+        return false;
+    }
+
+    return true;
+}
+
+struct Corruption {
+    const char *                        name;
+    std::function<void(state_t &state)> corrupt;
+};
+
+const std::vector<Corruption> corruptions{
+    {"empty", [](state_t &state) { state.clear(); }},
+    {"magic only", [](state_t &state) { state.resize(4); }},
+    {"truncated by a byte", [](state_t &state) { state.pop_back(); }},
+    {"extended by a byte", [](state_t &state) { state.push_back(0); }},
+    {"wrong magic", [](state_t &state) { state[0] = 'X'; }},
+    {"wrong version", [](state_t &state) { ++state[version_offset]; }},
+    {"unknown profile", [](state_t &state) { state[profile_offset] = 0xFF; }},
+    {"other profile size",
+     [](state_t &state) {
+         // Everything matches, except for the RAM size
+         state[profile_offset] = static_cast<uint8_t>(
+             other_profile(static_cast<QuirkProfile>(state[profile_offset])));
+     }}};
+
+/** \return false if the blob was loaded or the VM has changed */
+bool check_rejected(QuirkProfile quirks, const Corruption &corruption)
+{
+    state_t state = make_vm(quirks, 1)->save_state();
+    corruption.corrupt(state);
+
+    const auto    vm     = make_vm(other_profile(quirks), 2);
+    const state_t before = vm->save_state();
+
+    if (vm->load_state(state.data(), state.size())) {
+        std::cerr << quirk_profile_name(quirks) << ": " << corruption.name
+                  << " state was loaded\n";
+        return false;
+    }
+
+    if (vm->save_state() != before) {
+        std::cerr << quirk_profile_name(quirks) << ": " << corruption.name
+                  << " state has changed the VM\n";
+        return false;
+    }
+
+    return true;
+}
+} // namespace
+
+int main()
+{
+    bool passed = true;
+
+    for (const QuirkProfile quirks : TestPrograms::profiles) {
+        passed &= check_round_trip(quirks);
+
+        for (const Corruption &corruption : corruptions)
+            passed &= check_rejected(quirks, corruption);
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+
+namespace {
+constexpr std::array<const char *, static_cast<std::size_t>(OpClass::count)>
+    op_class_names{
+        "SYS addr",
+        "CLS",
+        "RET",
+        "JP addr",
+        "CALL addr",
+        "SE Vx, kk",
+        "SNE Vx, kk",
+        "SE Vx, Vy",
+        "LD Vx, kk",
+        "ADD Vx, kk",
+        "LD Vx, Vy",
+        "OR Vx, Vy",
+        "AND Vx, Vy",
+        "XOR Vx, Vy",
+        "ADD Vx, Vy",
+        "SUB Vx, Vy",
+        "SHR Vx",
+        "SUBN Vx, Vy",
+        "SHL Vx",
+        "SNE Vx, Vy",
+        "LD I, addr",
+        "JP V0, addr",
+        "RND Vx, kk",
+        "DRW Vx, Vy, n",
+        "SKP Vx",
+        "SKNP Vx",
+        "LD Vx, DT",
+        "LD Vx, K",
+        "LD DT, Vx",
+        "LD ST, Vx",
+        "ADD I, Vx",
+        "LD F, Vx",
+        "LD B, Vx",
+        "LD [I], Vx",
+        "LD Vx, [I]",
+        "SCD n",
+        "SCR",
+        "SCL",
+        "EXIT",
+        "LOW",
+        "HIGH",
+        "DRW Vx, Vy, 0",
+        "LD HF, Vx",
+        "LD R, Vx",
+        "LD Vx, R",
+        "SCU n",
+        "SAVE Vx - Vy",
+        "LOAD Vx - Vy",
+        "LD I, long",
+        "PLANE n",
+        "AUDIO",
+        "PITCH Vx",
+        "unknown"};
+} // namespace
+
+/*
+ * Mirrors ChipVM::decode of the profiles with the instruction set, so the
+ * instructions, that the set doesn't have, are counted the way they are
+ * executed: as SYS addr or unknown ones.
+ */
+OpClass classify(uint16_t instr, InstructionSet set) noexcept
+{
+    const uint8_t imm = instr & 0xFF, nibble = instr & 0xF;
+    const uint8_t x = (instr >> 8) & 0xF, y = (instr >> 4) & 0xF;
+
+    const bool superchip = set != InstructionSet::chip8;
+    const bool xochip    = set == InstructionSet::xochip;
+
+    switch (instr >> 12) {
+        case 0x0:
+            switch (imm) {
+                case 0xE0:
+                    return OpClass::cls;
+                case 0xEE:
+                    return OpClass::ret;
+            }
+
+            if (!superchip || x != 0x0)
+                return OpClass::sys;
+
+            switch (imm) {
+                case 0xFB:
+                    return OpClass::scr;
+                case 0xFC:
+                    return OpClass::scl;
+                case 0xFD:
+                    return OpClass::exit;
+                case 0xFE:
+                    return OpClass::low;
+                case 0xFF:
+                    return OpClass::high;
+            }
+
+            return y == 0xC              ? OpClass::scd
+                   : xochip && y == 0xD ? OpClass::scu
+                                        : OpClass::sys;
+        case 0x1:
+            return OpClass::jp;
+        case 0x2:
+            return OpClass::call;
+        case 0x3:
+            return OpClass::se_imm;
+        case 0x4:
+            return OpClass::sne_imm;
+        case 0x5:
+            return xochip && nibble == 0x2   ? OpClass::save_range
+                   : xochip && nibble == 0x3 ? OpClass::load_range
+                                             : OpClass::se_reg;
+        case 0x6:
+            return OpClass::ld_imm;
+        case 0x7:
+            return OpClass::add_imm;
+
+        case 0x8:
+            switch (nibble) {
+                case 0x0:
+                    return OpClass::ld_reg;
+                case 0x1:
+                    return OpClass::or_reg;
+                case 0x2:
+                    return OpClass::and_reg;
+                case 0x3:
+                    return OpClass::xor_reg;
+                case 0x4:
+                    return OpClass::add_reg;
+                case 0x5:
+                    return OpClass::sub_reg;
+                case 0x6:
+                    return OpClass::shr;
+                case 0x7:
+                    return OpClass::subn_reg;
+                case 0xE:
+                    return OpClass::shl;
+            }
+            return OpClass::unknown;
+
+        case 0x9:
+            return nibble == 0x0 ? OpClass::sne_reg : OpClass::unknown;
+        case 0xA:
+            return OpClass::ld_i;
+        case 0xB:
+            return OpClass::jp_v0;
+        case 0xC:
+            return OpClass::rnd;
+        case 0xD:
+            return superchip && nibble == 0x0 ? OpClass::drw_large
+                                              : OpClass::drw;
+
+        case 0xE:
+            return imm == 0x9E ? OpClass::skp
+                   : imm == 0xA1 ? OpClass::sknp
+                                 : OpClass::unknown;
+
+        case 0xF:
+            switch (imm) {
+                case 0x07:
+                    return OpClass::ld_vx_dt;
+                case 0x0A:
+                    return OpClass::ld_vx_k;
+                case 0x15:
+                    return OpClass::ld_dt_vx;
+                case 0x18:
+                    return OpClass::ld_st_vx;
+                case 0x1E:
+                    return OpClass::add_i_vx;
+                case 0x29:
+                    return OpClass::ld_f_vx;
+                case 0x33:
+                    return OpClass::ld_b_vx;
+                case 0x55:
+                    return OpClass::ld_mem_vx;
+                case 0x65:
+                    return OpClass::ld_vx_mem;
+            }
+
+            if (superchip) {
+                switch (imm) {
+                    case 0x30:
+                        return OpClass::ld_hf_vx;
+                    case 0x75:
+                        return OpClass::ld_r_vx;
+                    case 0x85:
+                        return OpClass::ld_vx_r;
+                }
+            }
+
+            if (xochip) {
+                switch (imm) {
+                    case 0x00:
+                        return x == 0x0 ? OpClass::ld_i_long : OpClass::unknown;
+                    case 0x01:
+                        return OpClass::plane;
+                    case 0x02:
+                        return x == 0x0 ? OpClass::audio : OpClass::unknown;
+                    case 0x3A:
+                        return OpClass::pitch;
+                }
+            }
+            return OpClass::unknown;
+    }
+
+    return OpClass::unknown;
+}
+
+const char *op_class_name(OpClass op_class) noexcept
+{
+    const auto index = static_cast<std::size_t>(op_class);
+    return index < op_class_names.size() ? op_class_names[index] : "?";
+}
+
+ExecStats &ExecStats::operator+=(const ExecStats &other) noexcept
+{
+    for (std::size_t i = 0; i < opcodes.size(); ++i)
+        opcodes[i] += other.opcodes[i];
+
+    drw_collisions += other.drw_collisions;
+    skips_taken += other.skips_taken;
+    timer_writes += other.timer_writes;
+    key_waits += other.key_waits;
+    stack_high_water = std::max(stack_high_water, other.stack_high_water);
+
+    return *this;
+}
+
+void ExecStats::dump(std::ostream &out) const
+{
+    const uint64_t total =
+        std::accumulate(opcodes.cbegin(), opcodes.cend(), uint64_t{0});
+
+    std::array<std::size_t, static_cast<std::size_t>(OpClass::count)> order;
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](auto a, auto b) {
+        return opcodes[a] > opcodes[b];
+    });
+
+    out << "Executed instructions: " << total << '\n';
+
+    for (const std::size_t i : order) {
+        if (opcodes[i] == 0)
+            break;
+
+        out << "  " << std::left << std::setw(16) << op_class_names[i]
+            << std::right << std::setw(14) << opcodes[i] << std::fixed
+            << std::setprecision(2) << std::setw(8)
+            << 100.0 * opcodes[i] / total << "%\n";
+    }
+
+    out << "DRW collisions:   " << drw_collisions << '\n'
+        << "Skips taken:      " << skips_taken << '\n'
+        << "Timer writes:     " << timer_writes << '\n'
+        << "Key waits:        " << key_waits << '\n'
+        << "Stack high-water: " << +stack_high_water << '\n';
+}
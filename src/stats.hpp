@@ -0,0 +1,136 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STATS_HPP_
+#define STATS_HPP_
+
+#include "quirks.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/*
+ * Execution statistics are gathered only when built with GRANITE_STATS
+ * (see the CMake option of the same name). Otherwise GRANITE_STAT expands
+ * to nothing, so there is no cost at all.
+ */
+#ifdef GRANITE_STATS
+#define GRANITE_STAT(statement) statement
+constexpr bool stats_enabled = true;
+#else
+#define GRANITE_STAT(statement)
+constexpr bool stats_enabled = false;
+#endif
+
+enum class OpClass : uint8_t {
+    sys, // SYS addr, ignored
+    cls,
+    ret,
+    jp,
+    call,
+    se_imm,
+    sne_imm,
+    se_reg,
+    ld_imm,
+    add_imm,
+    ld_reg,
+    or_reg,
+    and_reg,
+    xor_reg,
+    add_reg,
+    sub_reg,
+    shr,
+    subn_reg,
+    shl,
+    sne_reg,
+    ld_i,
+    jp_v0,
+    rnd,
+    drw,
+    skp,
+    sknp,
+    ld_vx_dt,
+    ld_vx_k,
+    ld_dt_vx,
+    ld_st_vx,
+    add_i_vx,
+    ld_f_vx,
+    ld_b_vx,
+    ld_mem_vx,
+    ld_vx_mem,
+
+    // SUPER-CHIP
+    scd,
+    scr,
+    scl,
+    exit,
+    low,
+    high,
+    drw_large,
+    ld_hf_vx,
+    ld_r_vx,
+    ld_vx_r,
+
+    // XO-CHIP
+    scu,
+    save_range,
+    load_range,
+    ld_i_long,
+    plane,
+    audio,
+    pitch,
+
+    unknown,
+
+    count
+};
+
+// Class of the instruction, as the profiles with the instruction set run it
+OpClass     classify(uint16_t instr, InstructionSet set) noexcept;
+const char *op_class_name(OpClass op_class) noexcept;
+
+struct ExecStats {
+    // Executed instructions, indexed by OpClass
+    std::array<uint64_t, static_cast<std::size_t>(OpClass::count)> opcodes{};
+
+    uint64_t drw_collisions = 0; // DRW that erased a pixel
+    uint64_t skips_taken    = 0; // SE, SNE, SKP, SKNP that skipped
+    uint64_t timer_writes   = 0; // LD DT, Vx and LD ST, Vx
+    uint64_t key_waits      = 0; // LD Vx, K
+
+    uint8_t stack_high_water = 0; // deepest stack pointer reached
+
+    uint64_t &operator[](OpClass op_class) noexcept
+    {
+        return opcodes[static_cast<std::size_t>(op_class)];
+    }
+
+    // Sums up counters, e.g. of different ROMs
+    ExecStats &operator+=(const ExecStats &other) noexcept;
+
+    /**
+     * Prints the counters in a human-readable form, opcodes sorted by the
+     * number of executions.
+     */
+    void dump(std::ostream &out) const;
+};
+
+#endif /* !STATS_HPP_ */
@@ -0,0 +1,177 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_PROGRAMS_HPP_
+#define TEST_PROGRAMS_HPP_
+
+#include "chipvm.hpp"
+#include "quirks.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Programs for the differential tests of the execution engines: hand-written
+ * ones, that make the VMs of a group diverge and fault at different times,
+ * and seeded random ones. Random numbers are taken as raw mt19937_64 output,
+ * so the programs are the same on every platform.
+ */
+namespace TestPrograms {
+struct Program {
+    std::string                  name;
+    std::vector<ChipVM::instr_t> instrs;
+};
+
+constexpr QuirkProfile profiles[]{
+    QuirkProfile::chip8,
+    QuirkProfile::chip48,
+    QuirkProfile::superchip,
+    QuirkProfile::xochip,
+    QuirkProfile::legacy};
+
+// RND picks the branch, so VMs seeded differently take different paths
+inline const Program divergent_branches{
+    "divergent branches",
+    {
+        0xC003, // 200: RND V0, 3
+        0x3000, // 202: SE V0, 0
+        0x120E, // 204: JP 0x20E
+        0x7101, // 206: ADD V1, 1
+        0x8214, // 208: ADD V2, V1
+        0x222E, // 20A: CALL 0x22E
+        0x1200, // 20C: JP 0x200
+        0x3001, // 20E: SE V0, 1
+        0x121A, // 210: JP 0x21A
+        0xA300, // 212: LD I, 0x300
+        0xF233, // 214: LD B, V2
+        0xF265, // 216: LD V2, [I]
+        0x1200, // 218: JP 0x200
+        0x8316, // 21A: SHR V3, V1
+        0x830E, // 21C: SHL V3
+        0xD125, // 21E: DRW V1, V2, 5
+        0xF315, // 220: LD DT, V3
+        0xF407, // 222: LD V4, DT
+        0x3400, // 224: SE V4, 0
+        0x1222, // 226: JP 0x222
+        0xE09E, // 228: SKP V0
+        0x1200, // 22A: JP 0x200
+        0x1200, // 22C: JP 0x200
+        0x8124, // 22E: ADD V1, V2
+        0x8125, // 230: SUB V1, V2
+        0x8127, // 232: SUBN V1, V2
+        0x00EE  // 234: RET
+    }};
+
+// Every iteration some of the VMs fault, halt or go on
+inline const Program faults{
+    "faults",
+    {
+        0xC007, // 200: RND V0, 7
+        0x4000, // 202: SNE V0, 0
+        0x00EE, // 204: RET, stack underflow
+        0x4001, // 206: SNE V0, 1
+        0x2208, // 208: CALL 0x208, stack overflow
+        0x4002, // 20A: SNE V0, 2
+        0x121A, // 20C: JP 0x21A
+        0x4003, // 20E: SNE V0, 3
+        0x1FFE, // 210: JP 0xFFE, off the end of the CHIP-8 RAM
+        0x7101, // 212: ADD V1, 1
+        0xD015, // 214: DRW V0, V1, 5
+        0x1200, // 216: JP 0x200
+        0x1200, // 218: JP 0x200
+        0x6520, // 21A: LD V5, 0x20
+        0xE59E  // 21C: SKP V5, invalid key
+    }};
+
+/**
+ * Random mix of all the instructions. Jumps and calls go inside of the
+ * program, and I mostly points at it or right after it, so the programs
+ * modify themselves too.
+ */
+inline Program random_program(uint64_t seed, std::size_t length = 48)
+{
+    struct Template {
+        uint16_t base;
+        uint16_t mask; // of the random bits
+    };
+
+    // ALU ones are twice as likely, as in real programs
+    constexpr std::array<Template, 42> templates{{
+        {0x6000, 0x0FFF}, {0x7000, 0x0FFF}, {0x8000, 0x0FF7}, {0x800E, 0x0FF0},
+        {0x7000, 0x0FFF}, {0x8000, 0x0FF7}, {0xA200, 0x01FF}, {0xF01E, 0x0F00},
+        {0xF029, 0x0F00}, {0xF033, 0x0F00}, {0xF055, 0x0F00}, {0xF065, 0x0F00},
+        {0x3000, 0x0F03}, {0x4000, 0x0F03}, {0x5000, 0x0FF0}, {0x9000, 0x0FF0},
+        {0xD000, 0x0FFF}, {0x00E0, 0x0000}, {0xE09E, 0x0F00}, {0xE0A1, 0x0F00},
+        {0xF00A, 0x0F00}, {0xC000, 0x0FFF}, {0xF007, 0x0F00}, {0xF015, 0x0F00},
+        {0xF018, 0x0F00}, {0x00EE, 0x0000}, {0x00C0, 0x000F}, {0x00FB, 0x0000},
+        {0x00FC, 0x0000}, {0x00FE, 0x0000}, {0x00FF, 0x0000}, {0xF075, 0x0F00},
+        {0xF085, 0x0F00}, {0x5002, 0x0FF0}, {0x5003, 0x0FF0}, {0xF001, 0x0300},
+        {0xF000, 0x0000}, {0xF030, 0x0F00}, {0x00FD, 0x0000}, {0xF002, 0x0000},
+        {0xF03A, 0x0F00}, {0x00D0, 0x000F}}};
+
+    constexpr std::array<uint16_t, 3> jumps{0x1000, 0x2000, 0xB000};
+
+    std::mt19937_64 rng(seed);
+
+    Program program{"random " + std::to_string(seed), {}};
+    for (std::size_t i = 0; i < length; ++i) {
+        const uint16_t bits = static_cast<uint16_t>(rng());
+
+        if (rng() % 6 == 0) {
+            const uint16_t target = C8Consts::USER_SPACE + rng() % length * 2;
+            program.instrs.push_back(jumps[rng() % jumps.size()] | target);
+        }
+        else {
+            const Template &t = templates[rng() % templates.size()];
+            program.instrs.push_back(t.base | (bits & t.mask));
+        }
+    }
+
+    return program;
+}
+
+/**
+ * Hand-written programs and `random_count` random ones.
+ */
+inline std::vector<Program> programs(std::size_t random_count)
+{
+    std::vector<Program> result{divergent_branches, faults};
+    for (uint64_t seed = 1; seed <= random_count; ++seed)
+        result.push_back(random_program(seed));
+
+    return result;
+}
+
+inline void load(ChipVM &vm, const Program &program)
+{
+    auto dst = vm.ram.begin() + C8Consts::USER_SPACE;
+    for (const ChipVM::instr_t instr : program.instrs) {
+        *dst++ = instr >> 8;
+        *dst++ = instr & 0xFF;
+    }
+
+    vm.invalidate_code(C8Consts::USER_SPACE, program.instrs.size() * 2);
+}
+} // namespace TestPrograms
+
+#endif /* !TEST_PROGRAMS_HPP_ */
@@ -0,0 +1,133 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+ThreadPool::ThreadPool(std::size_t threads)
+{
+    if (threads == 0)
+        threads = std::max(1U, std::thread::hardware_concurrency());
+
+    for (std::size_t i = 0; i < threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+
+    for (std::size_t i = 0; i < threads; ++i)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::scoped_lock lk(state_mut);
+        stopping = true;
+    }
+    task_cv.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::submit(task_t task)
+{
+    Queue &queue = *queues[next_queue++ % queues.size()];
+
+    {
+        std::scoped_lock lk(queue.mut);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::scoped_lock lk(state_mut);
+        ++queued;
+        ++pending;
+    }
+    task_cv.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    std::unique_lock lk(state_mut);
+    done_cv.wait(lk, [this] { return pending == 0; });
+}
+
+void ThreadPool::work(std::size_t index)
+{
+    for (;;) {
+        {
+            std::unique_lock lk(state_mut);
+            task_cv.wait(lk, [this] { return stopping || queued > 0; });
+
+            if (queued == 0)
+                return;
+
+            --queued;
+        }
+
+        // The task is reserved by decrementing queued, so it's guaranteed
+        // to be found in one of the queues
+        task_t task;
+        while (!pop(index, task))
+            std::this_thread::yield();
+
+        task();
+
+        bool done;
+        {
+            std::scoped_lock lk(state_mut);
+            done = --pending == 0;
+        }
+
+        if (done)
+            done_cv.notify_all();
+    }
+}
+
+bool ThreadPool::pop(std::size_t index, task_t &task)
+{
+    {
+        Queue &own = *queues[index];
+        std::scoped_lock lk(own.mut);
+
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (std::size_t i = 1; i < queues.size(); ++i) {
+        Queue &victim = *queues[(index + i) % queues.size()];
+        std::scoped_lock lk(victim.mut);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,81 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef THREAD_POOL_HPP_
+#define THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Work-stealing thread pool: every worker has its own queue and takes tasks
+ * from its back, idle workers steal from the front of the others' queues.
+ */
+class ThreadPool {
+public:
+    using task_t = std::function<void()>;
+
+    /**
+     * \param threads Number of workers, 0 means hardware concurrency
+     */
+    explicit ThreadPool(std::size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void submit(task_t task);
+
+    /**
+     * Blocks until all the submitted tasks are finished.
+     */
+    void wait();
+
+    std::size_t size() const noexcept { return workers.size(); }
+
+private:
+    struct Queue {
+        std::mutex         mut;
+        std::deque<task_t> tasks;
+    };
+
+    void work(std::size_t index);
+    bool pop(std::size_t index, task_t &task);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread>            workers;
+
+    // Guards sleeping of idle workers and waiting for completion
+    std::mutex              state_mut;
+    std::condition_variable task_cv, done_cv;
+
+    std::atomic<std::size_t> next_queue = 0;
+    std::size_t              queued     = 0; // guarded by state_mut
+    std::size_t              pending    = 0; // guarded by state_mut
+    bool                     stopping   = false;
+};
+
+#endif /* !THREAD_POOL_HPP_ */
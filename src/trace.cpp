@@ -0,0 +1,131 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+// How long the writer sleeps, when there's nothing to write
+constexpr auto flush_period = std::chrono::milliseconds(1);
+
+void put_u16(uint8_t *dst, uint16_t value) noexcept
+{
+    dst[0] = value & 0xFF;
+    dst[1] = value >> 8;
+}
+} // namespace
+
+Tracer::Tracer(const std::string &file_name, std::size_t capacity)
+    : ring(std::bit_ceil(std::max<std::size_t>(capacity, 2))),
+      mask(ring.size() - 1),
+      file(file_name, std::ios::binary)
+{
+    if (!file)
+        throw std::runtime_error("Failed to open trace file " + file_name);
+
+    std::array<uint8_t, TraceFormat::header_size> header{};
+    std::copy(
+        TraceFormat::magic.cbegin(), TraceFormat::magic.cend(), header.begin());
+    put_u16(&header[4], TraceFormat::version);
+    put_u16(&header[6], TraceFormat::record_size);
+
+    file.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+    flush_thread = std::thread(&Tracer::flush_loop, this);
+}
+
+Tracer::~Tracer() { stop(); }
+
+void Tracer::record(const TraceRecord &record) noexcept
+{
+    const uint64_t pos = head.load(std::memory_order_relaxed);
+
+    // Wait for the writer only if the ring seems to be full
+    if (pos - cached_tail >= ring.size()) {
+        while (pos - (cached_tail = tail.load(std::memory_order_acquire))
+               >= ring.size())
+            std::this_thread::yield();
+    }
+
+    ring[pos & mask] = record;
+    head.store(pos + 1, std::memory_order_release);
+}
+
+void Tracer::stop()
+{
+    if (!flush_thread.joinable())
+        return;
+
+    stopping = true;
+    flush_thread.join();
+    file.close();
+}
+
+void Tracer::flush_loop()
+{
+    std::vector<uint8_t> buffer;
+
+    for (;;) {
+        // Checked before reading the head, so nothing recorded before
+        // stop() is missed
+        const bool last = stopping.load(std::memory_order_acquire);
+
+        const uint64_t end = head.load(std::memory_order_acquire);
+        const uint64_t beg = tail.load(std::memory_order_relaxed);
+
+        if (beg == end) {
+            if (last)
+                return;
+
+            std::this_thread::sleep_for(flush_period);
+            continue;
+        }
+
+        buffer.resize((end - beg) * TraceFormat::record_size);
+
+        uint8_t *dst = buffer.data();
+        for (uint64_t pos = beg; pos < end; ++pos) {
+            const TraceRecord &record = ring[pos & mask];
+
+            put_u16(dst, record.pc);
+            put_u16(dst + 2, record.instr);
+            put_u16(dst + 4, record.i_reg);
+            dst[6] = record.reg;
+            dst[7] = record.value;
+
+            dst += TraceFormat::record_size;
+        }
+
+        // Records are copied out, the producer may reuse their slots
+        tail.store(end, std::memory_order_release);
+
+        file.write(
+            reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    }
+}
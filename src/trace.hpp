@@ -0,0 +1,114 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * One executed instruction. reg is the first general purpose register, that
+ * the instruction has changed (no_reg if none), and value is its new value.
+ */
+struct TraceRecord {
+    static constexpr uint8_t no_reg = 0xFF;
+
+    uint16_t pc    = 0;
+    uint16_t instr = 0;
+    uint16_t i_reg = 0; // after the execution
+    uint8_t  reg   = no_reg;
+    uint8_t  value = 0;
+};
+
+/*
+ * Trace file is a header followed by the records, all the numbers are
+ * little-endian:
+ *
+ *   "GRTR" magic, u16 version, u16 record size,
+ *   (u16 pc, u16 instr, u16 i_reg, u8 reg, u8 value)...
+ */
+namespace TraceFormat {
+constexpr std::array<char, 4> magic{'G', 'R', 'T', 'R'};
+constexpr uint16_t            version     = 1;
+constexpr std::size_t         header_size = magic.size() + 2 + 2;
+constexpr std::size_t         record_size = 8;
+} // namespace TraceFormat
+
+/*
+ * Records executed instructions into a single-producer single-consumer
+ * lock-free ring buffer, that is written to a file by a background thread.
+ * If the writer falls behind, the VM waits for it instead of dropping
+ * records.
+ *
+ * Attach to a VM by pointing ChipVM::tracer to it.
+ */
+class Tracer {
+public:
+    /**
+     * Throws std::runtime_error if the file can't be opened.
+     *
+     * \param capacity Ring buffer size in records, rounded up to a power of
+     * two
+     */
+    explicit Tracer(
+        const std::string &file_name,
+        std::size_t        capacity = 1 << 16);
+    ~Tracer();
+
+    Tracer(const Tracer &) = delete;
+    Tracer &operator=(const Tracer &) = delete;
+
+    /**
+     * Must be called from the single thread, that runs the VM.
+     */
+    void record(const TraceRecord &record) noexcept;
+
+    /**
+     * Writes out the remaining records and closes the file. Called by the
+     * destructor too.
+     */
+    void stop();
+
+    uint64_t recorded() const noexcept { return head.load(); }
+
+private:
+    void flush_loop();
+
+    std::vector<TraceRecord> ring;
+    const std::size_t        mask;
+
+    // Producer and consumer positions, never wrapped
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+
+    uint64_t cached_tail = 0; // producer's view of the tail
+
+    std::ofstream     file;
+    std::atomic<bool> stopping = false;
+    std::thread       flush_thread;
+};
+
+#endif /* !TRACE_HPP_ */
@@ -0,0 +1,270 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * granite-trace - summarizes an execution trace, recorded by the Tracer:
+ * hot instructions, loops (backward jumps) and the call graph.
+ *
+ *   granite-trace [--top N] <trace file>
+ */
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+struct Options {
+    std::size_t top = 20;
+    std::string file_name;
+};
+
+struct Summary {
+    uint64_t records = 0;
+
+    // Executions and the instruction at every address
+    std::vector<uint64_t> pc_hits   = std::vector<uint64_t>(0x10000);
+    std::vector<uint16_t> pc_instrs = std::vector<uint16_t>(0x10000);
+
+    // Keyed by (from << 16 | to)
+    std::unordered_map<uint32_t, uint64_t> backward_jumps;
+    std::unordered_map<uint32_t, uint64_t> calls;
+
+    // Instructions executed in every function itself, without callees
+    std::unordered_map<uint16_t, uint64_t> function_instrs;
+};
+
+std::optional<Options> parse_args(int argc, char *argv[])
+{
+    Options options;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            if (arg == "--top" && i + 1 < argc)
+                options.top = std::stoul(argv[++i]);
+            else if (arg.starts_with("--") || !options.file_name.empty())
+                return std::nullopt;
+            else
+                options.file_name = arg;
+        }
+    }
+    catch (const std::logic_error &) {
+        return std::nullopt;
+    }
+
+    if (options.file_name.empty())
+        return std::nullopt;
+
+    return options;
+}
+
+uint16_t get_u16(const uint8_t *src) noexcept { return src[0] | src[1] << 8; }
+
+TraceRecord decode_record(const uint8_t *src) noexcept
+{
+    TraceRecord record;
+    record.pc    = get_u16(src);
+    record.instr = get_u16(src + 2);
+    record.i_reg = get_u16(src + 4);
+    record.reg   = src[6];
+    record.value = src[7];
+
+    return record;
+}
+
+/*
+ * Reads the trace in chunks, so traces of long runs don't have to fit the
+ * memory.
+ */
+Summary summarize(std::ifstream &file)
+{
+    std::vector<uint8_t> header(TraceFormat::header_size);
+    file.read(reinterpret_cast<char *>(header.data()), header.size());
+
+    if (!file
+        || !std::equal(
+            TraceFormat::magic.cbegin(), TraceFormat::magic.cend(),
+            header.cbegin())
+        || get_u16(&header[4]) != TraceFormat::version
+        || get_u16(&header[6]) != TraceFormat::record_size)
+        throw std::runtime_error("Not a trace file or unsupported version");
+
+    Summary summary;
+
+    // Entry point is the root of the call graph
+    std::vector<uint16_t>      call_stack;
+    std::optional<TraceRecord> prev;
+
+    constexpr std::size_t chunk_records = 1 << 16;
+
+    std::vector<uint8_t> chunk(chunk_records * TraceFormat::record_size);
+
+    while (file) {
+        file.read(reinterpret_cast<char *>(chunk.data()), chunk.size());
+        const std::size_t count = file.gcount() / TraceFormat::record_size;
+
+        for (std::size_t i = 0; i < count; ++i) {
+            const TraceRecord record =
+                decode_record(&chunk[i * TraceFormat::record_size]);
+
+            ++summary.records;
+            ++summary.pc_hits[record.pc];
+            summary.pc_instrs[record.pc] = record.instr;
+
+            if (call_stack.empty())
+                call_stack.push_back(record.pc);
+
+            if (prev) {
+                const uint32_t edge = uint32_t{prev->pc} << 16 | record.pc;
+
+                if (record.pc <= prev->pc && prev->instr != 0x00EE)
+                    ++summary.backward_jumps[edge];
+
+                // CALL addr, that has actually jumped (didn't fault)
+                if ((prev->instr & 0xF000) == 0x2000
+                    && record.pc == (prev->instr & 0xFFF)) {
+                    const uint32_t call =
+                        uint32_t{call_stack.back()} << 16 | record.pc;
+
+                    ++summary.calls[call];
+                    call_stack.push_back(record.pc);
+                }
+                else if (prev->instr == 0x00EE && call_stack.size() > 1) {
+                    call_stack.pop_back();
+                }
+            }
+
+            ++summary.function_instrs[call_stack.back()];
+            prev = record;
+        }
+    }
+
+    return summary;
+}
+
+std::string hex(uint32_t value)
+{
+    std::ostringstream str;
+    str << std::hex << std::uppercase << std::setfill('0') << std::setw(4)
+        << value;
+
+    return str.str();
+}
+
+// Entries of the map with the largest values, the largest first
+template <class Key>
+std::vector<std::pair<Key, uint64_t>>
+top_entries(const std::unordered_map<Key, uint64_t> &map, std::size_t top)
+{
+    std::vector<std::pair<Key, uint64_t>> entries(map.cbegin(), map.cend());
+
+    const std::size_t count = std::min(top, entries.size());
+    std::partial_sort(
+        entries.begin(),
+        entries.begin() + count,
+        entries.end(),
+        [](const auto &a, const auto &b) {
+            return a.second != b.second ? a.second > b.second
+                                        : a.first < b.first;
+        });
+    entries.resize(count);
+
+    return entries;
+}
+
+void print_summary(const Summary &summary, std::size_t top)
+{
+    const double percent = summary.records ? 100.0 / summary.records : 0;
+
+    std::cout << "Instructions: " << summary.records << "\n\nHot PCs:\n";
+
+    std::unordered_map<uint16_t, uint64_t> hits;
+    for (std::size_t pc = 0; pc < summary.pc_hits.size(); ++pc) {
+        if (summary.pc_hits[pc])
+            hits.emplace(pc, summary.pc_hits[pc]);
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    for (const auto &[pc, count] : top_entries(hits, top)) {
+        std::cout << "  0x" << hex(pc) << "  " << hex(summary.pc_instrs[pc])
+                  << std::setw(14) << count << std::setw(8) << count * percent
+                  << "%\n";
+    }
+
+    std::cout << "\nLoops (backward jumps):\n";
+    for (const auto &[edge, count] : top_entries(summary.backward_jumps, top)) {
+        const uint16_t from = edge >> 16, to = edge & 0xFFFF;
+
+        std::cout << "  0x" << hex(from) << " -> 0x" << hex(to)
+                  << std::setw(14) << count << " iterations, "
+                  << (from - to) / 2 + 1 << " instructions long\n";
+    }
+
+    std::cout << "\nCall graph:\n";
+    for (const auto &[edge, count] : top_entries(summary.calls, top)) {
+        std::cout << "  0x" << hex(edge >> 16) << " -> 0x"
+                  << hex(edge & 0xFFFF) << std::setw(14) << count
+                  << " calls\n";
+    }
+
+    std::cout << "\nFunctions (own instructions):\n";
+    for (const auto &[entry, count] : top_entries(summary.function_instrs, top))
+        std::cout << "  0x" << hex(entry) << std::setw(14) << count
+                  << std::setw(8) << count * percent << "%\n";
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const auto options = parse_args(argc, argv);
+    if (!options) {
+        std::cerr << "Usage: granite-trace [--top N] <trace file>\n";
+        return 1;
+    }
+
+    std::ifstream file(options->file_name, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open " << options->file_name << '\n';
+        return 1;
+    }
+
+    try {
+        print_summary(summarize(file), options->top);
+    }
+    catch (const std::runtime_error &ex) {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * granite - CHIP-8 emulator
+ *  Copyright (C) 2020 r4nx
+ *
+ * This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRIPLE_BUFFER_HPP_
+#define TRIPLE_BUFFER_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Lock-free handoff of values from a single writer to a single reader.
+ * Writer fills the back buffer and publishes it, swapping it with the
+ * middle one. Reader swaps the middle buffer with its front one if there is
+ * a new value. Neither side ever waits, and the reader always gets the
+ * newest published value, older unread ones are overwritten.
+ */
+template <class T>
+class TripleBuffer {
+public:
+    // Writer side
+
+    T &back() noexcept { return buffers[back_index]; }
+
+    void publish() noexcept
+    {
+        back_index =
+            middle.exchange(back_index | fresh_bit, std::memory_order_acq_rel)
+            & index_mask;
+    }
+
+    // Reader side
+
+    /**
+     * Takes the newest published value, if any.
+     *
+     * \return Has front() changed
+     */
+    bool update() noexcept
+    {
+        if (!(middle.load(std::memory_order_relaxed) & fresh_bit))
+            return false;
+
+        front_index =
+            middle.exchange(front_index, std::memory_order_acq_rel)
+            & index_mask;
+        return true;
+    }
+
+    const T &front() const noexcept { return buffers[front_index]; }
+
+private:
+    // Middle buffer index with a flag of being published and not read yet
+    static constexpr uint8_t index_mask = 0x3, fresh_bit = 0x4;
+
+    std::array<T, 3> buffers{};
+
+    std::atomic<uint8_t> middle      = 1;
+    uint8_t              back_index  = 0; // writer only
+    uint8_t              front_index = 2; // reader only
+};
+
+#endif /* !TRIPLE_BUFFER_HPP_ */
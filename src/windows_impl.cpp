@@ -22,7 +22,9 @@
 
 #include <array>
 #include <cstdint>
+#include <mutex>
 #include <sstream>
+#include <utility>
 
 const static std::array<uint32_t, 16> key_mapping{
     VK_NUMPAD0,  // 0
@@ -60,7 +62,51 @@ bool WindowsImpl::KeyboardDriver::is_pressed(uint8_t key)
     return GetAsyncKeyState(key_mapping[key]) & (1U << 15);
 }
 
+WindowsImpl::SoundDriver::SoundDriver()
+    : beep_thread(&WindowsImpl::SoundDriver::work, this)
+{}
+
+WindowsImpl::SoundDriver::~SoundDriver()
+{
+    shutdown();
+    beep_thread.join();
+}
+
 void WindowsImpl::SoundDriver::beep_for(uint32_t duration)
 {
-    Beep(750, duration);
+    {
+        std::scoped_lock lk(beep_mut);
+        queued_duration += duration;
+    }
+
+    cv.notify_one();
+}
+
+void WindowsImpl::SoundDriver::shutdown()
+{
+    {
+        std::scoped_lock lk(beep_mut);
+        IDriver::shutdown();
+    }
+
+    cv.notify_one();
+}
+
+void WindowsImpl::SoundDriver::work()
+{
+    for (;;) {
+        uint32_t duration;
+
+        {
+            std::unique_lock lk(beep_mut);
+            cv.wait(lk, [this] { return !working || queued_duration > 0; });
+
+            if (!working)
+                return;
+
+            duration = std::exchange(queued_duration, 0);
+        }
+
+        Beep(750, duration);
+    }
 }
\ No newline at end of file
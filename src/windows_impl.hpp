@@ -24,7 +24,10 @@
 #include <Windows.h>
 
 #include <array>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <thread>
 
 namespace WindowsImpl {
 
@@ -33,9 +36,26 @@ public:
     bool is_pressed(uint8_t key) override;
 };
 
+/*
+ * Beep() blocks for the whole duration, so beeps are played by a separate
+ * thread and beep_for only queues them up.
+ */
 class SoundDriver : public ISoundDriver {
 public:
+    SoundDriver();
+    ~SoundDriver();
+
     void beep_for(uint32_t duration) override;
+    void shutdown() override;
+
+private:
+    void work();
+
+    std::mutex              beep_mut;
+    std::condition_variable cv;
+    uint32_t                queued_duration = 0;
+
+    std::thread beep_thread;
 };
 
 } // namespace WindowsImpl